@@ -0,0 +1,223 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "arena.h"
+
+thread_local FrameArena *threadArena = nullptr;
+
+// arenas outlive their threads, like the stats blocks, and are only reset between frames
+static std::mutex registryLock;
+static std::vector<std::unique_ptr<FrameArena>> registry;
+
+#ifdef RAYTRACER_ALLOC_AUDIT
+thread_local int allocationAuditPause = 0;
+static std::atomic<bool> auditing {false};
+static std::atomic<uint64_t> auditAllocations {0};
+#endif
+
+/* allocate_block()
+ * ----------------------------------------
+ * Take a block for an arena straight from malloc, so it is never counted
+ * by the allocation audit
+ */
+static char *allocate_block(size_t size) {
+    void *data = nullptr;
+    if (posix_memalign(&data, ARENA_ALIGNMENT, size) != 0) {
+        throw std::bad_alloc();
+    }
+    return static_cast<char *>(data);
+}
+
+FrameArena::~FrameArena() {
+    for (int i = 0; i < blockCount; i++) {
+        std::free(blocks[i].data);
+    }
+}
+
+/* allocate()
+ * ----------------------------------------
+ * Hand out bytes from the current block, moving on to the next block that
+ * has room, or adding one, when it is full
+ *
+ * @param size_t bytes
+ * @param size_t alignment a power of two, at most ARENA_ALIGNMENT
+ * @return void* memory that stays valid until reset()
+ */
+void *FrameArena::allocate(size_t bytes, size_t alignment) {
+    while (current < blockCount) {
+        size_t start = (offset + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= blocks[current].size) {
+            offset = start + bytes;
+            return blocks[current].data + start;
+        }
+        if (current + 1 == blockCount) {
+            break;
+        }
+        current++;
+        offset = 0;
+    }
+
+    if (blockCount == ARENA_MAX_BLOCKS) {
+        fprintf(stderr, "Frame arena is out of blocks for %zu bytes\n", bytes);
+        throw std::bad_alloc();
+    }
+    size_t last = blockCount > 0 ? blocks[blockCount - 1].size : ARENA_BLOCK_SIZE / 2;
+    size_t size = std::max(2 * last, (bytes + ARENA_ALIGNMENT - 1) & ~static_cast<size_t>(ARENA_ALIGNMENT - 1));
+    blocks[blockCount] = Block {allocate_block(size), size};
+    current = blockCount++;
+    offset = bytes;
+    return blocks[current].data;
+}
+
+/* reset()
+ * ----------------------------------------
+ * Drop everything allocated. Several blocks are replaced by one as large
+ * as all of them together
+ */
+void FrameArena::reset() {
+    if (blockCount > 1) {
+        size_t total = capacity();
+        for (int i = 0; i < blockCount; i++) {
+            std::free(blocks[i].data);
+        }
+        blocks[0] = Block {allocate_block(total), total};
+        blockCount = 1;
+    }
+    current = 0;
+    offset = 0;
+}
+
+/* capacity()
+ * ----------------------------------------
+ * @return size_t bytes held in all blocks
+ */
+size_t FrameArena::capacity() const {
+    size_t total = 0;
+    for (int i = 0; i < blockCount; i++) {
+        total += blocks[i].size;
+    }
+    return total;
+}
+
+/* register_thread_arena()
+ * ----------------------------------------
+ * Give the calling thread its own arena on first use
+ *
+ * @return FrameArena
+ */
+FrameArena *register_thread_arena() {
+    AllocationAuditPause pause;
+    std::lock_guard<std::mutex> guard(registryLock);
+    registry.push_back(std::unique_ptr<FrameArena>(new FrameArena()));
+    threadArena = registry.back().get();
+    return threadArena;
+}
+
+/* begin_frame()
+ * ----------------------------------------
+ * Reset every thread's arena for a new frame and, with the audit built in,
+ * start counting heap allocations. Call it while no pool batch is running
+ * and nothing from the last frame's arenas is still in use
+ */
+void begin_frame() {
+    {
+        std::lock_guard<std::mutex> guard(registryLock);
+        for (const std::unique_ptr<FrameArena> &arena : registry) {
+            arena->reset();
+        }
+    }
+#ifdef RAYTRACER_ALLOC_AUDIT
+    auditAllocations = 0;
+    auditing = true;
+#endif
+}
+
+/* end_frame()
+ * ----------------------------------------
+ * Close the frame begun by begin_frame(). With the audit built in, abort
+ * if anything was allocated on the heap while it was in flight
+ */
+void end_frame() {
+#ifdef RAYTRACER_ALLOC_AUDIT
+    auditing = false;
+    uint64_t allocations = auditAllocations;
+    if (allocations > 0) {
+        fprintf(stderr, "Allocation audit: %llu heap allocations while a frame was in flight\n",
+                static_cast<unsigned long long>(allocations));
+        std::abort();
+    }
+#endif
+}
+
+#ifdef RAYTRACER_ALLOC_AUDIT
+
+/* audited_allocate()
+ * ----------------------------------------
+ * The global operator new of audit builds: malloc, counting the call if a
+ * frame is in flight and this thread has not paused the audit
+ */
+static void *audited_allocate(size_t size, size_t alignment) {
+    if (auditing.load(std::memory_order_relaxed) && allocationAuditPause == 0) {
+        auditAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    void *data = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        data = std::malloc(size > 0 ? size : 1);
+    } else if (posix_memalign(&data, alignment, size > 0 ? size : 1) != 0) {
+        data = nullptr;
+    }
+    return data;
+}
+
+void *operator new(size_t size) {
+    void *data = audited_allocate(size, 0);
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    void *data = audited_allocate(size, static_cast<size_t>(alignment));
+    if (data == nullptr) {
+        throw std::bad_alloc();
+    }
+    return data;
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return audited_allocate(size, 0);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return audited_allocate(size, 0);
+}
+
+void operator delete(void *data) noexcept { std::free(data); }
+void operator delete[](void *data) noexcept { std::free(data); }
+void operator delete(void *data, size_t) noexcept { std::free(data); }
+void operator delete[](void *data, size_t) noexcept { std::free(data); }
+void operator delete(void *data, std::align_val_t) noexcept { std::free(data); }
+void operator delete[](void *data, std::align_val_t) noexcept { std::free(data); }
+void operator delete(void *data, size_t, std::align_val_t) noexcept { std::free(data); }
+void operator delete[](void *data, size_t, std::align_val_t) noexcept { std::free(data); }
+void operator delete(void *data, const std::nothrow_t &) noexcept { std::free(data); }
+void operator delete[](void *data, const std::nothrow_t &) noexcept { std::free(data); }
+
+#endif //RAYTRACER_ALLOC_AUDIT
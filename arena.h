@@ -0,0 +1,151 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_ARENA_H
+#define RAYTRACINGFROMSCRATCH_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+// first block of a thread's arena, each block it has to add is at least twice the last
+#define ARENA_BLOCK_SIZE (256 * 1024)
+#define ARENA_MAX_BLOCKS 32
+#define ARENA_ALIGNMENT 64
+
+/* FrameArena
+ * ------------------------
+ * Bump allocator for data that lives no longer than one frame. Memory comes
+ * from a few large blocks taken from malloc and is handed out by moving an
+ * offset, nothing is freed on its own. reset() drops everything at once;
+ * if the frame spilled over into several blocks they are merged into one
+ * that holds the whole frame, so a frame of the same size after it never
+ * touches the heap. Only types without destructors can live in an arena
+ */
+class FrameArena {
+public:
+    FrameArena() = default;
+    ~FrameArena();
+
+    FrameArena(const FrameArena &) = delete;
+    FrameArena &operator=(const FrameArena &) = delete;
+
+    void *allocate(size_t bytes, size_t alignment);
+    void reset();
+    size_t capacity() const;
+
+    // count value initialised Ts
+    template <typename T>
+    T *allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is dropped without running destructors");
+        T *array = static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < count; i++) {
+            new (&array[i]) T();
+        }
+        return array;
+    }
+
+    // count copies of value
+    template <typename T>
+    T *allocate(size_t count, const T &value) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is dropped without running destructors");
+        T *array = static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < count; i++) {
+            new (&array[i]) T(value);
+        }
+        return array;
+    }
+
+private:
+    friend class ArenaScope;
+
+    typedef struct Block {
+        char *data {nullptr};
+        size_t size {0};
+    } Block;
+
+    Block blocks[ARENA_MAX_BLOCKS];
+    int blockCount {0};
+    int current {0};
+    size_t offset {0};
+};
+
+/* ArenaScope
+ * ------------------------
+ * Hands everything allocated from an arena during its lifetime back when it
+ * goes out of scope, for scratch that is only needed for one job of a frame
+ */
+class ArenaScope {
+public:
+    explicit ArenaScope(FrameArena &arena) : arena(arena), block(arena.current), offset(arena.offset) {}
+    ~ArenaScope() {
+        arena.current = block;
+        arena.offset = offset;
+    }
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    FrameArena &arena;
+    int block;
+    size_t offset;
+};
+
+extern thread_local FrameArena *threadArena;
+FrameArena *register_thread_arena();
+
+/* frame_arena()
+ * ----------------------------------------
+ * The calling thread's arena, valid until the next begin_frame()
+ */
+inline FrameArena &frame_arena() {
+    FrameArena *arena = threadArena;
+    return arena != nullptr ? *arena : *register_thread_arena();
+}
+
+void begin_frame();
+void end_frame();
+
+/* Allocation audit
+ * ------------------------
+ * Built only when RAYTRACER_ALLOC_AUDIT is defined (cmake
+ * -DRAYTRACER_ALLOC_AUDIT=ON). The global operator new then counts every
+ * heap allocation of every thread between begin_frame() and end_frame(),
+ * and end_frame() aborts with the count if there were any. One time set up
+ * that happens to fall inside a frame, like a thread's first arena or
+ * persistent caches growing, is wrapped in an AllocationAuditPause, and the
+ * arenas' own blocks come from malloc, so neither is counted. The viewer's
+ * window thread is counted too, so the audit is meant for the headless
+ * renderer and the benchmarks
+ */
+#ifdef RAYTRACER_ALLOC_AUDIT
+
+extern thread_local int allocationAuditPause;
+
+class AllocationAuditPause {
+public:
+    AllocationAuditPause() { allocationAuditPause++; }
+    ~AllocationAuditPause() { allocationAuditPause--; }
+
+    AllocationAuditPause(const AllocationAuditPause &) = delete;
+    AllocationAuditPause &operator=(const AllocationAuditPause &) = delete;
+};
+
+#else
+
+// user provided so a guard that does nothing still counts as used
+class AllocationAuditPause {
+public:
+    AllocationAuditPause() {}
+    ~AllocationAuditPause() {}
+
+    AllocationAuditPause(const AllocationAuditPause &) = delete;
+    AllocationAuditPause &operator=(const AllocationAuditPause &) = delete;
+};
+
+#endif //RAYTRACER_ALLOC_AUDIT
+
+#endif //RAYTRACINGFROMSCRATCH_ARENA_H
@@ -0,0 +1,448 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+// Libraries
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// Renderer
+#include "packet.h"
+#include "renderer.h"
+#include "scene.h"
+#include "sphere_soa.h"
+#include "stats.h"
+#include "thread_pool.h"
+#include "trace_path.h"
+
+#define BENCHMARK_VERSION 5
+#define MICRO_SECONDS 0.25
+#define MICRO_RAYS 4096
+#define SCENE_WIDTH 256
+#define SCENE_HEIGHT 256
+#define SCENE_SAMPLES 4
+// packets are cut from blocks of pixels this wide, and packet size / width high
+#define PACKET_BLOCK_WIDTH 4
+
+// FUNCTION DECLARATIONS ---------------------------------------------------
+void print_usage(const char *program);
+// -------------------------------------------------------------------------
+
+/* MicroResult
+ * ------------------------
+ * Average cost of one call of a microbenchmarked function
+ */
+typedef struct MicroResult {
+    const char *name;
+    double nsPerOp;
+    long long operations;
+} MicroResult;
+
+/* SceneResult
+ * ------------------------
+ * End to end numbers for one scene size: closest hit casting of the camera
+ * rays alone and shadow rays from their hits to the point light, each as
+ * single rays and in packets of 4, 8 and 16, and full path tracing through
+ * render_pass(), once one path at a time and once with the wavefront
+ * renderer
+ */
+typedef struct SceneResult {
+    int primitives;
+    double buildMs;
+    long long castRays;
+    double castSeconds;
+    double packetCastSeconds[3];
+    long long shadowRays;
+    double shadowSeconds;
+    double packetShadowSeconds[3];
+    long long pathSamples;
+    double pathSeconds;
+    double wavefrontSeconds;
+#ifdef RAYTRACER_STATS
+    RenderStats pathStats;
+    RenderStats wavefrontStats;
+#endif
+} SceneResult;
+
+static volatile float sink;
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* run_micro()
+ * ----------------------------------------
+ * Call body(i) over rounds of MICRO_RAYS inputs until MICRO_SECONDS have
+ * passed. body returns a float that is folded into a volatile so the call
+ * cannot be optimised away
+ */
+template <typename Body>
+static MicroResult run_micro(const char *name, Body body) {
+    float total = 0.0f;
+    for (int i = 0; i < MICRO_RAYS; i++) {
+        total += body(i);
+    }
+
+    long long operations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        for (int i = 0; i < MICRO_RAYS; i++) {
+            total += body(i);
+        }
+        operations += MICRO_RAYS;
+        elapsed = seconds_since(start);
+    } while (elapsed < MICRO_SECONDS);
+    sink = total;
+    return MicroResult {name, elapsed * 1e9 / operations, operations};
+}
+
+/* random_scene()
+ * ----------------------------------------
+ * Default scene for four primitives, otherwise that many small spheres
+ * scattered in a box in front of the camera under the default lights
+ */
+static void random_scene(Scene &scene, int primitives) {
+    load_default_scene(scene);
+    if (primitives == static_cast<int>(scene.objects.size())) {
+        return;
+    }
+    std::mt19937 rng(primitives);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float radius = 2.0f / std::cbrt(static_cast<float>(primitives));
+    scene.objects.clear();
+    for (int i = 0; i < primitives; i++) {
+        Sphere sphere;
+        sphere.centre = Vec3 {unit(rng) * 8 - 4, unit(rng) * 8 - 4, unit(rng) * 8 + 3};
+        sphere.radius = radius * (0.5f + unit(rng));
+        sphere.color = Vec3i {static_cast<int>(unit(rng) * 255), static_cast<int>(unit(rng) * 255), static_cast<int>(unit(rng) * 255)};
+        sphere.specular = -1;
+        scene.objects.push_back(sphere);
+    }
+    prepare_scene(scene);
+}
+
+/* run_micro_benchmarks()
+ * ----------------------------------------
+ * Time the per ray building blocks on fixed random inputs against the
+ * default scene
+ */
+static std::vector<MicroResult> run_micro_benchmarks() {
+    Scene scene;
+    load_default_scene(scene);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Vec3> directions(MICRO_RAYS);
+    std::vector<Vec3> points(MICRO_RAYS);
+    std::vector<Vec3> normals(MICRO_RAYS);
+    std::vector<float> r1(MICRO_RAYS), r2(MICRO_RAYS);
+    for (int i = 0; i < MICRO_RAYS; i++) {
+        directions[i] = view_to_canvas(static_cast<int>(unit(rng) * 600) - 300, static_cast<int>(unit(rng) * 600) - 300, 600, 600);
+        normals[i] = Vec3 {unit(rng) - 0.5f, unit(rng), unit(rng) - 0.5f}.normalize();
+        points[i] = scene.objects[0].centre + normals[i] * scene.objects[0].radius;
+        r1[i] = unit(rng);
+        r2[i] = unit(rng);
+    }
+    Vec3 origin = {0, 0, 0};
+    const Sphere &sphere = scene.objects[0];
+    Triangle triangle;
+    triangle.v0 = Vec3 {-1, -1, 3};
+    triangle.v1 = Vec3 {1, -1, 3};
+    triangle.v2 = Vec3 {0, 1, 3};
+    Sampler sampler(SAMPLER_RANDOM, 1);
+
+    std::vector<MicroResult> results;
+    results.push_back(run_micro("intersect_ray_sphere", [&](int i) {
+        float t1, t2;
+        return intersect_ray_sphere(origin, directions[i], sphere, t1, t2) ? t2 : 0.0f;
+    }));
+    results.push_back(run_micro("Sphere::intersect_ray_sphere", [&](int i) {
+        float distance = 0.0f;
+        return sphere.intersect_ray_sphere(origin, directions[i], 1000.0f, 0.001f, distance) ? distance : 0.0f;
+    }));
+    results.push_back(run_micro("Triangle::ray_triangle_intersection", [&](int i) {
+        float t = 0.0f;
+        return triangle.ray_triangle_intersection(origin, directions[i], &t) ? t : 0.0f;
+    }));
+    results.push_back(run_micro("closest_hit", [&](int i) {
+        Hit hit;
+        return closest_hit(scene, origin, directions[i], 1000.0f, hit) ? hit.t : 0.0f;
+    }));
+    results.push_back(run_micro("compute_direct_lighting_sphere", [&](int i) {
+        sampler.start_sample(i, 0, 0, 0);
+        return static_cast<float>(compute_direct_lighting_sphere(scene, points[i], normals[i], -directions[i], -1, sampler));
+    }));
+    results.push_back(run_micro("sample_hemisphere", [&](int i) {
+        return sample_hemisphere(r1[i], r2[i]).y;
+    }));
+    return results;
+}
+
+/* point_light()
+ * ----------------------------------------
+ * Position of the first point light of the scene, the target of the shadow
+ * ray benchmark
+ */
+static bool point_light(const Scene &scene, Vec3 &position) {
+    const LightSoA &lights = scene.lightSoA;
+    for (int i = 0; i < lights.count; i++) {
+        if (lights.type[i] == LIGHT_POINT) {
+            position = Vec3 {lights.x[i], lights.y[i], lights.z[i]};
+            return true;
+        }
+    }
+    return false;
+}
+
+/* for_each_packet()
+ * ----------------------------------------
+ * Cut the canvas into blocks of PACKET_BLOCK_WIDTH by size / PACKET_BLOCK_WIDTH
+ * pixels and hand each block's pixels to fn(pixels, count), a row of blocks
+ * per pool job
+ */
+template <typename Fn>
+static void for_each_packet(ThreadPool &pool, int size, Fn fn) {
+    int blockHeight = size / PACKET_BLOCK_WIDTH;
+    pool.run(SCENE_HEIGHT / blockHeight, [&](int row, int) {
+        int pixels[PACKET_MAX];
+        for (int x0 = 0; x0 < SCENE_WIDTH; x0 += PACKET_BLOCK_WIDTH) {
+            int count = 0;
+            for (int y = row * blockHeight; y < (row + 1) * blockHeight; y++) {
+                for (int x = x0; x < x0 + PACKET_BLOCK_WIDTH; x++) {
+                    pixels[count++] = y * SCENE_WIDTH + x;
+                }
+            }
+            fn(pixels, count);
+        }
+    });
+}
+
+/* run_packet_benchmark()
+ * ----------------------------------------
+ * Cast the camera rays of the canvas again in packets of each size, then
+ * trace a shadow ray from every camera hit to the point light, singly and
+ * in packets of the hits of each block
+ */
+static void run_packet_benchmark(ThreadPool &pool, const Scene &scene, Vec3 origin, const std::vector<float> &depth,
+                                 SceneResult &result) {
+    const int sizes[3] = {4, 8, 16};
+    for (int i = 0; i < 3; i++) {
+        for_each_packet(pool, sizes[i], [&](const int pixels[], int count) {
+            RayPacket packet;
+            PacketHits hits;
+            packet.count = count;
+            for (int lane = 0; lane < count; lane++) {
+                int px = pixels[lane] % SCENE_WIDTH, py = pixels[lane] / SCENE_WIDTH;
+                packet.set(lane, origin, view_to_canvas(px - SCENE_WIDTH / 2, SCENE_HEIGHT / 2 - py - 1, SCENE_WIDTH, SCENE_HEIGHT), 1000.0f);
+            }
+            intersect_packet(scene, packet, sizes[i], hits);
+            sink = hits.t[0];
+        });
+        result.packetCastSeconds[i] = pool.batch_seconds();
+    }
+
+    Vec3 light {};
+    if (!point_light(scene, light)) {
+        return;
+    }
+    std::vector<Vec3> points(depth.size());
+    for (int py = 0; py < SCENE_HEIGHT; py++) {
+        for (int px = 0; px < SCENE_WIDTH; px++) {
+            int pixel = py * SCENE_WIDTH + px;
+            Vec3 direction = view_to_canvas(px - SCENE_WIDTH / 2, SCENE_HEIGHT / 2 - py - 1, SCENE_WIDTH, SCENE_HEIGHT);
+            if (depth[pixel] < 1000.0f) {
+                points[pixel] = origin + direction * depth[pixel];
+                result.shadowRays++;
+            }
+        }
+    }
+
+    pool.run(SCENE_HEIGHT, [&](int py, int) {
+        int blocked = 0;
+        for (int pixel = py * SCENE_WIDTH; pixel < (py + 1) * SCENE_WIDTH; pixel++) {
+            if (depth[pixel] < 1000.0f) {
+                blocked += occluded(scene, points[pixel], light - points[pixel], TMIN, 1.0f);
+            }
+        }
+        sink = static_cast<float>(blocked);
+    });
+    result.shadowSeconds = pool.batch_seconds();
+
+    for (int i = 0; i < 3; i++) {
+        for_each_packet(pool, sizes[i], [&](const int pixels[], int count) {
+            RayPacket packet;
+            packet.count = 0;
+            for (int lane = 0; lane < count; lane++) {
+                if (depth[pixels[lane]] < 1000.0f) {
+                    packet.set(packet.count++, points[pixels[lane]], light - points[pixels[lane]], 1.0f);
+                }
+            }
+            if (packet.count > 0) {
+                sink = static_cast<float>(occluded_packet(scene, packet, sizes[i], TMIN));
+            }
+        });
+        result.packetShadowSeconds[i] = pool.batch_seconds();
+    }
+}
+
+/* run_scene_benchmark()
+ * ----------------------------------------
+ * Build a scene of the given size, cast one closest hit ray per pixel on the
+ * pool, compare it and shadow rays to packet traversal, then path trace
+ * SCENE_SAMPLES paths per pixel with render_pass(), one path at a time and
+ * then in wavefront mode
+ */
+static SceneResult run_scene_benchmark(ThreadPool &pool, int primitives) {
+    SceneResult result {};
+    result.primitives = primitives;
+    Scene scene;
+    auto start = std::chrono::steady_clock::now();
+    random_scene(scene, primitives);
+    result.buildMs = seconds_since(start) * 1000.0;
+
+    Vec3 origin = {0, 0, 0};
+    std::vector<float> depth(SCENE_WIDTH * SCENE_HEIGHT);
+    pool.run(SCENE_HEIGHT, [&](int py, int) {
+        for (int px = 0; px < SCENE_WIDTH; px++) {
+            Vec3 direction = view_to_canvas(px - SCENE_WIDTH / 2, SCENE_HEIGHT / 2 - py - 1, SCENE_WIDTH, SCENE_HEIGHT);
+            Hit hit;
+            closest_hit(scene, origin, direction, 1000.0f, hit);
+            depth[py * SCENE_WIDTH + px] = hit.t;
+        }
+    });
+    result.castRays = static_cast<long long>(SCENE_WIDTH) * SCENE_HEIGHT;
+    result.castSeconds = pool.batch_seconds();
+    run_packet_benchmark(pool, scene, origin, depth, result);
+
+    Framebuffer framebuffer(SCENE_WIDTH, SCENE_HEIGHT);
+    RenderSettings settings;
+    settings.samplesPerPixel = SCENE_SAMPLES;
+    result.pathSamples = static_cast<long long>(SCENE_WIDTH) * SCENE_HEIGHT * SCENE_SAMPLES;
+    for (bool wavefront : {false, true}) {
+        settings.wavefront = wavefront;
+        reset_accumulation(framebuffer);
+#ifdef RAYTRACER_STATS
+        collect_render_stats();
+#endif
+        // the wavefront renderer runs several batches per pass, so both are timed by the wall clock
+        start = std::chrono::steady_clock::now();
+        render_pass(pool, framebuffer, origin, scene, settings);
+        (wavefront ? result.wavefrontSeconds : result.pathSeconds) = seconds_since(start);
+#ifdef RAYTRACER_STATS
+        (wavefront ? result.wavefrontStats : result.pathStats) = collect_render_stats();
+#endif
+    }
+    return result;
+}
+
+/* write_json()
+ * ----------------------------------------
+ * Emit every result as one JSON document
+ */
+static void write_json(FILE *file, int threads, const std::vector<MicroResult> &micro, const std::vector<SceneResult> &scenes) {
+    fprintf(file, "{\n  \"version\": %d,\n  \"sphere_kernel\": \"%s\",\n  \"threads\": %d,\n", BENCHMARK_VERSION,
+            sphere_kernel_name(), threads);
+    fprintf(file, "  \"micro\": [\n");
+    for (size_t i = 0; i < micro.size(); i++) {
+        fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"operations\": %lld}%s\n", micro[i].name,
+                micro[i].nsPerOp, micro[i].operations, i + 1 < micro.size() ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"scenes\": [\n");
+    for (size_t i = 0; i < scenes.size(); i++) {
+        const SceneResult &scene = scenes[i];
+        fprintf(file, "    {\"primitives\": %d, \"build_ms\": %.2f, \"width\": %d, \"height\": %d,\n", scene.primitives,
+                scene.buildMs, SCENE_WIDTH, SCENE_HEIGHT);
+        fprintf(file, "     \"cast\": {\"rays\": %lld, \"seconds\": %.6f, \"mrays_per_s\": %.3f, \"ns_per_ray\": %.2f},\n",
+                scene.castRays, scene.castSeconds, scene.castRays / scene.castSeconds * 1e-6,
+                scene.castSeconds * 1e9 / scene.castRays);
+        fprintf(file, "     \"packet_cast\": {\"mrays_per_s\": {\"4\": %.3f, \"8\": %.3f, \"16\": %.3f}},\n",
+                scene.castRays / scene.packetCastSeconds[0] * 1e-6, scene.castRays / scene.packetCastSeconds[1] * 1e-6,
+                scene.castRays / scene.packetCastSeconds[2] * 1e-6);
+        if (scene.shadowRays > 0) {
+            fprintf(file, "     \"shadow\": {\"rays\": %lld, \"seconds\": %.6f, \"mrays_per_s\": %.3f, "
+                          "\"packet_mrays_per_s\": {\"4\": %.3f, \"8\": %.3f, \"16\": %.3f}},\n",
+                    scene.shadowRays, scene.shadowSeconds, scene.shadowRays / scene.shadowSeconds * 1e-6,
+                    scene.shadowRays / scene.packetShadowSeconds[0] * 1e-6, scene.shadowRays / scene.packetShadowSeconds[1] * 1e-6,
+                    scene.shadowRays / scene.packetShadowSeconds[2] * 1e-6);
+        }
+        for (bool wavefront : {false, true}) {
+            double seconds = wavefront ? scene.wavefrontSeconds : scene.pathSeconds;
+            fprintf(file, "     \"%s\": {\"samples\": %lld, \"seconds\": %.6f, \"samples_per_s\": %.1f, \"ns_per_sample\": %.2f",
+                    wavefront ? "wavefront" : "path", scene.pathSamples, seconds, scene.pathSamples / seconds,
+                    seconds * 1e9 / scene.pathSamples);
+#ifdef RAYTRACER_STATS
+            const uint64_t *counters = (wavefront ? scene.wavefrontStats : scene.pathStats).counters;
+            uint64_t rays = counters[STAT_CAMERA_RAYS] + counters[STAT_INDIRECT_RAYS] + counters[STAT_SHADOW_RAYS];
+            double perRay = rays > 0 ? 1.0 / rays : 0.0;
+            fprintf(file, ",\n      \"stats\": {\"camera_rays\": %llu, \"indirect_rays\": %llu, \"shadow_rays\": %llu, "
+                          "\"sphere_tests_per_ray\": %.2f, \"triangle_tests_per_ray\": %.2f, \"shape_tests_per_ray\": %.2f, "
+                          "\"bvh_nodes_per_ray\": %.2f}",
+                    (unsigned long long) counters[STAT_CAMERA_RAYS], (unsigned long long) counters[STAT_INDIRECT_RAYS],
+                    (unsigned long long) counters[STAT_SHADOW_RAYS], counters[STAT_SPHERE_TESTS] * perRay,
+                    counters[STAT_TRIANGLE_TESTS] * perRay, counters[STAT_SHAPE_TESTS] * perRay, counters[STAT_BVH_NODES] * perRay);
+#endif
+            fprintf(file, "}%s\n", wavefront ? "" : ",");
+        }
+        fprintf(file, "    }%s\n", i + 1 < scenes.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+/* main()
+ * ----------------------
+ * Run the microbenchmarks and the end to end scenes (4, 1k, 100k and 1M
+ * primitives) and print the results as JSON, or write them to --output
+ */
+int main(int argc, char *argv[]) {
+    int threads = 0;
+    int maxPrimitives = 1000000;
+    std::string output;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--threads") && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-primitives") && hasValue) {
+            maxPrimitives = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    ThreadPool pool(threads);
+    std::vector<MicroResult> micro = run_micro_benchmarks();
+    std::vector<SceneResult> scenes;
+    for (int primitives : {4, 1000, 100000, 1000000}) {
+        if (primitives <= maxPrimitives) {
+            scenes.push_back(run_scene_benchmark(pool, primitives));
+        }
+    }
+
+    FILE *file = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not write %s\n", output.c_str());
+        return 1;
+    }
+    write_json(file, pool.size(), micro, scenes);
+    if (file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+/* print_usage()
+ * ----------------------
+ * Print the command line options of the benchmark runner
+ */
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--threads T] [--max-primitives N] [--output results.json]\n", program);
+}
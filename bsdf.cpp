@@ -0,0 +1,135 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include "bsdf.h"
+#include "trace_path.h"
+
+/* specular_share()
+ * ----------------------------------------
+ * Part k_s of the reflectance given to the Phong lobe, the rest goes to
+ * the Lambertian base. Taken as w / (1 + w) with w = 2 / (n + 2), so the
+ * peak of the normalised lobe stays near 1 / pi as n grows. It is also the
+ * chance of sampling the lobe rather than the diffuse one
+ */
+static float specular_share(int specular) {
+    if (specular < 0) {
+        return 0.0f;
+    }
+    float weight = 2.0f / (specular + 2.0f);
+    return weight / (1.0f + weight);
+}
+
+/* lobe_cosine()
+ * ----------------------------------------
+ * cos(alpha) between a direction and the view mirrored about the normal,
+ * zero outside the lobe
+ */
+static float lobe_cosine(Vec3 normal, Vec3 view, Vec3 direction) {
+    Vec3 mirror = normal * (2.0f * normal.dot(view)) - view;
+    return std::max(mirror.dot(direction), 0.0f);
+}
+
+/* phong_brdf()
+ * ----------------------------------------
+ * The BRDF for a white surface, to be multiplied by the albedo. Both lobes
+ * are normalised and weighted by k_s, so the surface never reflects more
+ * than reaches it
+ *
+ * @param Vec3 normal unit
+ * @param Vec3 view unit
+ * @param int specular exponent, negative for none
+ * @param Vec3 direction unit, towards the light
+ * @return float f / albedo
+ */
+float phong_brdf(Vec3 normal, Vec3 view, int specular, Vec3 direction) {
+    if (normal.dot(direction) <= 0.0f) {
+        return 0.0f;
+    }
+    if (specular < 0) {
+        return static_cast<float>(M_1_PI);
+    }
+    float share = specular_share(specular);
+    float exponent = static_cast<float>(specular);
+    return ((1.0f - share) + share * (exponent + 2.0f) * 0.5f * std::pow(lobe_cosine(normal, view, direction), exponent)) *
+           static_cast<float>(M_1_PI);
+}
+
+/* phong_pdf()
+ * ----------------------------------------
+ * Density in solid angle of sample_phong() drawing a direction above the
+ * surface
+ *
+ * @param Vec3 normal unit
+ * @param Vec3 view unit
+ * @param int specular exponent, negative for none
+ * @param Vec3 direction unit
+ * @return float pdf
+ */
+float phong_pdf(Vec3 normal, Vec3 view, int specular, Vec3 direction) {
+    float cosTheta = normal.dot(direction);
+    if (cosTheta <= 0.0f) {
+        return 0.0f;
+    }
+    float share = specular_share(specular);
+    float pdf = (1.0f - share) * cosTheta * static_cast<float>(M_1_PI);
+    if (specular >= 0) {
+        float exponent = static_cast<float>(specular);
+        pdf += share * (exponent + 1.0f) * 0.5f * static_cast<float>(M_1_PI) *
+               std::pow(lobe_cosine(normal, view, direction), exponent);
+    }
+    return pdf;
+}
+
+/* sample_phong()
+ * ----------------------------------------
+ * Draw a direction from the BSDF. lobe picks between the specular and the
+ * diffuse lobe, u and v place the direction within it. Directions of the
+ * specular lobe can fall below the surface, those are rejected
+ *
+ * @param Vec3 normal unit
+ * @param Vec3 view unit
+ * @param int specular exponent, negative for none
+ * @param float u
+ * @param float v
+ * @param float lobe
+ * @param[out] Vec3 direction unit
+ * @param[out] float pdf of the direction, see phong_pdf()
+ * @return bool whether a direction above the surface was drawn
+ */
+bool sample_phong(Vec3 normal, Vec3 view, int specular, float u, float v, float lobe, Vec3 &direction, float &pdf) {
+    if (lobe < specular_share(specular)) {
+        Vec3 mirror = normal * (2.0f * normal.dot(view)) - view;
+        Vec3 tangent {}, bitangent {};
+        local_coordinates(mirror, tangent, bitangent);
+        float cosAlpha = std::pow(u, 1.0f / (specular + 1.0f));
+        float sinAlpha = std::sqrt(std::max(1.0f - cosAlpha * cosAlpha, 0.0f));
+        float phi = 2.0f * static_cast<float>(M_PI) * v;
+        direction = bitangent * (sinAlpha * std::cos(phi)) + mirror * cosAlpha + tangent * (sinAlpha * std::sin(phi));
+    } else {
+        Vec3 tangent {}, bitangent {};
+        local_coordinates(normal, tangent, bitangent);
+        Vec3 s = sample_cosine_hemisphere(u, v);
+        direction = bitangent * s.x + normal * s.y + tangent * s.z;
+    }
+    pdf = phong_pdf(normal, view, specular, direction);
+    return pdf > 0.0f;
+}
+
+/* sample_cosine_hemisphere()
+ * ----------------------------------------
+ * Unit vector in the hemisphere around +y with density cos(theta) / pi, so
+ * the cosine of the rendering equation cancels against the pdf
+ *
+ * @param float r1
+ * @param float r2
+ * @return Vec3 sample
+ */
+Vec3 sample_cosine_hemisphere(float r1, float r2) {
+    float sinTheta = std::sqrt(r1);
+    float cosTheta = std::sqrt(std::max(1.0f - r1, 0.0f));
+    float phi = 2.0f * static_cast<float>(M_PI) * r2;
+    return Vec3 {sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi)};
+}
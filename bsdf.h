@@ -0,0 +1,46 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_BSDF_H
+#define RAYTRACINGFROMSCRATCH_BSDF_H
+
+#include "renderer_math.h"
+
+/* Phong BSDF
+ * ------------------------
+ * Every surface reflects
+ *     f = albedo * ((1 - k_s) / pi + k_s * (n + 2) / (2 pi) * cos^n(alpha)),
+ * a Lambertian base plus, for a specular exponent n that is not negative, a
+ * normalised Phong lobe around the mirror direction, alpha being the angle
+ * between the light direction and the mirrored view. Either lobe reflects
+ * at most all the light reaching it, so with k_s in 0..1 the surface
+ * reflects at most its albedo. Surfaces without a lobe have k_s = 0.
+ * Lights are given in units where a white surface facing a light of
+ * intensity I reflects I, so the direct light of one is
+ * pi * f * cos(theta) * I.
+ *
+ * sample_phong() picks the lobe to sample with chance k_s, the diffuse one
+ * with cosine weighted directions and the specular one with directions
+ * distributed as cos^n(alpha), and phong_pdf() is the combined density of
+ * both in solid angle. view and direction point away from the surface and
+ * normal is unit length
+ */
+float phong_brdf(Vec3 normal, Vec3 view, int specular, Vec3 direction);
+float phong_pdf(Vec3 normal, Vec3 view, int specular, Vec3 direction);
+bool sample_phong(Vec3 normal, Vec3 view, int specular, float u, float v, float lobe, Vec3 &direction, float &pdf);
+Vec3 sample_cosine_hemisphere(float r1, float r2);
+
+/* power_heuristic()
+ * ----------------------------------------
+ * Veach's power heuristic with exponent 2: the multiple importance sampling
+ * weight of a sample drawn with density pdf when the other strategy could
+ * have drawn it with density otherPdf
+ */
+inline float power_heuristic(float pdf, float otherPdf) {
+    float a = pdf * pdf;
+    float b = otherPdf * otherPdf;
+    return a + b > 0.0f ? a / (a + b) : 0.0f;
+}
+
+#endif //RAYTRACINGFROMSCRATCH_BSDF_H
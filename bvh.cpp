@@ -0,0 +1,196 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <atomic>
+#include <numeric>
+#include <thread>
+#include "bvh.h"
+
+#define BVH_TRAVERSAL_COST 1.0f
+#define BVH_INTERSECTION_COST 1.0f
+
+typedef struct BvhBuild {
+    const std::vector<Aabb> &bounds;
+    std::vector<Vec3> centroids;
+    Bvh &bvh;
+    std::atomic<int> nodesUsed;
+    // nodes shallower than this hand one child to a new thread, so at most 2^threadDepth threads run
+    int threadDepth;
+} BvhBuild;
+
+static float axis_value(Vec3 v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+/* make_leaf()
+ * ----------------------------------------
+ * Turn a node into a leaf over a range of the BVH order
+ */
+static void make_leaf(BvhNode &node, int first, int count) {
+    node.leftFirst = first;
+    node.count = count;
+}
+
+/* build_node()
+ * ----------------------------------------
+ * Build the subtree for primitives [first, first + count) of the BVH order.
+ * Centroids are binned along each axis and the split with the lowest
+ * surface area heuristic cost is taken, unless keeping the node as a leaf
+ * is cheaper. Large subtrees near the root are built on their own thread,
+ * one level of threads per doubling of the hardware threads
+ *
+ * @param BvhBuild build
+ * @param int nodeIndex
+ * @param int first
+ * @param int count
+ * @param int depth
+ */
+static void build_node(BvhBuild &build, int nodeIndex, int first, int count, int depth) {
+    std::vector<int> &indices = build.bvh.indices;
+    BvhNode &node = build.bvh.nodes[nodeIndex];
+
+    Aabb box;
+    Aabb centroidBox;
+    for (int i = first; i < first + count; i++) {
+        box.grow(build.bounds[indices[i]]);
+        centroidBox.grow(build.centroids[indices[i]]);
+    }
+    node.minX = box.min.x;
+    node.minY = box.min.y;
+    node.minZ = box.min.z;
+    node.maxX = box.max.x;
+    node.maxY = box.max.y;
+    node.maxZ = box.max.z;
+
+    if (count == 1) {
+        make_leaf(node, first, count);
+        return;
+    }
+
+    // binned SAH over all three axes
+    float bestCost = std::numeric_limits<float>::infinity();
+    int bestAxis = -1;
+    int bestSplit = 0;
+    if (depth < BVH_MAX_SAH_DEPTH) {
+        for (int axis = 0; axis < 3; axis++) {
+            float low = axis_value(centroidBox.min, axis);
+            float high = axis_value(centroidBox.max, axis);
+            if (high <= low) {
+                continue;
+            }
+
+            Aabb binBounds[BVH_BINS];
+            int binCount[BVH_BINS] = {};
+            float scale = BVH_BINS / (high - low);
+            for (int i = first; i < first + count; i++) {
+                int bin = std::min(BVH_BINS - 1, static_cast<int>((axis_value(build.centroids[indices[i]], axis) - low) * scale));
+                binCount[bin]++;
+                binBounds[bin].grow(build.bounds[indices[i]]);
+            }
+
+            // sweep from the left, then evaluate every split from the right
+            float leftArea[BVH_BINS - 1];
+            int leftCount[BVH_BINS - 1];
+            Aabb sweep;
+            int sum = 0;
+            for (int i = 0; i < BVH_BINS - 1; i++) {
+                sum += binCount[i];
+                sweep.grow(binBounds[i]);
+                leftCount[i] = sum;
+                leftArea[i] = sweep.area();
+            }
+            sweep = Aabb {};
+            sum = 0;
+            for (int i = BVH_BINS - 1; i > 0; i--) {
+                sum += binCount[i];
+                sweep.grow(binBounds[i]);
+                if (leftCount[i - 1] == 0 || sum == 0) {
+                    continue;
+                }
+                float cost = leftArea[i - 1] * leftCount[i - 1] + sweep.area() * sum;
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+    }
+
+    float area = box.area();
+    float splitCost = area > 0 ? BVH_TRAVERSAL_COST + BVH_INTERSECTION_COST * bestCost / area : bestCost;
+    float leafCost = BVH_INTERSECTION_COST * count;
+    if ((bestAxis < 0 || splitCost >= leafCost) && count <= BVH_MAX_LEAF_SIZE) {
+        make_leaf(node, first, count);
+        return;
+    }
+
+    int axis = bestAxis;
+    int middle = first;
+    if (bestAxis >= 0) {
+        float low = axis_value(centroidBox.min, axis);
+        float scale = BVH_BINS / (axis_value(centroidBox.max, axis) - low);
+        int *split = std::partition(indices.data() + first, indices.data() + first + count, [&](int index) {
+            int bin = std::min(BVH_BINS - 1, static_cast<int>((axis_value(build.centroids[index], axis) - low) * scale));
+            return bin < bestSplit;
+        });
+        middle = static_cast<int>(split - indices.data());
+    }
+    if (middle == first || middle == first + count) {
+        // no usable SAH split, halve the range along the widest centroid axis
+        Vec3 extent = centroidBox.max.subtract(centroidBox.min);
+        axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 : (extent.y >= extent.z ? 1 : 2);
+        middle = first + count / 2;
+        std::nth_element(indices.data() + first, indices.data() + middle, indices.data() + first + count, [&](int a, int b) {
+            return axis_value(build.centroids[a], axis) < axis_value(build.centroids[b], axis);
+        });
+    }
+
+    int left = build.nodesUsed.fetch_add(2);
+    node.leftFirst = left;
+    node.count = -(axis + 1);
+
+    int leftCount = middle - first;
+    int rightCount = count - leftCount;
+    if (count > BVH_PARALLEL_THRESHOLD && depth < build.threadDepth) {
+        std::thread leftBuild(build_node, std::ref(build), left, first, leftCount, depth + 1);
+        build_node(build, left + 1, middle, rightCount, depth + 1);
+        leftBuild.join();
+    } else {
+        build_node(build, left, first, leftCount, depth + 1);
+        build_node(build, left + 1, middle, rightCount, depth + 1);
+    }
+}
+
+/* build_bvh()
+ * ----------------------------------------
+ * Build a binned SAH BVH over primitives given by their bounds. Afterwards
+ * bvh.indices lists the primitives in leaf order
+ *
+ * @param[out] Bvh bvh
+ * @param[in] vector<Aabb> bounds
+ */
+void build_bvh(Bvh &bvh, const std::vector<Aabb> &bounds) {
+    int count = static_cast<int>(bounds.size());
+    bvh.nodes.clear();
+    bvh.indices.resize(count);
+    std::iota(bvh.indices.begin(), bvh.indices.end(), 0);
+    if (count == 0) {
+        return;
+    }
+
+    bvh.nodes.resize(2 * count - 1);
+    int threadDepth = 0;
+    while ((2u << threadDepth) <= std::thread::hardware_concurrency()) {
+        threadDepth++;
+    }
+    BvhBuild build {bounds, std::vector<Vec3>(count), bvh, {1}, threadDepth};
+    for (int i = 0; i < count; i++) {
+        build.centroids[i] = bounds[i].centroid();
+    }
+
+    build_node(build, 0, 0, count, 0);
+    bvh.nodes.resize(build.nodesUsed.load());
+    bvh.nodes.shrink_to_fit();
+}
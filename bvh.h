@@ -0,0 +1,265 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_BVH_H
+#define RAYTRACINGFROMSCRATCH_BVH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "renderer_math.h"
+#include "stats.h"
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+#define BVH_STACK_SIZE 128
+#define BVH_MAX_SAH_DEPTH 64
+#define BVH_PARALLEL_THRESHOLD 16384
+// rays per batched occlusion query, one bit each in a mask
+#define BVH_MAX_BATCH 32
+
+/* Aabb
+ * ------------------------
+ * Axis aligned bounding box, empty (min > max) when default constructed
+ */
+typedef struct Aabb {
+    Vec3 min {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity()};
+    Vec3 max {-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()};
+
+    void grow(Vec3 point) {
+        min = Vec3 {std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z)};
+        max = Vec3 {std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z)};
+    }
+    void grow(const Aabb &box) {
+        grow(box.min);
+        grow(box.max);
+    }
+    Vec3 centroid() const {
+        return Vec3 {(min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f};
+    }
+    float area() const {
+        Vec3 extent = max.subtract(min);
+        if (extent.x < 0 || extent.y < 0 || extent.z < 0) {
+            return 0.0f;
+        }
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+} Aabb;
+
+/* BvhNode
+ * ------------------------
+ * 32 byte flattened node. For a leaf count > 0 and primitives
+ * [leftFirst, leftFirst + count) of the BVH order belong to it. Interior
+ * nodes store -(split axis + 1) in count and their children at leftFirst
+ * and leftFirst + 1
+ */
+typedef struct BvhNode {
+    float minX, minY, minZ;
+    int leftFirst;
+    float maxX, maxY, maxZ;
+    int count;
+} BvhNode;
+
+static_assert(sizeof(BvhNode) == 32, "BVH nodes are expected to be 32 bytes");
+
+/* Bvh
+ * ------------------------
+ * Nodes with the root at index 0, and the primitive index stored at each
+ * position of the BVH order. Callers usually reorder their primitives into
+ * that order so leaves reference contiguous ranges
+ */
+typedef struct Bvh {
+    std::vector<BvhNode> nodes {};
+    std::vector<int> indices {};
+} Bvh;
+
+void build_bvh(Bvh &bvh, const std::vector<Aabb> &bounds);
+
+/* intersect_node()
+ * ----------------------------------------
+ * Slab test of a ray against a node's bounds, returning the entry distance
+ * or infinity on a miss. Each corner of the node is one load into a Vec3A,
+ * so all three slabs are cut at once
+ */
+inline float intersect_node(const BvhNode &node, Vec3A origin, Vec3A inverse, float tMin, float tMax) {
+    Vec3A t1 = (Vec3A::load(&node.minX) - origin) * inverse;
+    Vec3A t2 = (Vec3A::load(&node.maxX) - origin) * inverse;
+    Vec3A near = t1.min(t2), far = t1.max(t2);
+    float entry = std::max(std::max(near.x(), near.y()), std::max(near.z(), tMin));
+    float exit = std::min(std::min(far.x(), far.y()), std::min(far.z(), tMax));
+    return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+}
+
+/* traverse_bvh()
+ * ----------------------------------------
+ * Walk the BVH with an explicit stack, visiting the child on the near side
+ * of the split axis first so closer hits shrink tMax early. leaf(first,
+ * count, tMax) tests a range of the BVH order, returns true on a hit and
+ * lowers tMax to the hit distance. root picks the subtree to walk
+ *
+ * @param Bvh bvh
+ * @param Vec3 origin
+ * @param Vec3 direction
+ * @param float tMin
+ * @param[in,out] float tMax
+ * @param LeafFunction leaf
+ * @param int root node to start from
+ * @return bool
+ */
+template <typename LeafFunction>
+bool traverse_bvh(const Bvh &bvh, Vec3 origin, Vec3 direction, float tMin, float &tMax, LeafFunction leaf, int root = 0) {
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+
+    Vec3A start(origin);
+    Vec3A inverse(Vec3 {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z});
+    int negative[3] = {direction.x < 0, direction.y < 0, direction.z < 0};
+
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = root;
+    bool found = false;
+
+    while (top > 0) {
+        const BvhNode &node = bvh.nodes[stack[--top]];
+        STAT_ADD(STAT_BVH_NODES, 1);
+        if (intersect_node(node, start, inverse, tMin, tMax) == std::numeric_limits<float>::infinity()) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            found |= leaf(node.leftFirst, node.count, tMax);
+            continue;
+        }
+
+        // push the far child first so the near one is popped next
+        int axis = -node.count - 1;
+        int near = node.leftFirst + negative[axis];
+        int far = node.leftFirst + 1 - negative[axis];
+        stack[top++] = far;
+        stack[top++] = near;
+    }
+    return found;
+}
+
+/* occluded_bvh()
+ * ----------------------------------------
+ * Any hit walk of the BVH for shadow rays. tMax never shrinks and the walk
+ * stops at the first leaf where leaf(first, count) reports something
+ * between tMin and tMax. root picks the subtree to walk
+ *
+ * @param Bvh bvh
+ * @param Vec3 origin
+ * @param Vec3 direction
+ * @param float tMin
+ * @param float tMax
+ * @param LeafFunction leaf
+ * @param int root node to start from
+ * @return bool
+ */
+template <typename LeafFunction>
+bool occluded_bvh(const Bvh &bvh, Vec3 origin, Vec3 direction, float tMin, float tMax, LeafFunction leaf, int root = 0) {
+    if (bvh.nodes.empty()) {
+        return false;
+    }
+
+    Vec3A start(origin);
+    Vec3A inverse(Vec3 {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z});
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = root;
+
+    while (top > 0) {
+        const BvhNode &node = bvh.nodes[stack[--top]];
+        STAT_ADD(STAT_BVH_NODES, 1);
+        if (intersect_node(node, start, inverse, tMin, tMax) == std::numeric_limits<float>::infinity()) {
+            continue;
+        }
+        if (node.count > 0) {
+            if (leaf(node.leftFirst, node.count)) {
+                return true;
+            }
+            continue;
+        }
+        stack[top++] = node.leftFirst + 1;
+        stack[top++] = node.leftFirst;
+    }
+    return false;
+}
+
+/* occluded_bvh_batch()
+ * ----------------------------------------
+ * Any hit walk for up to BVH_MAX_BATCH rays leaving the same point, such as
+ * the shadow rays towards every light. The tree is walked once, carrying
+ * the mask of rays that reached each node, and leaf(first, count, ray)
+ * only sees rays that hit the leaf and are not yet known to be blocked.
+ * Rays with tMax <= tMin are never traced. Returns the mask of blocked rays
+ *
+ * @param Bvh bvh
+ * @param Vec3 origin
+ * @param Vec3 directions[]
+ * @param float tMin
+ * @param float tMax[]
+ * @param int count
+ * @param LeafFunction leaf
+ * @return uint32_t blocked
+ */
+template <typename LeafFunction>
+uint32_t occluded_bvh_batch(const Bvh &bvh, Vec3 origin, const Vec3 directions[], float tMin, const float tMax[], int count,
+                            LeafFunction leaf) {
+    Vec3A start(origin);
+    Vec3A inverse[BVH_MAX_BATCH];
+    uint32_t pending = 0;
+    for (int ray = 0; ray < count; ray++) {
+        inverse[ray] = Vec3A(Vec3 {1.0f / directions[ray].x, 1.0f / directions[ray].y, 1.0f / directions[ray].z});
+        pending |= static_cast<uint32_t>(tMax[ray] > tMin) << ray;
+    }
+    if (bvh.nodes.empty()) {
+        return 0;
+    }
+
+    int stack[BVH_STACK_SIZE];
+    uint32_t masks[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    masks[top++] = pending;
+    uint32_t blocked = 0;
+
+    while (top > 0 && pending != 0) {
+        --top;
+        const BvhNode &node = bvh.nodes[stack[top]];
+        uint32_t active = masks[top] & pending;
+        STAT_ADD(STAT_BVH_NODES, __builtin_popcount(active));
+        uint32_t hit = 0;
+        for (uint32_t mask = active; mask != 0; mask &= mask - 1) {
+            int ray = __builtin_ctz(mask);
+            if (intersect_node(node, start, inverse[ray], tMin, tMax[ray]) != std::numeric_limits<float>::infinity()) {
+                hit |= 1u << ray;
+            }
+        }
+        if (hit == 0) {
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (uint32_t mask = hit; mask != 0; mask &= mask - 1) {
+                int ray = __builtin_ctz(mask);
+                if (leaf(node.leftFirst, node.count, ray)) {
+                    blocked |= 1u << ray;
+                    pending &= ~(1u << ray);
+                }
+            }
+            continue;
+        }
+        stack[top] = node.leftFirst + 1;
+        masks[top++] = hit;
+        stack[top] = node.leftFirst;
+        masks[top++] = hit;
+    }
+    return blocked;
+}
+
+#endif //RAYTRACINGFROMSCRATCH_BVH_H
@@ -0,0 +1,410 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "denoise.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DENOISE_SSE 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DENOISE_AVX2 1
+#endif
+
+// keeps black albedo from dividing by zero when demodulating
+#define DENOISE_ALBEDO_EPSILON 0.01f
+#define DENOISE_DEPTH_EPSILON 1e-4f
+#define DENOISE_SIGMA_EPSILON 1e-4f
+#define DENOISE_VARIANCE_EPSILON 1e-4f
+// stands in for the variance of pixels with fewer than two samples, large but finite so w^2 * variance stays a number
+#define DENOISE_UNKNOWN_VARIANCE 1e12f
+// weights below e^-80 are zero for all purposes, and 2^-116 is still a normal float
+#define DENOISE_MAX_EXPONENT 80.0f
+
+/* DenoisePlanes
+ * ------------------------
+ * The image split into one array per channel, so neighbouring pixels are
+ * neighbouring floats. Illumination is the radiance divided by albedo, so
+ * surface colour is not blurred away and is multiplied back in at the end.
+ * variance is that of each pixel's illumination luminance, and depthScale
+ * is 1 / (sigmaDepth * depth), turning depth differences into relative ones
+ */
+typedef struct DenoisePlanes {
+    std::vector<float> red, green, blue, variance;
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<float> depth, depthScale;
+} DenoisePlanes;
+
+/* FilterPass
+ * ------------------------
+ * One iteration: the illumination and variance it reads and writes, the
+ * distance between taps and the weights that are the same for every pixel
+ */
+typedef struct FilterPass {
+    const float *red, *green, *blue, *variance;
+    float *outRed, *outGreen, *outBlue, *outVariance;
+    int width, height, step;
+    float sigmaColor, invNormal;
+} FilterPass;
+
+// B3 spline taps of the a-trous kernel
+static const float kernel[5] = {1.0f / 16, 1.0f / 4, 3.0f / 8, 1.0f / 4, 1.0f / 16};
+
+/* exp_neg()
+ * ----------------------------------------
+ * e^-x for x >= 0 from 2^floor and a polynomial for the fraction, relative
+ * error around 1e-4, which is plenty for filter weights. Matches exp_neg_sse()
+ */
+static inline float exp_neg(float x) {
+    float t = -std::min(x, DENOISE_MAX_EXPONENT) * 1.44269504f;
+    float whole = std::floor(t);
+    float f = t - whole;
+    float p = 1.0f + f * (0.693147f + f * (0.240227f + f * (0.0555041f + f * 0.00961813f)));
+    int32_t bits = (static_cast<int32_t>(whole) + 127) << 23;
+    float scale;
+    memcpy(&scale, &bits, sizeof(scale));
+    return p * scale;
+}
+
+#if defined(DENOISE_SSE)
+static inline __m128 exp_neg_sse(__m128 x) {
+    __m128 t = _mm_mul_ps(_mm_min_ps(x, _mm_set1_ps(DENOISE_MAX_EXPONENT)), _mm_set1_ps(-1.44269504f));
+    // t <= 0, so truncation rounds up and floor is one less where it moved
+    __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+    whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, t), _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(t, whole);
+    __m128 p = _mm_add_ps(_mm_set1_ps(0.0555041f), _mm_mul_ps(f, _mm_set1_ps(0.00961813f)));
+    p = _mm_add_ps(_mm_set1_ps(0.240227f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(0.693147f), _mm_mul_ps(f, p));
+    p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(f, p));
+    __m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+}
+#endif
+
+/* filter_pixel()
+ * ----------------------------------------
+ * All 25 taps of one pixel, leaving out those that fall outside the image.
+ * Each weight is the kernel weight times e^-(luminance + normal + depth
+ * distance), where the luminance difference is measured in standard
+ * deviations of the pixel's noise. The variance is filtered with the
+ * squared weights, so the next iteration knows how much noise is left. The
+ * centre tap always has a weight, so the sum never is zero
+ */
+static void filter_pixel(const DenoisePlanes &planes, const FilterPass &pass, int x, int y) {
+    int p = y * pass.width + x;
+    float colorScale = 1.0f / (pass.sigmaColor * std::sqrt(pass.variance[p]) + DENOISE_VARIANCE_EPSILON);
+    float pLuminance = 0.2126f * pass.red[p] + 0.7152f * pass.green[p] + 0.0722f * pass.blue[p];
+    float sumRed = 0, sumGreen = 0, sumBlue = 0, sumWeight = 0, sumVariance = 0;
+    for (int ky = -2; ky <= 2; ky++) {
+        int qy = y + ky * pass.step;
+        if (qy < 0 || qy >= pass.height) {
+            continue;
+        }
+        for (int kx = -2; kx <= 2; kx++) {
+            int qx = x + kx * pass.step;
+            if (qx < 0 || qx >= pass.width) {
+                continue;
+            }
+            int q = qy * pass.width + qx;
+            float qLuminance = 0.2126f * pass.red[q] + 0.7152f * pass.green[q] + 0.0722f * pass.blue[q];
+            float dot = planes.normalX[p] * planes.normalX[q] + planes.normalY[p] * planes.normalY[q] +
+                        planes.normalZ[p] * planes.normalZ[q];
+            float dz = std::fabs(planes.depth[q] - planes.depth[p]);
+            float exponent = std::fabs(qLuminance - pLuminance) * colorScale + std::max(1.0f - dot, 0.0f) * pass.invNormal +
+                             dz * planes.depthScale[p];
+            float weight = kernel[ky + 2] * kernel[kx + 2] * exp_neg(exponent);
+            sumRed += weight * pass.red[q];
+            sumGreen += weight * pass.green[q];
+            sumBlue += weight * pass.blue[q];
+            sumWeight += weight;
+            sumVariance += weight * weight * pass.variance[q];
+        }
+    }
+    float inverse = 1.0f / sumWeight;
+    pass.outRed[p] = sumRed * inverse;
+    pass.outGreen[p] = sumGreen * inverse;
+    pass.outBlue[p] = sumBlue * inverse;
+    pass.outVariance[p] = sumVariance * inverse * inverse;
+}
+
+#if defined(DENOISE_SSE)
+/* filter_pixels_sse()
+ * ----------------------------------------
+ * filter_pixel() for pixels x..x+3 of a row, whose taps all lie inside the
+ * image horizontally. The centre pixels are loaded once and the sums stay in
+ * registers across all 25 taps
+ */
+static void filter_pixels_sse(const DenoisePlanes &planes, const FilterPass &pass, int x, int y) {
+    int p = y * pass.width + x;
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 invNormal = _mm_set1_ps(pass.invNormal);
+    const __m128 lumR = _mm_set1_ps(0.2126f), lumG = _mm_set1_ps(0.7152f), lumB = _mm_set1_ps(0.0722f);
+    __m128 pLuminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lumR, _mm_loadu_ps(pass.red + p)), _mm_mul_ps(lumG, _mm_loadu_ps(pass.green + p))),
+                                   _mm_mul_ps(lumB, _mm_loadu_ps(pass.blue + p)));
+    __m128 pNx = _mm_loadu_ps(&planes.normalX[p]), pNy = _mm_loadu_ps(&planes.normalY[p]), pNz = _mm_loadu_ps(&planes.normalZ[p]);
+    __m128 pDepth = _mm_loadu_ps(&planes.depth[p]);
+    __m128 depthScale = _mm_loadu_ps(&planes.depthScale[p]);
+    __m128 deviation = _mm_mul_ps(_mm_set1_ps(pass.sigmaColor), _mm_sqrt_ps(_mm_loadu_ps(pass.variance + p)));
+    __m128 colorScale = _mm_div_ps(one, _mm_add_ps(deviation, _mm_set1_ps(DENOISE_VARIANCE_EPSILON)));
+    __m128 sumRed = zero, sumGreen = zero, sumBlue = zero, sumWeight = zero, sumVariance = zero;
+
+    for (int ky = -2; ky <= 2; ky++) {
+        int qy = y + ky * pass.step;
+        if (qy < 0 || qy >= pass.height) {
+            continue;
+        }
+        for (int kx = -2; kx <= 2; kx++) {
+            int q = qy * pass.width + x + kx * pass.step;
+            __m128 qRed = _mm_loadu_ps(pass.red + q), qGreen = _mm_loadu_ps(pass.green + q), qBlue = _mm_loadu_ps(pass.blue + q);
+            __m128 qLuminance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lumR, qRed), _mm_mul_ps(lumG, qGreen)), _mm_mul_ps(lumB, qBlue));
+            __m128 color = _mm_and_ps(_mm_sub_ps(qLuminance, pLuminance), absMask);
+
+            __m128 dot = _mm_mul_ps(pNx, _mm_loadu_ps(&planes.normalX[q]));
+            dot = _mm_add_ps(dot, _mm_mul_ps(pNy, _mm_loadu_ps(&planes.normalY[q])));
+            dot = _mm_add_ps(dot, _mm_mul_ps(pNz, _mm_loadu_ps(&planes.normalZ[q])));
+            __m128 normal = _mm_max_ps(_mm_sub_ps(one, dot), zero);
+            __m128 dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(&planes.depth[q]), pDepth), absMask);
+
+            __m128 exponent = _mm_add_ps(_mm_mul_ps(color, colorScale), _mm_mul_ps(normal, invNormal));
+            exponent = _mm_add_ps(exponent, _mm_mul_ps(dz, depthScale));
+            __m128 weight = _mm_mul_ps(_mm_set1_ps(kernel[ky + 2] * kernel[kx + 2]), exp_neg_sse(exponent));
+            sumRed = _mm_add_ps(sumRed, _mm_mul_ps(weight, qRed));
+            sumGreen = _mm_add_ps(sumGreen, _mm_mul_ps(weight, qGreen));
+            sumBlue = _mm_add_ps(sumBlue, _mm_mul_ps(weight, qBlue));
+            sumWeight = _mm_add_ps(sumWeight, weight);
+            sumVariance = _mm_add_ps(sumVariance, _mm_mul_ps(_mm_mul_ps(weight, weight), _mm_loadu_ps(pass.variance + q)));
+        }
+    }
+    __m128 inverse = _mm_div_ps(one, sumWeight);
+    _mm_storeu_ps(pass.outRed + p, _mm_mul_ps(sumRed, inverse));
+    _mm_storeu_ps(pass.outGreen + p, _mm_mul_ps(sumGreen, inverse));
+    _mm_storeu_ps(pass.outBlue + p, _mm_mul_ps(sumBlue, inverse));
+    _mm_storeu_ps(pass.outVariance + p, _mm_mul_ps(sumVariance, _mm_mul_ps(inverse, inverse)));
+}
+#endif
+
+#if defined(DENOISE_AVX2)
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_neg_avx2(__m256 x) {
+    __m256 t = _mm256_mul_ps(_mm256_min_ps(x, _mm256_set1_ps(DENOISE_MAX_EXPONENT)), _mm256_set1_ps(-1.44269504f));
+    __m256 whole = _mm256_floor_ps(t);
+    __m256 f = _mm256_sub_ps(t, whole);
+    __m256 p = _mm256_fmadd_ps(f, _mm256_set1_ps(0.00961813f), _mm256_set1_ps(0.0555041f));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(0.240227f));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(0.693147f));
+    p = _mm256_fmadd_ps(f, p, _mm256_set1_ps(1.0f));
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(whole), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+/* filter_pixels_avx2()
+ * ----------------------------------------
+ * filter_pixels_sse() for eight pixels x..x+7 with AVX2 and FMA. Compiled for
+ * those instructions only, and only called when the CPU reports them
+ */
+__attribute__((target("avx2,fma")))
+static void filter_pixels_avx2(const DenoisePlanes &planes, const FilterPass &pass, int x, int y) {
+    int p = y * pass.width + x;
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 invNormal = _mm256_set1_ps(pass.invNormal);
+    const __m256 lumR = _mm256_set1_ps(0.2126f), lumG = _mm256_set1_ps(0.7152f), lumB = _mm256_set1_ps(0.0722f);
+    __m256 pLuminance = _mm256_fmadd_ps(lumB, _mm256_loadu_ps(pass.blue + p),
+                                        _mm256_fmadd_ps(lumG, _mm256_loadu_ps(pass.green + p), _mm256_mul_ps(lumR, _mm256_loadu_ps(pass.red + p))));
+    __m256 pNx = _mm256_loadu_ps(&planes.normalX[p]), pNy = _mm256_loadu_ps(&planes.normalY[p]), pNz = _mm256_loadu_ps(&planes.normalZ[p]);
+    __m256 pDepth = _mm256_loadu_ps(&planes.depth[p]);
+    __m256 depthScale = _mm256_loadu_ps(&planes.depthScale[p]);
+    __m256 deviation = _mm256_mul_ps(_mm256_set1_ps(pass.sigmaColor), _mm256_sqrt_ps(_mm256_loadu_ps(pass.variance + p)));
+    __m256 colorScale = _mm256_div_ps(one, _mm256_add_ps(deviation, _mm256_set1_ps(DENOISE_VARIANCE_EPSILON)));
+    __m256 sumRed = zero, sumGreen = zero, sumBlue = zero, sumWeight = zero, sumVariance = zero;
+
+    for (int ky = -2; ky <= 2; ky++) {
+        int qy = y + ky * pass.step;
+        if (qy < 0 || qy >= pass.height) {
+            continue;
+        }
+        for (int kx = -2; kx <= 2; kx++) {
+            int q = qy * pass.width + x + kx * pass.step;
+            __m256 qRed = _mm256_loadu_ps(pass.red + q), qGreen = _mm256_loadu_ps(pass.green + q), qBlue = _mm256_loadu_ps(pass.blue + q);
+            __m256 qLuminance = _mm256_fmadd_ps(lumB, qBlue, _mm256_fmadd_ps(lumG, qGreen, _mm256_mul_ps(lumR, qRed)));
+            __m256 color = _mm256_and_ps(_mm256_sub_ps(qLuminance, pLuminance), absMask);
+
+            __m256 dot = _mm256_mul_ps(pNx, _mm256_loadu_ps(&planes.normalX[q]));
+            dot = _mm256_fmadd_ps(pNy, _mm256_loadu_ps(&planes.normalY[q]), dot);
+            dot = _mm256_fmadd_ps(pNz, _mm256_loadu_ps(&planes.normalZ[q]), dot);
+            __m256 normal = _mm256_max_ps(_mm256_sub_ps(one, dot), zero);
+            __m256 dz = _mm256_and_ps(_mm256_sub_ps(_mm256_loadu_ps(&planes.depth[q]), pDepth), absMask);
+
+            __m256 exponent = _mm256_fmadd_ps(color, colorScale, _mm256_mul_ps(normal, invNormal));
+            exponent = _mm256_fmadd_ps(dz, depthScale, exponent);
+            __m256 weight = _mm256_mul_ps(_mm256_set1_ps(kernel[ky + 2] * kernel[kx + 2]), exp_neg_avx2(exponent));
+            sumRed = _mm256_fmadd_ps(weight, qRed, sumRed);
+            sumGreen = _mm256_fmadd_ps(weight, qGreen, sumGreen);
+            sumBlue = _mm256_fmadd_ps(weight, qBlue, sumBlue);
+            sumWeight = _mm256_add_ps(sumWeight, weight);
+            sumVariance = _mm256_fmadd_ps(_mm256_mul_ps(weight, weight), _mm256_loadu_ps(pass.variance + q), sumVariance);
+        }
+    }
+    __m256 inverse = _mm256_div_ps(one, sumWeight);
+    _mm256_storeu_ps(pass.outRed + p, _mm256_mul_ps(sumRed, inverse));
+    _mm256_storeu_ps(pass.outGreen + p, _mm256_mul_ps(sumGreen, inverse));
+    _mm256_storeu_ps(pass.outBlue + p, _mm256_mul_ps(sumBlue, inverse));
+    _mm256_storeu_ps(pass.outVariance + p, _mm256_mul_ps(sumVariance, _mm256_mul_ps(inverse, inverse)));
+}
+
+/* cpu_has_avx2()
+ * ----------------------------------------
+ * Whether the running CPU can use filter_pixels_avx2()
+ */
+static bool cpu_has_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+#endif
+
+/* demodulate()
+ * ----------------------------------------
+ * Split rows [y0, y1) of the framebuffer into the planes the filter reads.
+ * The raw variance goes to scratch for smooth_variance()
+ */
+static void demodulate(const Framebuffer &framebuffer, DenoisePlanes &planes, std::vector<float> &variance,
+                       const DenoiseSettings &settings, int y0, int y1) {
+    float invDepth = 1.0f / std::max(settings.sigmaDepth, DENOISE_SIGMA_EPSILON);
+    for (int pixel = y0 * framebuffer.width; pixel < y1 * framebuffer.width; pixel++) {
+        const float *radiance = &framebuffer.accumulation[3 * pixel];
+        const float *albedo = &framebuffer.albedo[3 * pixel];
+        const float *normal = &framebuffer.normals[3 * pixel];
+        planes.red[pixel] = radiance[0] / std::max(albedo[0], DENOISE_ALBEDO_EPSILON);
+        planes.green[pixel] = radiance[1] / std::max(albedo[1], DENOISE_ALBEDO_EPSILON);
+        planes.blue[pixel] = radiance[2] / std::max(albedo[2], DENOISE_ALBEDO_EPSILON);
+        planes.normalX[pixel] = normal[0];
+        planes.normalY[pixel] = normal[1];
+        planes.normalZ[pixel] = normal[2];
+        planes.depth[pixel] = framebuffer.depth[pixel];
+        planes.depthScale[pixel] = invDepth / std::max(framebuffer.depth[pixel], DENOISE_DEPTH_EPSILON);
+
+        // variance of the mean luminance, carried over to illumination
+        uint32_t count = framebuffer.sampleCount[pixel];
+        float reflectance = std::max(luminance(Vec3 {albedo[0], albedo[1], albedo[2]}), DENOISE_ALBEDO_EPSILON);
+        variance[pixel] = count > 1 ? framebuffer.luminanceM2[pixel] / ((count - 1.0f) * count * reflectance * reflectance)
+                                    : DENOISE_UNKNOWN_VARIANCE;
+    }
+}
+
+/* smooth_variance()
+ * ----------------------------------------
+ * 3x3 mean of the variance around each pixel of rows [y0, y1). Estimates
+ * from a handful of samples are themselves noisy, and a pixel whose samples
+ * happened to agree would otherwise refuse every neighbour
+ */
+static void smooth_variance(const std::vector<float> &variance, DenoisePlanes &planes, int width, int height, int y0, int y1) {
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < width; x++) {
+            float sum = 0.0f;
+            int count = 0;
+            for (int qy = std::max(y - 1, 0); qy <= std::min(y + 1, height - 1); qy++) {
+                for (int qx = std::max(x - 1, 0); qx <= std::min(x + 1, width - 1); qx++) {
+                    sum += variance[qy * width + qx];
+                    count++;
+                }
+            }
+            planes.variance[y * width + x] = sum / count;
+        }
+    }
+}
+
+/* denoise()
+ * ----------------------------------------
+ * Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) guided by the
+ * first hit normals, albedo and depth of the framebuffer, with the
+ * luminance term scaled by the pixel variance as in SVGF (Schied et al.
+ * 2017). Each iteration applies the 5x5 B3 kernel with its taps 2^i pixels
+ * apart. Blocks of TILE_SIZE rows are filtered on the pool, iteration by
+ * iteration, and the result is written as interleaved RGB radiance
+ *
+ * @param ThreadPool pool
+ * @param Framebuffer framebuffer
+ * @param[out] vector<float> output 3 floats per pixel
+ * @param DenoiseSettings settings
+ */
+void denoise(ThreadPool &pool, const Framebuffer &framebuffer, std::vector<float> &output, const DenoiseSettings &settings) {
+    int width = framebuffer.width;
+    int height = framebuffer.height;
+    size_t pixels = static_cast<size_t>(width) * height;
+    int blocks = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+    DenoisePlanes planes;
+    for (std::vector<float> *plane : {&planes.red, &planes.green, &planes.blue, &planes.variance, &planes.normalX,
+                                      &planes.normalY, &planes.normalZ, &planes.depth, &planes.depthScale}) {
+        plane->resize(pixels);
+    }
+    // iterations ping pong between the planes and these, variance starts out in there unsmoothed
+    std::vector<float> red(pixels), green(pixels), blue(pixels), variance(pixels);
+    pool.run(blocks, [&](int block, int) {
+        demodulate(framebuffer, planes, variance, settings, block * TILE_SIZE, std::min((block + 1) * TILE_SIZE, height));
+    });
+    pool.run(blocks, [&](int block, int) {
+        smooth_variance(variance, planes, width, height, block * TILE_SIZE, std::min((block + 1) * TILE_SIZE, height));
+    });
+
+    float invNormal = 1.0f / std::max(settings.sigmaNormal, DENOISE_SIGMA_EPSILON);
+#if defined(DENOISE_AVX2)
+    static const bool avx2 = cpu_has_avx2();
+#endif
+
+    for (int iteration = 0; iteration < settings.iterations; iteration++) {
+        FilterPass pass {planes.red.data(), planes.green.data(), planes.blue.data(), planes.variance.data(),
+                         red.data(), green.data(), blue.data(), variance.data(),
+                         width, height, 1 << iteration, settings.sigmaColor, invNormal};
+        int border = 2 * pass.step;
+
+        pool.run(blocks, [&](int block, int) {
+            for (int y = block * TILE_SIZE; y < std::min((block + 1) * TILE_SIZE, height); y++) {
+                // pixels whose taps can fall off the left or right edge take the scalar path
+                int x = 0;
+                for (; x < border && x < width; x++) {
+                    filter_pixel(planes, pass, x, y);
+                }
+#if defined(DENOISE_AVX2)
+                if (avx2) {
+                    for (; x + 8 + border <= width; x += 8) {
+                        filter_pixels_avx2(planes, pass, x, y);
+                    }
+                }
+#endif
+#if defined(DENOISE_SSE)
+                for (; x + 4 + border <= width; x += 4) {
+                    filter_pixels_sse(planes, pass, x, y);
+                }
+#endif
+                for (; x < width; x++) {
+                    filter_pixel(planes, pass, x, y);
+                }
+            }
+        });
+        planes.red.swap(red);
+        planes.green.swap(green);
+        planes.blue.swap(blue);
+        planes.variance.swap(variance);
+    }
+
+    output.resize(3 * pixels);
+    pool.run(blocks, [&](int block, int) {
+        for (int pixel = block * TILE_SIZE * width; pixel < std::min((block + 1) * TILE_SIZE, height) * width; pixel++) {
+            const float *albedo = &framebuffer.albedo[3 * pixel];
+            output[3 * pixel] = planes.red[pixel] * std::max(albedo[0], DENOISE_ALBEDO_EPSILON);
+            output[3 * pixel + 1] = planes.green[pixel] * std::max(albedo[1], DENOISE_ALBEDO_EPSILON);
+            output[3 * pixel + 2] = planes.blue[pixel] * std::max(albedo[2], DENOISE_ALBEDO_EPSILON);
+        }
+    });
+}
@@ -0,0 +1,30 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_DENOISE_H
+#define RAYTRACINGFROMSCRATCH_DENOISE_H
+
+#include <vector>
+#include "renderer.h"
+#include "thread_pool.h"
+
+#define DENOISE_ITERATIONS 5
+
+/* DenoiseSettings
+ * ------------------------
+ * Strength of the edge stopping functions of the a-trous filter. Larger
+ * sigmas blur across bigger differences in illumination, normal and
+ * relative depth. sigmaColor counts standard deviations of the pixel mean,
+ * so noisier pixels take in more of their neighbours
+ */
+typedef struct DenoiseSettings {
+    int iterations {DENOISE_ITERATIONS};
+    float sigmaColor {16.0f};
+    float sigmaNormal {0.1f};
+    float sigmaDepth {0.05f};
+} DenoiseSettings;
+
+void denoise(ThreadPool &pool, const Framebuffer &framebuffer, std::vector<float> &output, const DenoiseSettings &settings);
+
+#endif //RAYTRACINGFROMSCRATCH_DENOISE_H
@@ -0,0 +1,259 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+// Libraries
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renderer
+#include "renderer.h"
+#include "denoise.h"
+#include "irradiance_cache.h"
+#include "packet.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "thread_pool.h"
+#include "image_io.h"
+#include "stats.h"
+
+#define CANVAS_WIDTH 600
+#define CANVAS_HEIGHT 600
+
+// FUNCTION DECLARATIONS ---------------------------------------------------
+void print_usage(const char *program);
+// -------------------------------------------------------------------------
+
+/* frame_path()
+ * ----------------------
+ * frame.ppm stays frame.ppm for one frame, otherwise becomes frame_0000.ppm,
+ * frame_0001.ppm, ...
+ */
+static std::string frame_path(const std::string &output, int frame, int frames) {
+    if (frames <= 1) {
+        return output;
+    }
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), "_%04d", frame);
+    size_t dot = output.find_last_of('.');
+    return output.substr(0, dot) + suffix + (dot == std::string::npos ? "" : output.substr(dot));
+}
+
+/* main()
+ * ----------------------
+ * Render a fixed number of frames without opening a window and write each
+ * one to disk. The image format follows the output extension (ppm, pfm, png).
+ * --passes is the most passes per frame; with --error or --time-budget a
+ * frame stops early once every pixel has converged or the time is spent.
+ * --irradiance-cache interpolates indirect light at camera hits from
+ * records kept across frames. --denoise filters each frame with its
+ * normal, albedo and depth buffers before it is written. --wavefront
+ * traces the passes with the wavefront renderer, --packets 4, 8 or 16
+ * traces them with its camera and shadow rays in packets
+ */
+int main(int argc, char *argv[]) {
+    int width = CANVAS_WIDTH;
+    int height = CANVAS_HEIGHT;
+    int frames = 1;
+    int passes = 1;
+    RenderSettings settings;
+    DisplaySettings display;
+    int threads = 0;
+    std::string output = "frame.ppm";
+    bool quiet = false;
+    std::vector<std::string> meshes;
+    std::string sceneFile;
+    bool useCache = true;
+    double timeBudget = 0.0;
+    bool stats = false;
+    std::string heatmap;
+    bool denoiseFrames = false;
+    bool irradianceCache = false;
+    DenoiseSettings denoiseSettings;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--width") && hasValue) {
+            width = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--height") && hasValue) {
+            height = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--frames") && hasValue) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--passes") && hasValue) {
+            passes = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--samples") && hasValue) {
+            settings.samplesPerPixel = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--depth") && hasValue) {
+            settings.maxDepth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--sampler") && hasValue) {
+            bool valid;
+            settings.sampler = parse_sampler_type(argv[++i], valid);
+            if (!valid) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--error") && hasValue) {
+            settings.errorThreshold = static_cast<float>(atof(argv[++i]));
+        } else if (!strcmp(argv[i], "--min-samples") && hasValue) {
+            settings.minSamples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--time-budget") && hasValue) {
+            timeBudget = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--exposure") && hasValue) {
+            display.exposure = static_cast<float>(atof(argv[++i]));
+        } else if (!strcmp(argv[i], "--tonemap") && hasValue) {
+            bool valid;
+            display.toneMap = parse_tonemap(argv[++i], valid);
+            if (!valid) {
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--linear")) {
+            display.srgb = false;
+        } else if (!strcmp(argv[i], "--threads") && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--output") && hasValue) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "--scene") && hasValue) {
+            sceneFile = argv[++i];
+        } else if (!strcmp(argv[i], "--no-cache")) {
+            useCache = false;
+        } else if (!strcmp(argv[i], "--obj") && hasValue) {
+            meshes.push_back(argv[++i]);
+        } else if (!strcmp(argv[i], "--wavefront")) {
+            settings.wavefront = true;
+        } else if (!strcmp(argv[i], "--packets") && hasValue) {
+            settings.packetSize = atoi(argv[++i]);
+            if (!valid_packet_size(settings.packetSize)) {
+                fprintf(stderr, "Packets are 4, 8 or 16 rays, not %d\n", settings.packetSize);
+                return 1;
+            }
+        } else if (!strcmp(argv[i], "--irradiance-cache")) {
+            irradianceCache = true;
+        } else if (!strcmp(argv[i], "--denoise")) {
+            denoiseFrames = true;
+        } else if (!strcmp(argv[i], "--denoise-iterations") && hasValue) {
+            denoiseSettings.iterations = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--stats")) {
+            stats = true;
+        } else if (!strcmp(argv[i], "--heatmap") && hasValue) {
+            heatmap = argv[++i];
+        } else if (!strcmp(argv[i], "--quiet")) {
+            quiet = true;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || frames <= 0 || passes <= 0 || settings.samplesPerPixel <= 0 || settings.maxDepth < 0 ||
+        denoiseSettings.iterations < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+#ifndef RAYTRACER_STATS
+    if (stats || !heatmap.empty()) {
+        fprintf(stderr, "--stats and --heatmap need a build configured with -DRAYTRACER_STATS=ON\n");
+        return 1;
+    }
+#endif
+
+    Scene scene;
+    if (sceneFile.empty()) {
+        load_default_scene(scene);
+    } else if (!load_scene(sceneFile, scene, useCache)) {
+        fprintf(stderr, "Could not load %s\n", sceneFile.c_str());
+        return 1;
+    }
+    if (!meshes.empty()) {
+        for (const std::string &path : meshes) {
+            Mesh mesh;
+            if (!load_obj(path, mesh)) {
+                fprintf(stderr, "Could not load %s\n", path.c_str());
+                return 1;
+            }
+            scene.meshes.push_back(std::move(mesh));
+        }
+        prepare_scene(scene);
+    }
+
+    // records are shared by every frame, the scene does not change between them
+    std::unique_ptr<IrradianceCache> cache;
+    if (irradianceCache) {
+        cache.reset(new IrradianceCache(scene));
+        settings.irradianceCache = cache.get();
+    }
+
+    ThreadPool pool(threads);
+    Framebuffer framebuffer(width, height);
+    framebuffer.display = display;
+    Vec3 origin = scene.camera;
+
+    std::vector<float> denoised;
+    double totalSeconds = 0.0;
+    for (int frame = 0; frame < frames; frame++) {
+        // each frame accumulates up to passes x samples paths per pixel, fewer where pixels converge
+        auto frameStart = std::chrono::steady_clock::now();
+        reset_accumulation(framebuffer);
+        int framePasses = render_adaptive(pool, framebuffer, origin, scene, settings, passes, timeBudget);
+        double denoiseSeconds = 0.0;
+        if (denoiseFrames) {
+            // the filtered radiance takes the place of the accumulation, which the next frame resets anyway
+            auto denoiseStart = std::chrono::steady_clock::now();
+            denoise(pool, framebuffer, denoised, denoiseSettings);
+            framebuffer.accumulation.swap(denoised);
+            tonemap_framebuffer(pool, framebuffer);
+            denoiseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - denoiseStart).count();
+        }
+        double frameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count();
+        totalSeconds += frameSeconds;
+
+        std::string path = frame_path(output, frame, frames);
+        if (!write_image(framebuffer, path)) {
+            fprintf(stderr, "Could not write %s\n", path.c_str());
+            return 1;
+        }
+
+        if (!quiet) {
+            unsigned long long paths = 0;
+            for (uint32_t count : framebuffer.sampleCount) {
+                paths += count;
+            }
+            printf("Frame %d: %04.2f s, %d passes, %.1f samples per pixel -> %s\n", frame, frameSeconds, framePasses,
+                   static_cast<double>(paths) / framebuffer.sampleCount.size(), path.c_str());
+            if (cache) {
+                printf("Irradiance cache: %zu records\n", cache->size());
+            }
+            if (denoiseFrames) {
+                printf("Denoised in %.1f ms\n", 1000.0 * denoiseSeconds);
+            }
+            print_worker_utilisation(pool);
+        }
+#ifdef RAYTRACER_STATS
+        // counters from every worker are merged once the frame is done
+        RenderStats frameStats = collect_render_stats();
+        if (stats) {
+            print_render_stats(frameStats);
+        }
+        std::string heatmapPath = frame_path(heatmap, frame, frames);
+        if (!heatmap.empty() && !write_tile_heatmap(framebuffer, heatmapPath)) {
+            fprintf(stderr, "Could not write %s\n", heatmapPath.c_str());
+            return 1;
+        }
+#endif
+    }
+    printf("Rendered %d frames of %dx%d in %04.2f s (%04.2f frames/s)\n", frames, width, height,
+           totalSeconds, frames / totalSeconds);
+    return 0;
+}
+
+/* print_usage()
+ * ----------------------
+ * Print the command line options of the headless renderer
+ */
+void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--width W] [--height H] [--frames N] [--passes P] [--samples S] [--depth D] [--sampler random|stratified|sobol|bluenoise] [--error E] [--min-samples N] [--time-budget seconds] [--exposure EV] [--tonemap none|reinhard|aces] [--linear] [--threads T] [--output file.ppm|.pfm|.png] [--scene file.json] [--no-cache] [--obj mesh.obj] [--wavefront] [--packets 4|8|16] [--irradiance-cache] [--denoise] [--denoise-iterations N] [--stats] [--heatmap tiles.png] [--quiet]\n", program);
+}
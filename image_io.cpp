@@ -0,0 +1,191 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "image_io.h"
+
+/* write_ppm()
+ * ----------------------------------------
+ * Write the tone mapped display image as a binary (P6) portable pixmap
+ *
+ * @param Framebuffer framebuffer
+ * @param string path
+ * @return bool success
+ */
+bool write_ppm(const Framebuffer &framebuffer, const std::string &path) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    size_t count = static_cast<size_t>(framebuffer.width) * framebuffer.height;
+    std::vector<uint8_t> bytes(count * 3);
+    for (size_t i = 0; i < count; i++) {
+        bytes[3 * i] = framebuffer.rgba[4 * i];
+        bytes[3 * i + 1] = framebuffer.rgba[4 * i + 1];
+        bytes[3 * i + 2] = framebuffer.rgba[4 * i + 2];
+    }
+
+    fprintf(file, "P6\n%d %d\n255\n", framebuffer.width, framebuffer.height);
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    return (fclose(file) == 0) && ok;
+}
+
+/* write_pfm()
+ * ----------------------------------------
+ * Write the framebuffer as a little endian portable float map. PFM stores
+ * rows bottom up, and holds the linear radiance before exposure and tone
+ * mapping so the full range is kept
+ *
+ * @param Framebuffer framebuffer
+ * @param string path
+ * @return bool success
+ */
+bool write_pfm(const Framebuffer &framebuffer, const std::string &path) {
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    std::vector<float> values(static_cast<size_t>(framebuffer.width) * framebuffer.height * 3);
+    size_t i = 0;
+    for (int y = framebuffer.height - 1; y >= 0; y--) {
+        for (int x = 0; x < framebuffer.width; x++) {
+            Vec3 pixel = framebuffer.mean(x, y);
+            values[i++] = pixel.x;
+            values[i++] = pixel.y;
+            values[i++] = pixel.z;
+        }
+    }
+
+    fprintf(file, "PF\n%d %d\n-1.0\n", framebuffer.width, framebuffer.height);
+    bool ok = fwrite(values.data(), sizeof(float), values.size(), file) == values.size();
+    return (fclose(file) == 0) && ok;
+}
+
+/* crc32()
+ * ----------------------------------------
+ * CRC used by PNG chunks, continued from a previous value
+ */
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> entries {};
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[n] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void put_chunk(std::vector<uint8_t> &out, const char type[4], const std::vector<uint8_t> &data) {
+    put_u32(out, data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_u32(out, crc32(0, out.data() + start, out.size() - start));
+}
+
+/* write_png()
+ * ----------------------------------------
+ * Write the tone mapped display image as an 8 bit RGB PNG. The image data is stored in
+ * uncompressed deflate blocks, which keeps the writer dependency free and
+ * fast at the cost of file size
+ *
+ * @param Framebuffer framebuffer
+ * @param string path
+ * @return bool success
+ */
+bool write_png(const Framebuffer &framebuffer, const std::string &path) {
+    // raw scanlines, each prefixed with filter type 0
+    size_t stride = framebuffer.width * 3 + 1;
+    std::vector<uint8_t> raw(stride * framebuffer.height);
+    for (int y = 0; y < framebuffer.height; y++) {
+        uint8_t *row = raw.data() + y * stride;
+        row[0] = 0;
+        for (int x = 0; x < framebuffer.width; x++) {
+            const uint8_t *pixel = &framebuffer.rgba[4 * (y * framebuffer.width + x)];
+            row[1 + 3 * x] = pixel[0];
+            row[2 + 3 * x] = pixel[1];
+            row[3 + 3 * x] = pixel[2];
+        }
+    }
+
+    // zlib stream of stored blocks
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    size_t offset = 0;
+    do {
+        uint16_t length = static_cast<uint16_t>(std::min<size_t>(65535, raw.size() - offset));
+        zlib.push_back(offset + length == raw.size() ? 1 : 0);
+        zlib.push_back(length & 0xFF);
+        zlib.push_back(length >> 8);
+        zlib.push_back(~length & 0xFF);
+        zlib.push_back((~length >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+        offset += length;
+    } while (offset < raw.size());
+    put_u32(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    put_u32(header, framebuffer.width);
+    put_u32(header, framebuffer.height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit RGB, no interlace
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    put_chunk(png, "IHDR", header);
+    put_chunk(png, "IDAT", zlib);
+    put_chunk(png, "IEND", {});
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+    return (fclose(file) == 0) && ok;
+}
+
+/* write_image()
+ * ----------------------------------------
+ * Write the framebuffer in the format matching the file extension of path
+ * (.ppm, .pfm or .png)
+ *
+ * @param Framebuffer framebuffer
+ * @param string path
+ * @return bool success
+ */
+bool write_image(const Framebuffer &framebuffer, const std::string &path) {
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    if (extension == "pfm") {
+        return write_pfm(framebuffer, path);
+    }
+    if (extension == "png") {
+        return write_png(framebuffer, path);
+    }
+    return write_ppm(framebuffer, path);
+}
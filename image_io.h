@@ -0,0 +1,16 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_IMAGE_IO_H
+#define RAYTRACINGFROMSCRATCH_IMAGE_IO_H
+
+#include <string>
+#include "renderer.h"
+
+bool write_ppm(const Framebuffer &framebuffer, const std::string &path);
+bool write_pfm(const Framebuffer &framebuffer, const std::string &path);
+bool write_png(const Framebuffer &framebuffer, const std::string &path);
+bool write_image(const Framebuffer &framebuffer, const std::string &path);
+
+#endif //RAYTRACINGFROMSCRATCH_IMAGE_IO_H
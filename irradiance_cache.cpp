@@ -0,0 +1,284 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include "irradiance_cache.h"
+#include "arena.h"
+#include "trace_path.h"
+#include "renderer.h"
+#include "sampler.h"
+
+// records further than this fraction of their radius behind the point's surface are not used
+#define IRRADIANCE_FRONT_TOLERANCE 0.05f
+#define IRRADIANCE_RAY_OFFSET 0.0001f
+
+/* IrradianceCache()
+ * ----------------------------------------
+ * An empty cache whose octree covers the bounds of everything in the scene
+ * but its planes. Records on a plane outside it go to the cells nearest
+ *
+ * @param Scene scene
+ */
+IrradianceCache::IrradianceCache(const Scene &scene) {
+    Aabb bounds;
+    for (const Bvh *bvh : {&scene.sphereBvh, &scene.triangleBvh, &scene.shapeBvh}) {
+        if (!bvh->nodes.empty()) {
+            const BvhNode &root = bvh->nodes[0];
+            bounds.grow(Vec3 {root.minX, root.minY, root.minZ});
+            bounds.grow(Vec3 {root.maxX, root.maxY, root.maxZ});
+        }
+    }
+    if (bounds.min.x > bounds.max.x) {
+        bounds.grow(Vec3 {-1, -1, -1});
+        bounds.grow(Vec3 {1, 1, 1});
+    }
+    Vec3 extent = bounds.max - bounds.min;
+    centre = bounds.centroid();
+    half = 0.5f * std::max(std::max(extent.x, extent.y), extent.z) * 1.01f + IRRADIANCE_MIN_RADIUS;
+    nodes.emplace_back();
+}
+
+/* lookup()
+ * ----------------------------------------
+ * Interpolate the irradiance at a point from the records that are valid
+ * there. A record's error is its distance over its radius plus how far the
+ * normals diverge (Ward et al. 1988); records with an error below
+ * IRRADIANCE_ERROR are extrapolated with their gradients and weighted by
+ * 1 / error - 1 / IRRADIANCE_ERROR, which fades them out at the edge of
+ * their area instead of cutting them off
+ *
+ * @param Vec3 point
+ * @param Vec3 normal unit
+ * @param[out] Vec3 irradiance
+ * @return bool whether any record covered the point
+ */
+bool IrradianceCache::lookup(Vec3 point, Vec3 normal, Vec3 &irradiance) const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    Vec3 sum {0, 0, 0};
+    float weightSum = 0.0f;
+    int node = 0;
+    Vec3 cell = centre;
+    float size = half;
+
+    while (node >= 0) {
+        for (int index : nodes[node].records) {
+            const IrradianceRecord &record = records[index];
+            Vec3 offset = point - record.point;
+            float error = offset.length() / record.radius + std::sqrt(std::max(1.0f - normal.dot(record.normal), 0.0f));
+            if (error >= IRRADIANCE_ERROR || offset.dot(normal + record.normal) * 0.5f < -IRRADIANCE_FRONT_TOLERANCE * record.radius) {
+                continue;
+            }
+            Vec3 axis = record.normal.cross(normal);
+            Vec3 estimate = record.irradiance + record.translation[0] * offset.x + record.translation[1] * offset.y +
+                            record.translation[2] * offset.z + record.rotation[0] * axis.x + record.rotation[1] * axis.y +
+                            record.rotation[2] * axis.z;
+            estimate = Vec3 {std::max(estimate.x, 0.0f), std::max(estimate.y, 0.0f), std::max(estimate.z, 0.0f)};
+            float weight = 1.0f / std::max(error, 1e-6f) - 1.0f / IRRADIANCE_ERROR;
+            sum += estimate * weight;
+            weightSum += weight;
+        }
+
+        // on to the child cell holding the point
+        size *= 0.5f;
+        int octant = (point.x > cell.x) | (point.y > cell.y) << 1 | (point.z > cell.z) << 2;
+        cell += Vec3 {octant & 1 ? size : -size, octant & 2 ? size : -size, octant & 4 ? size : -size};
+        node = nodes[node].children[octant];
+    }
+    if (weightSum <= 0.0f) {
+        return false;
+    }
+    irradiance = sum * (1.0f / weightSum);
+    return true;
+}
+
+/* insert()
+ * ----------------------------------------
+ * Add a record, safe to call while other threads look up or insert. The
+ * records outlive the frame, so growing them is not counted by the
+ * allocation audit
+ *
+ * @param IrradianceRecord record
+ */
+void IrradianceCache::insert(const IrradianceRecord &record) {
+    float reach = IRRADIANCE_ERROR * record.radius;
+    Aabb area;
+    area.grow(record.point - Vec3 {reach, reach, reach});
+    area.grow(record.point + Vec3 {reach, reach, reach});
+
+    AllocationAuditPause pause;
+    std::unique_lock<std::shared_mutex> guard(lock);
+    records.push_back(record);
+    insert_node(0, centre, half, area, static_cast<int>(records.size()) - 1, 0);
+}
+
+/* insert_node()
+ * ----------------------------------------
+ * Store a record in the cell once the cell is no larger than the record's
+ * area, otherwise in every child the area overlaps, creating them as needed
+ */
+void IrradianceCache::insert_node(int node, Vec3 cell, float size, const Aabb &area, int record, int depth) {
+    if (depth == IRRADIANCE_MAX_DEPTH || 2.0f * size <= area.max.x - area.min.x) {
+        nodes[node].records.push_back(record);
+        return;
+    }
+    float childSize = 0.5f * size;
+    for (int octant = 0; octant < 8; octant++) {
+        // the child covers [cell, cell + size] or [cell - size, cell] on each axis
+        bool upperX = octant & 1, upperY = octant & 2, upperZ = octant & 4;
+        if ((upperX ? area.max.x < cell.x : area.min.x > cell.x) || (upperY ? area.max.y < cell.y : area.min.y > cell.y) ||
+            (upperZ ? area.max.z < cell.z : area.min.z > cell.z)) {
+            continue;
+        }
+        int child = nodes[node].children[octant];
+        if (child < 0) {
+            child = static_cast<int>(nodes.size());
+            nodes[node].children[octant] = child;
+            nodes.emplace_back();
+        }
+        Vec3 childCell = cell + Vec3 {upperX ? childSize : -childSize, upperY ? childSize : -childSize, upperZ ? childSize : -childSize};
+        insert_node(child, childCell, childSize, area, record, depth + 1);
+    }
+}
+
+/* clear()
+ * ----------------------------------------
+ * Drop every record, for when the scene changes
+ */
+void IrradianceCache::clear() {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    records.clear();
+    nodes.assign(1, IrradianceNode());
+}
+
+/* size()
+ * ----------------------------------------
+ * @return size_t number of records
+ */
+size_t IrradianceCache::size() const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    return records.size();
+}
+
+/* point_seed()
+ * ----------------------------------------
+ * Hash of a point's coordinates, so a record's samples do not depend on
+ * which thread or pixel asked for it first
+ */
+static uint32_t point_seed(Vec3 point) {
+    uint32_t bits[3];
+    memcpy(bits, &point, sizeof(bits));
+    uint32_t hash = 2166136261u;
+    for (uint32_t word : bits) {
+        hash = (hash ^ word) * 16777619u;
+        hash ^= hash >> 15;
+    }
+    return hash;
+}
+
+/* compute_irradiance_record()
+ * ----------------------------------------
+ * Sample the hemisphere above a point with one path per stratum of a
+ * cosine weighted IRRADIANCE_THETA_STRATA x IRRADIANCE_PHI_STRATA grid, so
+ * E = pi / (M N) * sum L. The radiance and hit distance of neighbouring
+ * strata also give the translation and rotation gradients (Ward and
+ * Heckbert 1992). The radius is the harmonic mean hit distance, no larger
+ * than E over the length of its gradient and clamped to
+ * [IRRADIANCE_MIN_RADIUS, IRRADIANCE_MAX_RADIUS]
+ *
+ * @param Scene scene
+ * @param Vec3 point
+ * @param Vec3 normal unit
+ * @param int maxDepth indirect bounces after the first
+ * @return IrradianceRecord
+ */
+IrradianceRecord compute_irradiance_record(const Scene &scene, Vec3 point, Vec3 normal, int maxDepth) {
+    const int M = IRRADIANCE_THETA_STRATA;
+    const int N = IRRADIANCE_PHI_STRATA;
+    Vec3 tangent {}, bitangent {};
+    local_coordinates(normal, tangent, bitangent);
+
+    Vec3 radiance[M][N];
+    float distance[M][N];
+    Sampler sampler(SAMPLER_RANDOM, 1);
+    uint32_t seed = point_seed(point);
+
+    IrradianceRecord record;
+    record.point = point;
+    record.normal = normal;
+    float inverseDistance = 0.0f;
+    // trace_path() only counts the bounces after these first hits
+    STAT_ADD(STAT_INDIRECT_RAYS, M * N);
+    for (int j = 0; j < M; j++) {
+        for (int k = 0; k < N; k++) {
+            sampler.start_sample(static_cast<int>(seed & 0xffff), static_cast<int>(seed >> 16), j * N + k, 0);
+            float u, v;
+            sampler.get_2d(u, v);
+            float sinTheta = std::sqrt((j + u) / M);
+            float cosTheta = std::sqrt(std::max(1.0f - sinTheta * sinTheta, 0.0f));
+            float phi = 2.0f * static_cast<float>(M_PI) * (k + v) / N;
+            Vec3 across = bitangent * std::cos(phi) + tangent * std::sin(phi);
+            Vec3 direction = across * sinTheta + normal * cosTheta;
+
+            PathFeatures features;
+            radiance[j][k] = trace_path(point + direction * IRRADIANCE_RAY_OFFSET, direction, scene, sampler, maxDepth, &features);
+            distance[j][k] = std::max(features.depth, IRRADIANCE_MIN_RADIUS);
+            record.irradiance += radiance[j][k];
+            inverseDistance += 1.0f / distance[j][k];
+
+            // tilting the normal towards n x across raises cos(theta) by sin(theta) per radian
+            Vec3 tilt = normal.cross(across) * (sinTheta / std::max(cosTheta, 1e-3f));
+            record.rotation[0] += radiance[j][k] * tilt.x;
+            record.rotation[1] += radiance[j][k] * tilt.y;
+            record.rotation[2] += radiance[j][k] * tilt.z;
+        }
+    }
+    float cell = static_cast<float>(M_PI) / (M * N);
+    record.irradiance *= cell;
+    for (Vec3 &rotation : record.rotation) {
+        rotation *= cell;
+    }
+
+    // moving the point shifts what each wall between strata sees, the nearer surface sets the rate
+    for (int k = 0; k < N; k++) {
+        float centre = 2.0f * static_cast<float>(M_PI) * (k + 0.5f) / N;
+        float edge = 2.0f * static_cast<float>(M_PI) * k / N;
+        Vec3 radial = bitangent * std::cos(centre) + tangent * std::sin(centre);
+        Vec3 azimuthal = tangent * std::cos(edge) - bitangent * std::sin(edge);
+        Vec3 gradient[3] {};
+        for (int j = 0; j < M; j++) {
+            if (j > 0) {
+                // wall between theta strata j - 1 and j, at sin^2 theta = j / M
+                float sin2 = static_cast<float>(j) / M;
+                float scale = 2.0f * static_cast<float>(M_PI) / N * std::sqrt(sin2) * (1.0f - sin2) /
+                              std::min(distance[j][k], distance[j - 1][k]);
+                Vec3 change = (radiance[j][k] - radiance[j - 1][k]) * scale;
+                gradient[0] += change * radial.x;
+                gradient[1] += change * radial.y;
+                gradient[2] += change * radial.z;
+            }
+            // wall between phi strata k - 1 and k
+            int previous = (k + N - 1) % N;
+            float scale = 1.0f / (2.0f * M * std::sqrt((j + 0.5f) / M) * std::min(distance[j][k], distance[j][previous]));
+            Vec3 change = (radiance[j][k] - radiance[j][previous]) * scale;
+            gradient[0] += change * azimuthal.x;
+            gradient[1] += change * azimuthal.y;
+            gradient[2] += change * azimuthal.z;
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            record.translation[axis] += gradient[axis];
+        }
+    }
+
+    float radius = (M * N) / inverseDistance;
+    Vec3 slope {luminance(record.translation[0]), luminance(record.translation[1]), luminance(record.translation[2])};
+    float steepness = slope.length();
+    if (steepness > 0.0f) {
+        radius = std::min(radius, luminance(record.irradiance) / steepness);
+    }
+    record.radius = std::min(std::max(radius, IRRADIANCE_MIN_RADIUS), IRRADIANCE_MAX_RADIUS);
+    return record;
+}
@@ -0,0 +1,85 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_IRRADIANCE_CACHE_H
+#define RAYTRACINGFROMSCRATCH_IRRADIANCE_CACHE_H
+
+#include <cstddef>
+#include <shared_mutex>
+#include <vector>
+#include "renderer_math.h"
+#include "bvh.h"
+#include "scene.h"
+
+// hemisphere strata of a new record, cosine weighted in theta
+#define IRRADIANCE_THETA_STRATA 16
+#define IRRADIANCE_PHI_STRATA 48
+// Ward's a: records are used out to this fraction of their radius
+#define IRRADIANCE_ERROR 0.3f
+#define IRRADIANCE_MIN_RADIUS 0.05f
+#define IRRADIANCE_MAX_RADIUS 2.0f
+#define IRRADIANCE_MAX_DEPTH 20
+
+/* IrradianceRecord
+ * ------------------------
+ * Irradiance E = integral of L cos(theta) over the hemisphere above a point,
+ * sampled once and reused by nearby shading points. radius is the harmonic
+ * mean distance to the surfaces seen from the point. translation and
+ * rotation are the gradients of E (Ward and Heckbert 1992), one RGB
+ * derivative per world axis, so E can be extrapolated to a moved point or
+ * a tilted normal
+ */
+typedef struct IrradianceRecord {
+    Vec3 point {};
+    Vec3 normal {};
+    Vec3 irradiance {};
+    Vec3 translation[3] {};
+    Vec3 rotation[3] {};
+    float radius {0};
+} IrradianceRecord;
+
+/* IrradianceNode
+ * ------------------------
+ * Octree cell: the records whose area of use overlaps it and were too
+ * large to go further down, and its eight children, -1 where there is none
+ */
+typedef struct IrradianceNode {
+    int children[8] {-1, -1, -1, -1, -1, -1, -1, -1};
+    std::vector<int> records {};
+} IrradianceNode;
+
+/* IrradianceCache
+ * ------------------------
+ * Records in an octree over the scene bounds. A record is stored in every
+ * cell about the size of its area of use that it overlaps, so a lookup only
+ * walks the cells on the way down to the point. Any number of threads may
+ * look up and insert at once; lookups share a lock and inserts take it
+ * alone. Irradiance does not depend on the camera, so the cache stays valid
+ * until the scene changes
+ */
+class IrradianceCache {
+public:
+    explicit IrradianceCache(const Scene &scene);
+
+    IrradianceCache(const IrradianceCache &) = delete;
+    IrradianceCache &operator=(const IrradianceCache &) = delete;
+
+    bool lookup(Vec3 point, Vec3 normal, Vec3 &irradiance) const;
+    void insert(const IrradianceRecord &record);
+    void clear();
+    size_t size() const;
+
+private:
+    void insert_node(int node, Vec3 centre, float half, const Aabb &area, int record, int depth);
+
+    mutable std::shared_mutex lock;
+    std::vector<IrradianceNode> nodes;
+    std::vector<IrradianceRecord> records;
+    Vec3 centre {};
+    float half {0};
+};
+
+IrradianceRecord compute_irradiance_record(const Scene &scene, Vec3 point, Vec3 normal, int maxDepth);
+
+#endif //RAYTRACINGFROMSCRATCH_IRRADIANCE_CACHE_H
@@ -0,0 +1,100 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include "lights.h"
+
+/* build_light_soa()
+ * ----------------------------------------
+ * Pack the scene's lights and build the alias table used to pick lights by
+ * power. Every light type uses its intensity as its power, as the renderer
+ * applies no distance falloff and an area light's intensity is shared by
+ * its whole surface. The area lights get a BVH over their quads
+ *
+ * @param[out] LightSoA lights
+ * @param[in] vector<Light> source
+ */
+void build_light_soa(LightSoA &lights, const std::vector<Light> &source) {
+    lights = LightSoA {};
+    double total = 0.0;
+    for (const Light &light : source) {
+        if (light.type == LIGHT_AMBIENT) {
+            lights.ambient += light.intensity;
+            continue;
+        }
+        if (light.intensity <= 0) {
+            continue;
+        }
+        if (light.type == LIGHT_AREA) {
+            lights.areaLights.push_back(static_cast<int>(lights.type.size()));
+        }
+        lights.type.push_back(static_cast<uint8_t>(light.type));
+        lights.intensity.push_back(light.intensity);
+        lights.x.push_back(light.direction.x);
+        lights.y.push_back(light.direction.y);
+        lights.z.push_back(light.direction.z);
+        lights.edge1X.push_back(light.edge1.x);
+        lights.edge1Y.push_back(light.edge1.y);
+        lights.edge1Z.push_back(light.edge1.z);
+        lights.edge2X.push_back(light.edge2.x);
+        lights.edge2Y.push_back(light.edge2.y);
+        lights.edge2Z.push_back(light.edge2.z);
+        total += light.intensity;
+    }
+    int count = static_cast<int>(lights.type.size());
+    lights.count = count;
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<Aabb> bounds(lights.areaLights.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        int light = lights.areaLights[i];
+        Vec3 corner = {lights.x[light], lights.y[light], lights.z[light]};
+        Vec3 edge1 = {lights.edge1X[light], lights.edge1Y[light], lights.edge1Z[light]};
+        Vec3 edge2 = {lights.edge2X[light], lights.edge2Y[light], lights.edge2Z[light]};
+        for (Vec3 point : {corner, corner + edge1, corner + edge2, corner + edge1 + edge2}) {
+            bounds[i].grow(point);
+        }
+    }
+    build_bvh(lights.areaLightBvh, bounds);
+    std::vector<int> areaLights(bounds.size());
+    for (size_t i = 0; i < bounds.size(); i++) {
+        areaLights[i] = lights.areaLights[lights.areaLightBvh.indices[i]];
+    }
+    lights.areaLights = std::move(areaLights);
+
+    // Vose's alias method: split buckets into those under and over the average
+    // power, and top up each small bucket from a large one
+    lights.probability.resize(count);
+    lights.alias.resize(count);
+    lights.pdf.resize(count);
+    std::vector<double> scaled(count);
+    std::vector<int> small, large;
+    for (int i = 0; i < count; i++) {
+        lights.pdf[i] = static_cast<float>(lights.intensity[i] / total);
+        scaled[i] = lights.intensity[i] / total * count;
+        (scaled[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        int under = small.back();
+        int over = large.back();
+        small.pop_back();
+        lights.probability[under] = static_cast<float>(scaled[under]);
+        lights.alias[under] = over;
+        scaled[over] -= 1.0 - scaled[under];
+        if (scaled[over] < 1.0) {
+            large.pop_back();
+            small.push_back(over);
+        }
+    }
+    // whatever is left is full up to rounding error
+    for (int i : large) {
+        lights.probability[i] = 1.0f;
+        lights.alias[i] = i;
+    }
+    for (int i : small) {
+        lights.probability[i] = 1.0f;
+        lights.alias[i] = i;
+    }
+}
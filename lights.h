@@ -0,0 +1,60 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_LIGHTS_H
+#define RAYTRACINGFROMSCRATCH_LIGHTS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "renderer_math.h"
+#include "bvh.h"
+#include "objects.h"
+
+/* LightSoA
+ * ------------------------
+ * The scene's lights packed for shading, one array per field. Ambient
+ * lights only add a constant so they are summed into ambient and left out.
+ * Lights that emit nothing are dropped too. probability and alias form a
+ * Walker alias table over the light powers, and pdf is the chance of each
+ * light being picked from it. areaLights lists the area lights, the only
+ * ones a ray sampled from a surface can hit, in the order of
+ * areaLightBvh, so a ray only tests the lights whose bounds it passes
+ */
+typedef struct LightSoA {
+    int count {0};
+    float ambient {0};
+    std::vector<uint8_t> type {};
+    std::vector<float> intensity {};
+    std::vector<float> x {}, y {}, z {};
+    std::vector<float> edge1X {}, edge1Y {}, edge1Z {};
+    std::vector<float> edge2X {}, edge2Y {}, edge2Z {};
+    std::vector<float> probability {};
+    std::vector<int> alias {};
+    std::vector<float> pdf {};
+    std::vector<int> areaLights {};
+    Bvh areaLightBvh {};
+} LightSoA;
+
+void build_light_soa(LightSoA &lights, const std::vector<Light> &source);
+
+/* sample_light()
+ * ----------------------------------------
+ * Pick a light in proportion to its power with one uniform number in
+ * [0, 1), in constant time whatever the number of lights
+ *
+ * @param LightSoA lights
+ * @param float u
+ * @param[out] float pdf
+ * @return int light
+ */
+inline int sample_light(const LightSoA &lights, float u, float &pdf) {
+    float scaled = u * static_cast<float>(lights.count);
+    int bucket = std::min(static_cast<int>(scaled), lights.count - 1);
+    int light = scaled - static_cast<float>(bucket) < lights.probability[bucket] ? bucket : lights.alias[bucket];
+    pdf = lights.pdf[light];
+    return light;
+}
+
+#endif //RAYTRACINGFROMSCRATCH_LIGHTS_H
@@ -1,7 +1,11 @@
 // Libraries
 #include <SDL2/SDL.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
 #include <string>
-#include <ctime>
+#include <thread>
 #include <algorithm>
 
 // Renderer
@@ -9,22 +13,28 @@
 #include "renderer_math.h"
 #include "objects.h"
 #include "trace_path.h"
+#include "renderer.h"
+#include "thread_pool.h"
+#include "scene.h"
+#include "scene_file.h"
+#include "denoise.h"
+#include "irradiance_cache.h"
+#include "packet.h"
 
 #define CANVAS_WIDTH 600
 #define CANVAS_HEIGHT 600
-#define VIEW_WIDTH 1.0
-#define VIEW_HEIGHT 1.0
-#define DISTANCE 1.0
-
-#define LIGHTS 3
-#define OBJECTS 4
+#define REFRESH_RATE 30
+#define SAMPLES_PER_PASS 4
+#define CAMERA_STEP 0.25f
+#define EXPOSURE_STEP 0.5f
+#define ERROR_THRESHOLD 0.02f
+#define IDLE_MS 20
 
 // FUNCTION DECLARATIONS ---------------------------------------------------
-void draw_pixel(SDL_Renderer* renderer, int x, int y, int r, int g, int b);
-Vec3 view_to_canvas(int canvas_x, int canvas_y);
+void present_framebuffer(SDL_Renderer* renderer, SDL_Texture* texture, Framebuffer &framebuffer);
 // -------------------------------------------------------------------------
 
-int main() {
+int main(int argc, char* argv[]) {
 
     // Create our SDL render objects
     SDL_Window* window = nullptr;
@@ -35,27 +45,24 @@ int main() {
     SDL_CreateWindowAndRenderer(CANVAS_WIDTH, CANVAS_HEIGHT, SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL, &window, &renderer);
     SDL_Delay(100); // Conflict between SDL and KDE window manager, delay band-aid fix to resolve
 
+    // The whole canvas is uploaded through one streaming texture per refresh
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, CANVAS_WIDTH, CANVAS_HEIGHT);
+
     // Draw and clear the canvas
     SDL_SetRenderDrawColor(renderer,0,0,0,255);
     SDL_RenderClear(renderer);
 
     // ---------- Model Code ------------------------
 
-    Sphere redCircle = {{0,-0.5,3}, 1, {255,0,0}, -1, 0.0};
-    Sphere blueCircle = {{2,0.0,4}, 1, {0,0,255}, -1, 0.0};
-    Sphere greenCircle = {{-2,0.0,4}, 1, {0,0,255}, -1, 0.0};
-    Sphere yellowCircle = {{0,-5001,3}, 5000, {255,255,255}, -1, 0.0};
-    Sphere scene[OBJECTS] = {redCircle, greenCircle, blueCircle, yellowCircle};
-
-    Light ambient = {std::string {"ambient"}, 0, Vec3 {0,0,0}};
-    Light point = {std::string {"point"}, 0.8, Vec3 {2,1,0}};
-    Light directional = {std::string {"directional"}, 0.0, Vec3 {1,4,4}};
-    Light lights[LIGHTS] = {ambient, point, directional};
-
-    Triangle whiteTriangle = {Vec3 {-1, 0, 3}, Vec3 {1, 0, 3}, Vec3 {0, 1, 3}};
-    Triangle scene1[1] = {whiteTriangle};
-    //Cube whiteCube = {};
-    //Cube* scene[OBJECTS] = {&whiteCube};
+    // an optional scene file replaces the built in scene
+    Scene scene;
+    if (argc < 2) {
+        load_default_scene(scene);
+    } else if (!load_scene(argv[1], scene)) {
+        fprintf(stderr, "Could not load %s\n", argv[1]);
+        SDL_Quit();
+        return 1;
+    }
 
     // ---------- End Model Code --------------------
 
@@ -63,57 +70,162 @@ int main() {
 
     // place the eye and the frame as desired
 
-    while(true) {
-        clock_t timeStart = clock();
+    ThreadPool pool;
+    Framebuffer framebuffer(CANVAS_WIDTH, CANVAS_HEIGHT);
+    std::atomic<bool> running {true};
+    std::atomic<bool> denoising {false};
+
+    // irradiance records stay valid while the camera moves, the scene never changes
+    IrradianceCache irradianceCache(scene);
+    bool cacheIrradiance = false;
+    bool wavefront = false;
+    int packetSize = 0;
+    RenderSettings settings;
+    settings.samplesPerPixel = SAMPLES_PER_PASS;
+    settings.errorThreshold = ERROR_THRESHOLD;
+
+    // the camera is moved by the window thread and picked up at the start of each pass
+    std::mutex cameraLock;
+    Vec3 camera = scene.camera;
+    int cameraVersion = 0;
+
+    // render progressive passes in the background so the window keeps refreshing
+    std::thread renderThread([&] {
+        int renderedVersion = -1;
+        bool shownDenoised = false;
+        std::vector<float> denoised;
+        while (running) {
+            Vec3 origin {};
+            {
+                std::lock_guard<std::mutex> guard(cameraLock);
+                origin = camera;
+                settings.irradianceCache = cacheIrradiance ? &irradianceCache : nullptr;
+                settings.wavefront = wavefront;
+                settings.packetSize = packetSize;
+                if (cameraVersion != renderedVersion) {
+                    reset_accumulation(framebuffer);
+                    renderedVersion = cameraVersion;
+                }
+            }
 
-        Vec3 origin = {0, 0, 0};
-        // for each square on the canvas
-        for (int x = -CANVAS_WIDTH / 2; x < CANVAS_WIDTH / 2; x++) {
-            if (x % 100 == 0) {
-                printf("%d percent\n", x);
+            // add a few paths to the running mean of every pixel that has not converged yet,
+            // and idle once none are left until the camera moves
+            int sampled = render_pass(pool, framebuffer, origin, scene, settings);
+            if (sampled > 0) {
+                printf("Pass %d: %04.3f s, %d pixels sampled\n", framebuffer.passes, pool.batch_seconds(), sampled);
                 fflush(stdout);
             }
 
-            for (int y = -CANVAS_HEIGHT / 2; y < CANVAS_HEIGHT / 2; y++) {
-                // Determine which squares on the grid correspond to this square on the canvas
-                Vec3 transformed = view_to_canvas(x, y);
+            // the pass republished its tiles noisy, idle ones included, so a denoised view is shown again after
+            // each one. The denoiser only reruns when samples were added, otherwise its last image is reused
+            bool denoiseView = denoising;
+            if (denoiseView) {
+                if (sampled > 0 || !shownDenoised) {
+                    denoise(pool, framebuffer, denoised, DenoiseSettings());
+                }
+                tonemap_framebuffer(pool, framebuffer, &denoised);
+            }
+            shownDenoised = denoiseView;
+            if (sampled == 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+            }
+        }
+    });
 
-                // Determine the color seen through that grid square
-                Vec3i color = trace_path(origin, transformed, scene, lights, 0);
+    // present whatever tiles are finished at a fixed refresh rate
+    while (running) {
+        Uint32 frameStart = SDL_GetTicks();
 
-                // Paint the square with that color
-                draw_pixel(renderer, x, y, color.r, color.g, color.b);
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) {
+                running = false;
+            }
+            if (event.type == SDL_KEYDOWN) {
+                // display changes are picked up as the next pass republishes its tiles
+                SDL_Keycode key = event.key.keysym.sym;
+                if (key == SDLK_n) {
+                    denoising = !denoising;
+                    printf("Denoiser %s\n", denoising ? "on" : "off");
+                    continue;
+                }
+                if (key == SDLK_EQUALS || key == SDLK_MINUS || key == SDLK_t) {
+                    std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+                    DisplaySettings &display = framebuffer.display;
+                    if (key == SDLK_t) {
+                        display.toneMap = static_cast<ToneMapOperator>((display.toneMap + 1) % (TONEMAP_ACES + 1));
+                    } else {
+                        display.exposure += key == SDLK_EQUALS ? EXPOSURE_STEP : -EXPOSURE_STEP;
+                    }
+                    printf("Exposure %+.1f EV, %s tone mapping\n", display.exposure, tonemap_name(display.toneMap));
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> guard(cameraLock);
+                Vec3 step = {0, 0, 0};
+                switch (event.key.keysym.sym) {
+                    case SDLK_i:
+                        cacheIrradiance = !cacheIrradiance;
+                        printf("Irradiance cache %s, %zu records\n", cacheIrradiance ? "on" : "off", irradianceCache.size());
+                        break;
+                    case SDLK_f:
+                        wavefront = !wavefront;
+                        printf("%s renderer\n", wavefront ? "Wavefront" : "Path at a time");
+                        break;
+                    case SDLK_p:
+                        // single rays, then packets of 4, 8 and 16, which run in the wavefront renderer
+                        packetSize = packetSize == 0 ? 4 : packetSize == PACKET_MAX ? 0 : packetSize * 2;
+                        if (packetSize > 0) {
+                            printf("Packets of %d rays, wavefront renderer\n", packetSize);
+                        } else {
+                            printf("Single rays, %s renderer\n", wavefront ? "wavefront" : "path at a time");
+                        }
+                        break;
+                    case SDLK_w: step.z = CAMERA_STEP; break;
+                    case SDLK_s: step.z = -CAMERA_STEP; break;
+                    case SDLK_a: step.x = -CAMERA_STEP; break;
+                    case SDLK_d: step.x = CAMERA_STEP; break;
+                    case SDLK_e: step.y = CAMERA_STEP; break;
+                    case SDLK_q: step.y = -CAMERA_STEP; break;
+                    case SDLK_r: break; // restart accumulation without moving
+                    default: continue;
+                }
+                camera = camera.add(step);
+                cameraVersion++;
             }
         }
-        clock_t timeEnd = clock();
-        printf("Render time: %04.2f\n", (float)(timeEnd - timeStart) / CLOCKS_PER_SEC);
-        SDL_RenderPresent(renderer);
-    }
-}
 
-/* draw_pixel()
- * ----------------------
- * Draws a pixel on the screen using SDL tools
- */
-void draw_pixel(SDL_Renderer* renderer, int x, int y, int r, int g, int b) {
-    x = CANVAS_WIDTH/2 + x;
-    y = CANVAS_HEIGHT/2 - y - 1;
+        present_framebuffer(renderer, texture, framebuffer);
 
-    if (x < 0 || x >= CANVAS_WIDTH || y < 0 || y >= CANVAS_HEIGHT) {
-        return;
+        Uint32 elapsed = SDL_GetTicks() - frameStart;
+        if (elapsed < 1000 / REFRESH_RATE) {
+            SDL_Delay(1000 / REFRESH_RATE - elapsed);
+        }
     }
-    SDL_SetRenderDrawColor(renderer,r,g,b,255);
-    SDL_RenderDrawPoint(renderer, x, y);
+
+    renderThread.join();
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
 }
 
-/* view_to_canvas()
+/* present_framebuffer()
  * ----------------------
- * Takes a pixel coordinate on the canvas and returns in viewport coordinates (0,1)
+ * Copy the RGBA8 framebuffer into the streaming texture and show it
  */
-Vec3 view_to_canvas(int canvas_x, int canvas_y) {
-    Vec3 f_array{0, 0,0};
-    f_array.x = (canvas_x * VIEW_WIDTH/CANVAS_WIDTH);
-    f_array.y = (canvas_y * VIEW_HEIGHT/CANVAS_HEIGHT);
-    f_array.z = DISTANCE;
-    return f_array;
-}
\ No newline at end of file
+void present_framebuffer(SDL_Renderer* renderer, SDL_Texture* texture, Framebuffer &framebuffer) {
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) == 0) {
+        std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+        int rowBytes = 4 * framebuffer.width;
+        for (int y = 0; y < framebuffer.height; y++) {
+            memcpy(static_cast<Uint8*>(pixels) + y * pitch, framebuffer.rgba.data() + y * rowBytes, rowBytes);
+        }
+        SDL_UnlockTexture(texture);
+    }
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
@@ -0,0 +1,52 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_MATERIAL_H
+#define RAYTRACINGFROMSCRATCH_MATERIAL_H
+
+#include <vector>
+#include "renderer_math.h"
+#include "sphere_soa.h"
+
+// two materials per cache line and none straddling two
+#define MATERIAL_ALIGNMENT 32
+#define MATERIAL_TABLE_ALIGNMENT 64
+
+/* Material
+ * ------------------------
+ * Everything shading needs to know about a surface, shared by every
+ * primitive that looks the same. albedo is the linear reflectance of the
+ * 0..255 colour the scene gave
+ */
+typedef struct alignas(MATERIAL_ALIGNMENT) Material {
+    Vec3 albedo {1, 1, 1};
+    int specular {-1};
+    float emission {0};
+} Material;
+
+typedef std::vector<Material, AlignedAllocator<Material, MATERIAL_TABLE_ALIGNMENT>> MaterialTable;
+
+/* albedo()
+ * ----------------------------------------
+ * Material colours are given as 0..255 per channel, shading works on
+ * linear 0..1 reflectance
+ */
+inline Vec3 albedo(Vec3i color) {
+    return Vec3 {static_cast<float>(color.r), static_cast<float>(color.g), static_cast<float>(color.b)} * (1.0f / 255.0f);
+}
+
+/* make_material()
+ * ----------------------------------------
+ * Material of a surface described the way scene files and objects do
+ *
+ * @param Vec3i color 0..255 per channel
+ * @param int specular Phong exponent, -1 for matte
+ * @param float emission
+ * @return Material
+ */
+inline Material make_material(Vec3i color, int specular, float emission) {
+    return Material {albedo(color), specular, emission};
+}
+
+#endif //RAYTRACINGFROMSCRATCH_MATERIAL_H
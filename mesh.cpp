@@ -0,0 +1,262 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <cstdio>
+#include <cstring>
+#include "mesh.h"
+
+#define OBJ_CHUNK_SIZE (1 << 20)
+
+static const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    return p;
+}
+
+/* parse_float()
+ * ----------------------------------------
+ * Parse a decimal float in place, advancing p past it. Handles sign,
+ * fraction and exponent, which covers everything OBJ exporters write, and
+ * avoids the locale lookups of strtof
+ */
+static bool parse_float(const char *&p, const char *end, float &value) {
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+    p = skip_spaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    const char *start = p;
+    double mantissa = 0;
+    int exponent = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa * 10 + (*p++ - '0');
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p++ - '0');
+            exponent--;
+        }
+    }
+    if (p == start) {
+        return false;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        int written = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            written = written * 10 + (*p++ - '0');
+        }
+        exponent += negativeExponent ? -written : written;
+    }
+
+    while (exponent > 18) {
+        mantissa *= 1e18;
+        exponent -= 18;
+    }
+    while (exponent < -18) {
+        mantissa /= 1e18;
+        exponent += 18;
+    }
+    mantissa = exponent >= 0 ? mantissa * powers[exponent] : mantissa / powers[-exponent];
+    value = static_cast<float>(negative ? -mantissa : mantissa);
+    return true;
+}
+
+/* parse_index()
+ * ----------------------------------------
+ * Parse the vertex index of one face corner (v, v/vt, v//vn or v/vt/vn),
+ * turning OBJ's 1 based and negative relative indices into an offset into
+ * the vertex array
+ */
+static bool parse_index(const char *&p, const char *end, size_t vertexCount, uint32_t &index) {
+    p = skip_spaces(p, end);
+    bool negative = false;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return false;
+    }
+    long long value = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    // texture and normal indices are not used
+    while (p < end && *p != ' ' && *p != '\t') {
+        p++;
+    }
+
+    long long resolved = negative ? static_cast<long long>(vertexCount) - value : value - 1;
+    if (resolved < 0 || resolved >= static_cast<long long>(vertexCount)) {
+        return false;
+    }
+    index = static_cast<uint32_t>(resolved);
+    return true;
+}
+
+/* parse_line()
+ * ----------------------------------------
+ * Handle one OBJ statement. Vertices and faces are read, polygons are split
+ * into a triangle fan and every other statement is ignored
+ */
+static bool parse_line(const char *p, const char *end, Mesh &mesh) {
+    p = skip_spaces(p, end);
+    if (end - p < 2 || (p[1] != ' ' && p[1] != '\t')) {
+        return true;
+    }
+
+    if (p[0] == 'v') {
+        Vec3 vertex {};
+        p += 1;
+        if (!parse_float(p, end, vertex.x) || !parse_float(p, end, vertex.y) || !parse_float(p, end, vertex.z)) {
+            return false;
+        }
+        mesh.vertices.push_back(vertex);
+    } else if (p[0] == 'f') {
+        p += 1;
+        uint32_t first, previous, current;
+        if (!parse_index(p, end, mesh.vertices.size(), first) || !parse_index(p, end, mesh.vertices.size(), previous)) {
+            return false;
+        }
+        int corners = 2;
+        while (skip_spaces(p, end) < end) {
+            if (!parse_index(p, end, mesh.vertices.size(), current)) {
+                return false;
+            }
+            mesh.indices.push_back(first);
+            mesh.indices.push_back(previous);
+            mesh.indices.push_back(current);
+            previous = current;
+            corners++;
+        }
+        if (corners < 3) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* load_obj()
+ * ----------------------------------------
+ * Load the geometry of a Wavefront OBJ file into an indexed mesh. The file
+ * is streamed through a fixed buffer and parsed in place, so nothing is
+ * allocated per line beyond the growth of the output arrays
+ *
+ * @param string path
+ * @param[out] Mesh mesh
+ * @return bool success
+ */
+bool load_obj(const std::string &path, Mesh &mesh) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    // rough size based reservation, a vertex and its two faces take around 60 bytes of text
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size > 0) {
+        mesh.vertices.reserve(mesh.vertices.size() + size / 60);
+        mesh.indices.reserve(mesh.indices.size() + 3 * (size / 60));
+    }
+
+    std::vector<char> buffer(OBJ_CHUNK_SIZE);
+    size_t pending = 0;
+    bool ok = true;
+    int lineNumber = 0;
+
+    while (ok) {
+        size_t read = fread(buffer.data() + pending, 1, buffer.size() - pending, file);
+        size_t available = pending + read;
+        bool last = read == 0 || feof(file);
+        if (available == 0) {
+            break;
+        }
+
+        // parse every complete line, the last one only at the end of the file
+        const char *p = buffer.data();
+        const char *end = buffer.data() + available;
+        while (p < end) {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+            if (newline == nullptr && !last) {
+                break;
+            }
+            const char *lineEnd = newline != nullptr ? newline : end;
+            const char *contentEnd = lineEnd;
+            const char *comment = static_cast<const char *>(memchr(p, '#', lineEnd - p));
+            if (comment != nullptr) {
+                contentEnd = comment;
+            }
+            while (contentEnd > p && (contentEnd[-1] == '\r' || contentEnd[-1] == ' ' || contentEnd[-1] == '\t')) {
+                contentEnd--;
+            }
+
+            lineNumber++;
+            if (!parse_line(p, contentEnd, mesh)) {
+                fprintf(stderr, "%s:%d: could not parse line\n", path.c_str(), lineNumber);
+                ok = false;
+                break;
+            }
+            p = newline != nullptr ? newline + 1 : end;
+        }
+
+        // carry the partial line over to the next chunk, growing only for very long lines
+        pending = end - p;
+        if (ok && last) {
+            break;
+        }
+        memmove(buffer.data(), p, pending);
+        if (pending == buffer.size()) {
+            buffer.resize(buffer.size() * 2);
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+
+/* make_cube_mesh()
+ * ----------------------------------------
+ * Axis aligned cube from 8 corners and 12 triangles
+ *
+ * @param Vec3 min
+ * @param Vec3 max
+ * @param Vec3i color
+ * @return Mesh
+ */
+Mesh make_cube_mesh(Vec3 min, Vec3 max, Vec3i color) {
+    // 0------1  4------5
+    // |      |  |      |
+    // |      |  |      |
+    // 2------3  6------7
+    // top edges first, then bottom
+    Mesh mesh;
+    mesh.color = color;
+    mesh.vertices = {
+            {min.x, max.y, max.z}, {max.x, max.y, max.z}, {min.x, max.y, min.z}, {max.x, max.y, min.z},
+            {min.x, min.y, max.z}, {max.x, min.y, max.z}, {min.x, min.y, min.z}, {max.x, min.y, min.z},
+    };
+    mesh.indices = {
+            0, 2, 3, 0, 3, 1, // top
+            4, 6, 7, 4, 7, 5, // bottom
+            2, 6, 7, 2, 7, 3, // front
+            1, 5, 4, 1, 4, 0, // back
+            0, 4, 6, 0, 6, 2, // left
+            3, 7, 5, 3, 5, 1, // right
+    };
+    return mesh;
+}
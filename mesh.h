@@ -0,0 +1,102 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_MESH_H
+#define RAYTRACINGFROMSCRATCH_MESH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "renderer_math.h"
+
+/* Mesh
+ * ------------------------
+ * Indexed triangle mesh: every three entries of indices name the vertices
+ * of one triangle. All triangles share one color and specular exponent
+ */
+typedef struct Mesh {
+    std::vector<Vec3> vertices {};
+    std::vector<uint32_t> indices {};
+    Vec3i color {255, 255, 255};
+    int specular {-1};
+} Mesh;
+
+/* MeshTriangle
+ * ------------------------
+ * Compact triangle for intersection: the first vertex and the two edges
+ * leaving it, precomputed so Moller-Trumbore needs no vertex fetches or
+ * subtractions. material indexes the scene's material table, shared by
+ * every triangle of the mesh the triangle came from
+ */
+typedef struct MeshTriangle {
+    Vec3 v0;
+    Vec3 edge1;
+    Vec3 edge2;
+    int material;
+} MeshTriangle;
+
+bool load_obj(const std::string &path, Mesh &mesh);
+Mesh make_cube_mesh(Vec3 min, Vec3 max, Vec3i color);
+
+/* intersect_mesh_triangle()
+ * ----------------------------------------
+ * Moller-Trumbore test of a ray against a packed triangle, accepting hits
+ * with tMin < t < tMax. Kept inline as it is the inner loop of the
+ * triangle BVH leaves
+ *
+ * @param[in] MeshTriangle triangle
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMin
+ * @param[in] float tMax
+ * @param[out] float t
+ * @return bool
+ */
+inline bool intersect_mesh_triangle(const MeshTriangle &triangle, Vec3 origin, Vec3 direction, float tMin, float tMax, float &t) {
+    Vec3 P = direction.cross(triangle.edge2);
+    float determinant = triangle.edge1.dot(P);
+    if (determinant > -1e-12f && determinant < 1e-12f) {
+        return false;
+    }
+    float inverse = 1.0f / determinant;
+
+    Vec3 T = origin.subtract(triangle.v0);
+    float u = T.dot(P) * inverse;
+    if (u < 0 || u > 1) {
+        return false;
+    }
+    Vec3 Q = T.cross(triangle.edge1);
+    float v = direction.dot(Q) * inverse;
+    if (v < 0 || u + v > 1) {
+        return false;
+    }
+
+    float distance = triangle.edge2.dot(Q) * inverse;
+    if (distance <= tMin || distance >= tMax) {
+        return false;
+    }
+    t = distance;
+    return true;
+}
+
+/* triangle_barycentrics()
+ * ----------------------------------------
+ * Barycentric coordinates of the point a ray hits a packed triangle,
+ * weights of the second and third vertex, for a ray known to hit it
+ *
+ * @param[in] MeshTriangle triangle
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[out] float u
+ * @param[out] float v
+ */
+inline void triangle_barycentrics(const MeshTriangle &triangle, Vec3 origin, Vec3 direction, float &u, float &v) {
+    Vec3 P = direction.cross(triangle.edge2);
+    float inverse = 1.0f / triangle.edge1.dot(P);
+    Vec3 T = origin.subtract(triangle.v0);
+    u = T.dot(P) * inverse;
+    v = direction.dot(T.cross(triangle.edge1)) * inverse;
+}
+
+#endif //RAYTRACINGFROMSCRATCH_MESH_H
@@ -22,10 +22,25 @@ typedef struct SphereStruct {
     float emission{};
 } SphereStruct;
 
+enum LightType {
+    LIGHT_AMBIENT,
+    LIGHT_POINT,
+    LIGHT_DIRECTIONAL,
+    LIGHT_AREA,
+};
+
+/* Light
+ * ------------------------
+ * Plain light record. direction is the position of a point light, the
+ * direction towards a directional light and one corner of an area light,
+ * whose surface is the parallelogram spanned by edge1 and edge2
+ */
 typedef struct Light {
-    std::string type;
-    float intensity;
-    Vec3 direction;
+    LightType type {LIGHT_AMBIENT};
+    float intensity {0};
+    Vec3 direction {0, 0, 0};
+    Vec3 edge1 {0, 0, 0};
+    Vec3 edge2 {0, 0, 0};
 } Light;
 
 
@@ -73,72 +88,56 @@ public:
     }
 };
 
+/* Triangle
+ * ------------------------
+ * A single stand alone triangle. Meshes use the indexed layout in mesh.h
+ */
 class Triangle {
 public:
     Vec3 v0 {}; // bottom left
     Vec3 v1 {}; // bottom right
     Vec3 v2 {}; // top
     Vec3i color {255, 255, 255};
-    Vec3 vertices[3] = {v0, v1, v2};
-    Vec3 normal = get_normal(vertices);
 
-    Vec3 get_normal(Vec3 triangle_vertices[3]) const {
+    Vec3 get_normal() const {
         Vec3 A = v1.subtract(v0);
         Vec3 B = v2.subtract(v0);
-        Vec3 C = A.cross(B);
-        return C = C.normalize();
+        return A.cross(B).normalize();
     }
 
+    /* ray_triangle_intersection()
+     * ----------------------------------------
+     * Moller-Trumbore intersection, solving for the distance along the ray
+     * and the barycentric coordinates of the hit in one go
+     */
     bool ray_triangle_intersection(Vec3 origin, Vec3 direction, float *t) const {
-        // check if the ray and the triangle are parallel
-        if (fabs(normal.dot(direction)) < 0.0001) {
-            return false;
-        }
-
-        // compute D parameter of plane
-        float d = -normal.dot(v1);
-
-        // compute t
-        *t = -(normal.dot(origin) + d);
-
-        // check if triangle is behind ray
-        if (*t < 0) {
-            return false;
-        }
-
-        // compute the intersection point
-        Vec3 P = (origin.add(direction.multiplyScalar(*t)));
+        Vec3 edge1 = v1.subtract(v0);
+        Vec3 edge2 = v2.subtract(v0);
+        Vec3 P = direction.cross(edge2);
+        float determinant = edge1.dot(P);
 
-        // inside outside test
-        Vec3 C{};
-
-        // edge 0
-        Vec3 edge0 = v1.subtract(v0);
-        Vec3 vp0 = P.subtract(v0);
-        C = edge0.cross(vp0);
-        if (normal.dot(C) < 0) {
+        // check if the ray and the triangle are parallel
+        if (fabs(determinant) < 1e-8f) {
             return false;
         }
+        float inverse = 1.0f / determinant;
 
-        // edge 1
-        Vec3 edge1 = v2.subtract(v1);
-        Vec3 vp1 = P.subtract(v0);
-        C = edge1.cross(vp1);
-        if (normal.dot(C) < 0) {
+        // inside outside test against the first two barycentrics
+        Vec3 T = origin.subtract(v0);
+        float u = T.dot(P) * inverse;
+        if (u < 0 || u > 1) {
             return false;
         }
-
-        // edge 2
-        Vec3 edge2 = v0.subtract(v2);
-        Vec3 vp2 = P.subtract(v2);
-        C = edge2.cross(vp2);
-        if (normal.dot(C) < 0) {
+        Vec3 Q = T.cross(edge1);
+        float v = direction.dot(Q) * inverse;
+        if (v < 0 || u + v > 1) {
             return false;
         }
-        return true;
 
+        // check if triangle is behind ray
+        *t = edge2.dot(Q) * inverse;
+        return *t > 0;
     }
-
 };
 
 typedef struct TracedSphere {
@@ -147,49 +146,4 @@ typedef struct TracedSphere {
     int found {0};
 } TracedSphere;
 
-class Cube {
-    // 0------1  4------5
-    // |      |  |      |
-    // |      |  |      |
-    // 2------3  6------7
-    // top edges first, then bottom
-public:
-    Vec3 edges[8]{};
-    Triangle triangles[12];
-
-    Cube() {
-        populate_triangles();
-    }
-
-    void populate_triangles() {
-        edges[0] = {0,1,4};
-        edges[1] = {1,1,4};
-        edges[2] = {0,1,3};
-        edges[3] = {1,1,3};
-        edges[4] = {0,0,4};
-        edges[5] = {1,0,4};
-        edges[6] = {0,0,3};
-        edges[7] = {1,0,3};
-
-        // top
-        triangles[0] = Triangle {edges[0], edges[2], edges[3]};
-        triangles[1] = Triangle {edges[0], edges[3], edges[1]};
-        // bottom
-        triangles[2] = Triangle {edges[4], edges[6], edges[7]};
-        triangles[3] = Triangle {edges[4], edges[7], edges[5]};
-        // front
-        triangles[4] = Triangle {edges[2], edges[6], edges[7]};
-        triangles[5] = Triangle {edges[2], edges[7], edges[3]};
-        // back
-        triangles[6] = Triangle {edges[1], edges[5], edges[4]};
-        triangles[7] = Triangle {edges[1], edges[4], edges[0]};
-        // left
-        triangles[8] = Triangle {edges[0], edges[4], edges[6]};
-        triangles[9] = Triangle {edges[0], edges[6], edges[2]};
-        // right
-        triangles[10] = Triangle {edges[3], edges[7], edges[5]};
-        triangles[11] = Triangle {edges[3], edges[5], edges[1]};
-    }
-};
-
 #endif //RAYTRACINGFROMSCRATCH_OBJECTS_H
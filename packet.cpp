@@ -0,0 +1,629 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "packet.h"
+#include "sphere_soa.h"
+#include "stats.h"
+#include "trace_path.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PACKET_X86 1
+#endif
+
+// the lane loops are inlined into every kernel so each is vectorised for its own instruction set
+#define PACKET_INLINE inline __attribute__((always_inline))
+// inverse directions are clamped to this in the interval test, so axis parallel rays give no inf * 0
+#define PACKET_INVERSE_LIMIT 1e30f
+
+/* PacketLanes
+ * ------------------------
+ * A packet widened to exactly W lanes, with the inverse and squared length
+ * of each direction. Unused lanes copy lane 0 and have a tMax of -infinity
+ */
+template <int W>
+struct PacketLanes {
+    float originX[W], originY[W], originZ[W];
+    float directionX[W], directionY[W], directionZ[W];
+    float inverseX[W], inverseY[W], inverseZ[W];
+    float length2[W], inverseLength2[W];
+    float tMax[W];
+};
+
+/* PacketFrustum
+ * ------------------------
+ * Bounds of the origins and inverse directions of a packet's rays on each
+ * axis, and whether the rays run towards -axis. Only built for packets in a
+ * single octant, where every inverse on an axis has the same sign
+ */
+typedef struct PacketFrustum {
+    float originLow[3], originHigh[3];
+    float inverseLow[3], inverseHigh[3];
+    int negative[3];
+} PacketFrustum;
+
+/* load_lanes()
+ * ----------------------------------------
+ * Widen a packet to W lanes and bound it. Returns whether its directions
+ * share one octant; the frustum is only valid if they do. Fused squares the
+ * directions the way the AVX2 sphere kernel's build of Vec3::dot() does
+ */
+template <int W, bool Fused>
+PACKET_INLINE bool load_lanes(const RayPacket &packet, PacketLanes<W> &lanes, PacketFrustum &frustum) {
+    for (int lane = 0; lane < W; lane++) {
+        int source = lane < packet.count ? lane : 0;
+        lanes.originX[lane] = packet.originX[source];
+        lanes.originY[lane] = packet.originY[source];
+        lanes.originZ[lane] = packet.originZ[source];
+        lanes.directionX[lane] = packet.directionX[source];
+        lanes.directionY[lane] = packet.directionY[source];
+        lanes.directionZ[lane] = packet.directionZ[source];
+        lanes.tMax[lane] = lane < packet.count ? packet.tMax[lane] : -std::numeric_limits<float>::infinity();
+    }
+    for (int lane = 0; lane < W; lane++) {
+        lanes.inverseX[lane] = 1.0f / lanes.directionX[lane];
+        lanes.inverseY[lane] = 1.0f / lanes.directionY[lane];
+        lanes.inverseZ[lane] = 1.0f / lanes.directionZ[lane];
+        float x = lanes.directionX[lane], y = lanes.directionY[lane], z = lanes.directionZ[lane];
+        lanes.length2[lane] = Fused ? std::fma(z, z, std::fma(x, x, y * y)) : x * x + y * y + z * z;
+        lanes.inverseLength2[lane] = 1.0f / lanes.length2[lane];
+    }
+
+    // the sign bit, so -0 and +0 directions, whose inverses are -inf and +inf, fall in different octants
+    const float *origins[3] = {lanes.originX, lanes.originY, lanes.originZ};
+    const float *inverses[3] = {lanes.inverseX, lanes.inverseY, lanes.inverseZ};
+    for (int axis = 0; axis < 3; axis++) {
+        frustum.negative[axis] = std::signbit(inverses[axis][0]);
+        frustum.originLow[axis] = frustum.originHigh[axis] = origins[axis][0];
+        frustum.inverseLow[axis] = frustum.inverseHigh[axis] = inverses[axis][0];
+        for (int lane = 1; lane < packet.count; lane++) {
+            if (std::signbit(inverses[axis][lane]) != frustum.negative[axis]) {
+                return false;
+            }
+            frustum.originLow[axis] = std::min(frustum.originLow[axis], origins[axis][lane]);
+            frustum.originHigh[axis] = std::max(frustum.originHigh[axis], origins[axis][lane]);
+            frustum.inverseLow[axis] = std::min(frustum.inverseLow[axis], inverses[axis][lane]);
+            frustum.inverseHigh[axis] = std::max(frustum.inverseHigh[axis], inverses[axis][lane]);
+        }
+        frustum.inverseLow[axis] = std::min(std::max(frustum.inverseLow[axis], -PACKET_INVERSE_LIMIT), PACKET_INVERSE_LIMIT);
+        frustum.inverseHigh[axis] = std::min(std::max(frustum.inverseHigh[axis], -PACKET_INVERSE_LIMIT), PACKET_INVERSE_LIMIT);
+    }
+    return true;
+}
+
+/* frustum_misses()
+ * ----------------------------------------
+ * Interval arithmetic slab test of a node against a whole packet. The
+ * entry distance of every ray is at least the smallest product of its near
+ * plane offset and inverse over the packet's bounds, the exit at most the
+ * largest, so if the one passes the other no ray reaches the node
+ */
+PACKET_INLINE bool frustum_misses(const BvhNode &node, const PacketFrustum &frustum, float tMin, float tMax) {
+    const float low[3] = {node.minX, node.minY, node.minZ};
+    const float high[3] = {node.maxX, node.maxY, node.maxZ};
+    float entry = tMin;
+    float exit = tMax;
+    for (int axis = 0; axis < 3; axis++) {
+        float nearPlane = frustum.negative[axis] ? high[axis] : low[axis];
+        float farPlane = frustum.negative[axis] ? low[axis] : high[axis];
+        float iLow = frustum.inverseLow[axis], iHigh = frustum.inverseHigh[axis];
+
+        float a = nearPlane - frustum.originHigh[axis], b = nearPlane - frustum.originLow[axis];
+        entry = std::max(entry, std::min(std::min(a * iLow, a * iHigh), std::min(b * iLow, b * iHigh)));
+        a = farPlane - frustum.originHigh[axis];
+        b = farPlane - frustum.originLow[axis];
+        exit = std::min(exit, std::max(std::max(a * iLow, a * iHigh), std::max(b * iLow, b * iHigh)));
+    }
+    return entry > exit;
+}
+
+/* node_mask()
+ * ----------------------------------------
+ * Slab test of every lane against a node, as intersect_node() does for one
+ * ray
+ *
+ * @return uint32_t the lanes of mask whose ray enters the node
+ */
+template <int W>
+PACKET_INLINE uint32_t node_mask(const BvhNode &node, const PacketLanes<W> &lanes, float tMin, uint32_t mask) {
+    uint32_t hit = 0;
+    for (int lane = 0; lane < W; lane++) {
+        float tx1 = (node.minX - lanes.originX[lane]) * lanes.inverseX[lane];
+        float tx2 = (node.maxX - lanes.originX[lane]) * lanes.inverseX[lane];
+        float ty1 = (node.minY - lanes.originY[lane]) * lanes.inverseY[lane];
+        float ty2 = (node.maxY - lanes.originY[lane]) * lanes.inverseY[lane];
+        float tz1 = (node.minZ - lanes.originZ[lane]) * lanes.inverseZ[lane];
+        float tz2 = (node.maxZ - lanes.originZ[lane]) * lanes.inverseZ[lane];
+        float entry = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::max(std::min(tz1, tz2), tMin));
+        float exit = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::min(std::max(tz1, tz2), lanes.tMax[lane]));
+        hit |= static_cast<uint32_t>(entry <= exit) << lane;
+    }
+    return hit & mask;
+}
+
+/* sphere_lanes()
+ * ----------------------------------------
+ * Every lane of mask against spheres [first, first + count) of the SoA, one
+ * sphere at a time across the lanes, with the same arithmetic as the single
+ * ray kernels: fused multiply adds where the AVX2 kernel has them, so the
+ * lanes hit exactly the spheres single rays do. With closest, hits lower
+ * the lane's tMax and record the sphere; otherwise the lanes that hit
+ * anything are returned
+ */
+template <int W, bool Closest, bool Fused>
+PACKET_INLINE uint32_t sphere_lanes(const SphereSoA &spheres, int first, int count, PacketLanes<W> &lanes, uint32_t mask, float tMin,
+                                    int closest[W]) {
+    STAT_ADD(STAT_SPHERE_TESTS, count * __builtin_popcount(mask));
+    int on[W];
+    for (int lane = 0; lane < W; lane++) {
+        on[lane] = (mask >> lane) & 1;
+    }
+    int any[W] = {};
+    for (int i = first; i < first + count; i++) {
+        float centreX = spheres.centreX[i], centreY = spheres.centreY[i], centreZ = spheres.centreZ[i];
+        float radius2 = spheres.radius2[i];
+        int object = spheres.object[i];
+        for (int lane = 0; lane < W; lane++) {
+            float COx = lanes.originX[lane] - centreX;
+            float COy = lanes.originY[lane] - centreY;
+            float COz = lanes.originZ[lane] - centreZ;
+            float b, c, discriminant;
+            if (Fused) {
+                b = std::fma(COz, lanes.directionZ[lane], std::fma(COy, lanes.directionY[lane], COx * lanes.directionX[lane]));
+                c = std::fma(COz, COz, std::fma(COy, COy, COx * COx)) - radius2;
+                discriminant = std::fma(b, b, -(lanes.length2[lane] * c));
+            } else {
+                b = COx * lanes.directionX[lane] + COy * lanes.directionY[lane] + COz * lanes.directionZ[lane];
+                c = COx * COx + COy * COy + COz * COz - radius2;
+                discriminant = b * b - lanes.length2[lane] * c;
+            }
+            float root = std::sqrt(std::max(discriminant, 0.0f));
+            float tNear = (-b - root) * lanes.inverseLength2[lane];
+            float tFar = (-b + root) * lanes.inverseLength2[lane];
+            bool nearValid = tNear > tMin && tNear < lanes.tMax[lane];
+            bool farValid = tFar > tMin && tFar < lanes.tMax[lane];
+            bool take = on[lane] && discriminant >= 0 && (nearValid || farValid);
+            if (Closest) {
+                lanes.tMax[lane] = take ? (nearValid ? tNear : tFar) : lanes.tMax[lane];
+                closest[lane] = take ? object : closest[lane];
+            } else {
+                any[lane] |= take;
+            }
+        }
+    }
+    uint32_t hit = 0;
+    for (int lane = 0; lane < W; lane++) {
+        hit |= static_cast<uint32_t>(any[lane]) << lane;
+    }
+    return hit;
+}
+
+/* triangle_lanes()
+ * ----------------------------------------
+ * sphere_lanes() for triangles [first, first + count), Moller-Trumbore as in
+ * intersect_mesh_triangle()
+ */
+template <int W, bool Closest>
+PACKET_INLINE uint32_t triangle_lanes(const std::vector<MeshTriangle> &triangles, int first, int count, PacketLanes<W> &lanes,
+                                      uint32_t mask, float tMin, int closest[W]) {
+    STAT_ADD(STAT_TRIANGLE_TESTS, count * __builtin_popcount(mask));
+    int on[W];
+    for (int lane = 0; lane < W; lane++) {
+        on[lane] = (mask >> lane) & 1;
+    }
+    int any[W] = {};
+    for (int i = first; i < first + count; i++) {
+        const MeshTriangle &triangle = triangles[i];
+        Vec3 e1 = triangle.edge1, e2 = triangle.edge2, v0 = triangle.v0;
+        for (int lane = 0; lane < W; lane++) {
+            float dx = lanes.directionX[lane], dy = lanes.directionY[lane], dz = lanes.directionZ[lane];
+            float Px = dy * e2.z - dz * e2.y;
+            float Py = dz * e2.x - dx * e2.z;
+            float Pz = dx * e2.y - dy * e2.x;
+            float determinant = e1.x * Px + e1.y * Py + e1.z * Pz;
+            float inverse = 1.0f / determinant;
+
+            float Tx = lanes.originX[lane] - v0.x;
+            float Ty = lanes.originY[lane] - v0.y;
+            float Tz = lanes.originZ[lane] - v0.z;
+            float u = (Tx * Px + Ty * Py + Tz * Pz) * inverse;
+            float Qx = Ty * e1.z - Tz * e1.y;
+            float Qy = Tz * e1.x - Tx * e1.z;
+            float Qz = Tx * e1.y - Ty * e1.x;
+            float v = (dx * Qx + dy * Qy + dz * Qz) * inverse;
+            float distance = (e2.x * Qx + e2.y * Qy + e2.z * Qz) * inverse;
+
+            bool take = on[lane] && !(determinant > -1e-12f && determinant < 1e-12f) && u >= 0 && u <= 1 && v >= 0 && u + v <= 1 &&
+                        distance > tMin && distance < lanes.tMax[lane];
+            if (Closest) {
+                lanes.tMax[lane] = take ? distance : lanes.tMax[lane];
+                closest[lane] = take ? i : closest[lane];
+            } else {
+                any[lane] |= take;
+            }
+        }
+    }
+    uint32_t hit = 0;
+    for (int lane = 0; lane < W; lane++) {
+        hit |= static_cast<uint32_t>(any[lane]) << lane;
+    }
+    return hit;
+}
+
+/* farthest()
+ * ----------------------------------------
+ * Largest tMax of the lanes in mask, the far end of the packet's interval
+ */
+template <int W>
+PACKET_INLINE float farthest(const PacketLanes<W> &lanes, uint32_t mask) {
+    float tFar = -std::numeric_limits<float>::infinity();
+    for (int lane = 0; lane < W; lane++) {
+        tFar = std::max(tFar, (mask >> lane) & 1 ? lanes.tMax[lane] : -std::numeric_limits<float>::infinity());
+    }
+    return tFar;
+}
+
+template <int W>
+static Vec3 lane_origin(const PacketLanes<W> &lanes, int lane) {
+    return Vec3 {lanes.originX[lane], lanes.originY[lane], lanes.originZ[lane]};
+}
+
+template <int W>
+static Vec3 lane_direction(const PacketLanes<W> &lanes, int lane) {
+    return Vec3 {lanes.directionX[lane], lanes.directionY[lane], lanes.directionZ[lane]};
+}
+
+/* single_closest()
+ * ----------------------------------------
+ * Closest hit of one lane in the subtree below a node, traced as a single
+ * ray once the packet has thinned out there
+ */
+template <int W, bool Triangles>
+static void single_closest(const Scene &scene, const Bvh &bvh, int root, PacketLanes<W> &lanes, int lane, float tMin, int closest[W]) {
+    Vec3 origin = lane_origin(lanes, lane);
+    Vec3 direction = lane_direction(lanes, lane);
+    int index = -1;
+    traverse_bvh(bvh, origin, direction, tMin, lanes.tMax[lane], [&](int first, int count, float &tHit) {
+        if (!Triangles) {
+            STAT_ADD(STAT_SPHERE_TESTS, count);
+            return intersect_spheres(scene.sphereSoA, first, count, origin, direction, tMin, tHit, tHit, index);
+        }
+        STAT_ADD(STAT_TRIANGLE_TESTS, count);
+        bool hit = false;
+        for (int i = first; i < first + count; i++) {
+            if (intersect_mesh_triangle(scene.triangles[i], origin, direction, tMin, tHit, tHit)) {
+                index = i;
+                hit = true;
+            }
+        }
+        return hit;
+    }, root);
+    if (index >= 0) {
+        closest[lane] = index;
+    }
+}
+
+/* single_occluded()
+ * ----------------------------------------
+ * Any hit of one lane in the subtree below a node, traced as a single ray
+ */
+template <int W, bool Triangles>
+static bool single_occluded(const Scene &scene, const Bvh &bvh, int root, const PacketLanes<W> &lanes, int lane, float tMin) {
+    Vec3 origin = lane_origin(lanes, lane);
+    Vec3 direction = lane_direction(lanes, lane);
+    float tMax = lanes.tMax[lane];
+    return occluded_bvh(bvh, origin, direction, tMin, tMax, [&](int first, int count) {
+        if (!Triangles) {
+            STAT_ADD(STAT_SPHERE_TESTS, count);
+            return occluded_spheres(scene.sphereSoA, first, count, origin, direction, tMin, tMax);
+        }
+        STAT_ADD(STAT_TRIANGLE_TESTS, count);
+        float t;
+        for (int i = first; i < first + count; i++) {
+            if (intersect_mesh_triangle(scene.triangles[i], origin, direction, tMin, tMax, t)) {
+                return true;
+            }
+        }
+        return false;
+    }, root);
+}
+
+/* walk_closest()
+ * ----------------------------------------
+ * Closest hit walk of one BVH for the lanes in active, near child first
+ * by the packet's octant. Each node is culled against the frustum, then
+ * slab tested per lane; the lanes that reach a leaf are tested against it
+ * together, and once few lanes are left they finish the subtree one by one
+ */
+template <int W, bool Triangles, bool Fused>
+PACKET_INLINE void walk_closest(const Scene &scene, const Bvh &bvh, PacketLanes<W> &lanes, const PacketFrustum &frustum,
+                                uint32_t active, float tMin, int closest[W]) {
+    if (bvh.nodes.empty() || active == 0) {
+        return;
+    }
+    int stack[BVH_STACK_SIZE];
+    uint32_t masks[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    masks[top++] = active;
+    float tFar = farthest(lanes, active);
+
+    while (top > 0) {
+        --top;
+        int index = stack[top];
+        const BvhNode &node = bvh.nodes[index];
+        STAT_ADD(STAT_BVH_NODES, 1);
+        if (frustum_misses(node, frustum, tMin, tFar)) {
+            continue;
+        }
+        uint32_t mask = node_mask(node, lanes, tMin, masks[top]);
+        if (mask == 0) {
+            continue;
+        }
+
+        if (__builtin_popcount(mask) <= W / PACKET_SPLIT_SHARE) {
+            for (; mask != 0; mask &= mask - 1) {
+                single_closest<W, Triangles>(scene, bvh, index, lanes, __builtin_ctz(mask), tMin, closest);
+            }
+            tFar = farthest(lanes, active);
+            continue;
+        }
+        if (node.count > 0) {
+            if (Triangles) {
+                triangle_lanes<W, true>(scene.triangles, node.leftFirst, node.count, lanes, mask, tMin, closest);
+            } else {
+                sphere_lanes<W, true, Fused>(scene.sphereSoA, node.leftFirst, node.count, lanes, mask, tMin, closest);
+            }
+            tFar = farthest(lanes, active);
+            continue;
+        }
+
+        // push the far child first so the near one is popped next
+        int axis = -node.count - 1;
+        int near = node.leftFirst + frustum.negative[axis];
+        int far = node.leftFirst + 1 - frustum.negative[axis];
+        stack[top] = far;
+        masks[top++] = mask;
+        stack[top] = near;
+        masks[top++] = mask;
+    }
+}
+
+/* walk_occluded()
+ * ----------------------------------------
+ * Any hit walk of one BVH for the lanes in pending, stopping once every
+ * one of them is blocked
+ *
+ * @return uint32_t blocked lanes
+ */
+template <int W, bool Triangles, bool Fused>
+PACKET_INLINE uint32_t walk_occluded(const Scene &scene, const Bvh &bvh, PacketLanes<W> &lanes, const PacketFrustum &frustum,
+                                     uint32_t pending, float tMin) {
+    if (bvh.nodes.empty() || pending == 0) {
+        return 0;
+    }
+    int stack[BVH_STACK_SIZE];
+    uint32_t masks[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    masks[top++] = pending;
+    float tFar = farthest(lanes, pending);
+    uint32_t blocked = 0;
+
+    while (top > 0 && pending != 0) {
+        --top;
+        int index = stack[top];
+        const BvhNode &node = bvh.nodes[index];
+        uint32_t mask = masks[top] & pending;
+        if (mask == 0) {
+            continue;
+        }
+        STAT_ADD(STAT_BVH_NODES, 1);
+        if (frustum_misses(node, frustum, tMin, tFar)) {
+            continue;
+        }
+        mask = node_mask(node, lanes, tMin, mask);
+        if (mask == 0) {
+            continue;
+        }
+
+        uint32_t hit = 0;
+        if (__builtin_popcount(mask) <= W / PACKET_SPLIT_SHARE) {
+            for (; mask != 0; mask &= mask - 1) {
+                int lane = __builtin_ctz(mask);
+                hit |= static_cast<uint32_t>(single_occluded<W, Triangles>(scene, bvh, index, lanes, lane, tMin)) << lane;
+            }
+        } else if (node.count > 0) {
+            hit = Triangles ? triangle_lanes<W, false>(scene.triangles, node.leftFirst, node.count, lanes, mask, tMin, nullptr)
+                            : sphere_lanes<W, false, Fused>(scene.sphereSoA, node.leftFirst, node.count, lanes, mask, tMin, nullptr);
+        } else {
+            stack[top] = node.leftFirst + 1;
+            masks[top++] = mask;
+            stack[top] = node.leftFirst;
+            masks[top++] = mask;
+        }
+        blocked |= hit;
+        pending &= ~hit;
+    }
+    return blocked;
+}
+
+/* intersect_packet_lanes()
+ * ----------------------------------------
+ * intersect_packet() for packets of W rays
+ */
+template <int W, bool Fused>
+PACKET_INLINE void intersect_packet_lanes(const Scene &scene, const RayPacket &packet, PacketHits &hits) {
+    PacketLanes<W> lanes;
+    PacketFrustum frustum;
+    bool coherent = load_lanes<W, Fused>(packet, lanes, frustum);
+    int shapes[W], spheres[W], triangles[W];
+    for (int lane = 0; lane < W; lane++) {
+        shapes[lane] = -1;
+        spheres[lane] = -1;
+        triangles[lane] = -1;
+    }
+
+    // the few shapes are tested ray by ray first, as closest_hit() does, so the walks only look for nearer hits
+    for (int lane = 0; lane < packet.count; lane++) {
+        float closestT = std::numeric_limits<float>::infinity();
+        if (closest_intersection_shape(scene, lane_origin(lanes, lane), lane_direction(lanes, lane), packet.tMax[lane], shapes[lane],
+                                       closestT)) {
+            lanes.tMax[lane] = closestT;
+        }
+    }
+
+    if (coherent) {
+        uint32_t active = packet.count >= 32 ? ~0u : (1u << packet.count) - 1;
+        walk_closest<W, false, Fused>(scene, scene.sphereBvh, lanes, frustum, active, TMIN, spheres);
+        walk_closest<W, true, Fused>(scene, scene.triangleBvh, lanes, frustum, active, TMIN, triangles);
+    } else {
+        // the rays spread over several octants, too far apart to share the walk
+        for (int lane = 0; lane < packet.count; lane++) {
+            Vec3 origin = lane_origin(lanes, lane);
+            Vec3 direction = lane_direction(lanes, lane);
+            float closestT = lanes.tMax[lane];
+            if (!closest_intersection_sphere_index(scene, origin, direction, packet.tMax[lane], spheres[lane], closestT)) {
+                spheres[lane] = -1;
+            }
+            if (!closest_intersection_triangle(scene, origin, direction, packet.tMax[lane], triangles[lane], closestT)) {
+                triangles[lane] = -1;
+            }
+            lanes.tMax[lane] = closestT;
+        }
+    }
+    for (int lane = 0; lane < packet.count; lane++) {
+        hits.t[lane] = lanes.tMax[lane];
+        hits.shape[lane] = shapes[lane];
+        hits.sphere[lane] = spheres[lane];
+        hits.triangle[lane] = triangles[lane];
+    }
+}
+
+/* occluded_packet_lanes()
+ * ----------------------------------------
+ * occluded_packet() for packets of W rays
+ */
+template <int W, bool Fused>
+PACKET_INLINE uint32_t occluded_packet_lanes(const Scene &scene, const RayPacket &packet, float tMin) {
+    PacketLanes<W> lanes;
+    PacketFrustum frustum;
+    bool coherent = load_lanes<W, Fused>(packet, lanes, frustum);
+    if (!coherent) {
+        uint32_t blocked = 0;
+        for (int lane = 0; lane < packet.count; lane++) {
+            blocked |= static_cast<uint32_t>(occluded(scene, lane_origin(lanes, lane), lane_direction(lanes, lane), tMin,
+                                                      packet.tMax[lane])) << lane;
+        }
+        return blocked;
+    }
+
+    uint32_t pending = 0, blocked = 0;
+    for (int lane = 0; lane < packet.count; lane++) {
+        if (packet.tMax[lane] > tMin) {
+            bool shape = occluded_shapes(scene, lane_origin(lanes, lane), lane_direction(lanes, lane), tMin, packet.tMax[lane]);
+            (shape ? blocked : pending) |= 1u << lane;
+        }
+    }
+    blocked |= walk_occluded<W, false, Fused>(scene, scene.sphereBvh, lanes, frustum, pending, tMin);
+    return blocked | walk_occluded<W, true, Fused>(scene, scene.triangleBvh, lanes, frustum, pending & ~blocked, tMin);
+}
+
+typedef void (*IntersectPacketFunction)(const Scene &, const RayPacket &, PacketHits &);
+typedef uint32_t (*OccludedPacketFunction)(const Scene &, const RayPacket &, float);
+
+template <int W>
+static void intersect_packet_sse(const Scene &scene, const RayPacket &packet, PacketHits &hits) {
+    intersect_packet_lanes<W, false>(scene, packet, hits);
+}
+
+template <int W>
+static uint32_t occluded_packet_sse(const Scene &scene, const RayPacket &packet, float tMin) {
+    return occluded_packet_lanes<W, false>(scene, packet, tMin);
+}
+
+#ifdef PACKET_X86
+
+/* intersect_packet_avx2()
+ * ----------------------------------------
+ * The same lane loops compiled for AVX2 and FMA, only called when the
+ * AVX2 sphere kernel is selected
+ */
+template <int W>
+__attribute__((target("avx2,fma")))
+static void intersect_packet_avx2(const Scene &scene, const RayPacket &packet, PacketHits &hits) {
+    intersect_packet_lanes<W, true>(scene, packet, hits);
+}
+
+template <int W>
+__attribute__((target("avx2,fma")))
+static uint32_t occluded_packet_avx2(const Scene &scene, const RayPacket &packet, float tMin) {
+    return occluded_packet_lanes<W, true>(scene, packet, tMin);
+}
+
+#endif
+
+/* packet_width_index()
+ * ----------------------------------------
+ * Slot of a valid packet size in the kernel tables
+ */
+static int packet_width_index(int size) {
+    return size == 4 ? 0 : size == 8 ? 1 : 2;
+}
+
+/* valid_packet_size()
+ * ----------------------------------------
+ * @param int size
+ * @return bool whether packets of that many rays can be traced
+ */
+bool valid_packet_size(int size) {
+    return size == 4 || size == 8 || size == 16;
+}
+
+/* intersect_packet()
+ * ----------------------------------------
+ * Closest hits of the rays of a packet, as if each were traced on its own
+ * with closest_intersection_shape(), closest_intersection_sphere_index()
+ * and then closest_intersection_triangle()
+ *
+ * @param[in] Scene scene
+ * @param[in] RayPacket packet
+ * @param[in] int size 4, 8 or 16, at least packet.count
+ * @param[out] PacketHits hits
+ */
+void intersect_packet(const Scene &scene, const RayPacket &packet, int size, PacketHits &hits) {
+    static const IntersectPacketFunction sse[3] = {intersect_packet_sse<4>, intersect_packet_sse<8>, intersect_packet_sse<16>};
+#ifdef PACKET_X86
+    static const IntersectPacketFunction avx2[3] = {intersect_packet_avx2<4>, intersect_packet_avx2<8>, intersect_packet_avx2<16>};
+    if (active_sphere_kernel() == SPHERE_KERNEL_AVX2) {
+        avx2[packet_width_index(size)](scene, packet, hits);
+        return;
+    }
+#endif
+    sse[packet_width_index(size)](scene, packet, hits);
+}
+
+/* occluded_packet()
+ * ----------------------------------------
+ * occluded() for every ray of a packet. Rays with tMax <= tMin are reported
+ * unblocked
+ *
+ * @param Scene scene
+ * @param RayPacket packet
+ * @param int size 4, 8 or 16, at least packet.count
+ * @param float tMin
+ * @return uint32_t mask of the blocked rays
+ */
+uint32_t occluded_packet(const Scene &scene, const RayPacket &packet, int size, float tMin) {
+    static const OccludedPacketFunction sse[3] = {occluded_packet_sse<4>, occluded_packet_sse<8>, occluded_packet_sse<16>};
+#ifdef PACKET_X86
+    static const OccludedPacketFunction avx2[3] = {occluded_packet_avx2<4>, occluded_packet_avx2<8>, occluded_packet_avx2<16>};
+    if (active_sphere_kernel() == SPHERE_KERNEL_AVX2) {
+        return avx2[packet_width_index(size)](scene, packet, tMin);
+    }
+#endif
+    return sse[packet_width_index(size)](scene, packet, tMin);
+}
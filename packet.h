@@ -0,0 +1,75 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_PACKET_H
+#define RAYTRACINGFROMSCRATCH_PACKET_H
+
+#include <cstdint>
+#include "scene.h"
+
+// widest packet, packets of 4, 8 or 16 rays are traced
+#define PACKET_MAX 16
+// a packet goes on as single rays below a node once no more than 1 / this of its lanes reach it
+#define PACKET_SPLIT_SHARE 2
+
+/* RayPacket
+ * ------------------------
+ * Rays traced through the BVHs together, one array per component so the
+ * kernels test every ray of the packet against a node or primitive at
+ * once. Only the first count lanes are used. Directions need not be unit
+ * length, t is measured in multiples of them
+ */
+typedef struct alignas(64) RayPacket {
+    float originX[PACKET_MAX];
+    float originY[PACKET_MAX];
+    float originZ[PACKET_MAX];
+    float directionX[PACKET_MAX];
+    float directionY[PACKET_MAX];
+    float directionZ[PACKET_MAX];
+    float tMax[PACKET_MAX];
+    int count {0};
+
+    void set(int lane, Vec3 origin, Vec3 direction, float limit) {
+        originX[lane] = origin.x;
+        originY[lane] = origin.y;
+        originZ[lane] = origin.z;
+        directionX[lane] = direction.x;
+        directionY[lane] = direction.y;
+        directionZ[lane] = direction.z;
+        tMax[lane] = limit;
+    }
+} RayPacket;
+
+/* PacketHits
+ * ------------------------
+ * Closest hit of each ray of a packet beyond TMIN: the distance, the closest
+ * shape, the closest sphere (index into the scene's objects) if it is
+ * nearer and the closest triangle if it is nearer still, -1 where there is
+ * none, as resolve_hit() takes them. Rays that hit nothing keep their tMax
+ * as t
+ */
+typedef struct PacketHits {
+    float t[PACKET_MAX];
+    int shape[PACKET_MAX];
+    int sphere[PACKET_MAX];
+    int triangle[PACKET_MAX];
+} PacketHits;
+
+/* Packet traversal
+ * ------------------------
+ * Each packet walks the BVH once with the mask of its rays that reach each
+ * node. A node is first culled against the whole packet with interval
+ * arithmetic, the bounds of the packet's origins and inverse directions
+ * standing in for every ray, and only then slab tested ray by ray. Packets
+ * whose directions do not share one octant are traced as single rays, and
+ * so is the subtree below a node once no more than 1 / PACKET_SPLIT_SHARE
+ * of the lanes reach it. The kernels are built for SSE2 and AVX2 and follow
+ * the sphere kernel selected with select_sphere_kernel(). Hits and blocked
+ * rays match what single rays find
+ */
+bool valid_packet_size(int size);
+void intersect_packet(const Scene &scene, const RayPacket &packet, int size, PacketHits &hits);
+uint32_t occluded_packet(const Scene &scene, const RayPacket &packet, int size, float tMin);
+
+#endif //RAYTRACINGFROMSCRATCH_PACKET_H
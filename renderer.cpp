@@ -0,0 +1,387 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <cstdio>
+#include <cstring>
+#include "renderer.h"
+#include "arena.h"
+#include "trace_path.h"
+#include "wavefront.h"
+
+#define VIEW_WIDTH 1.0
+#define VIEW_HEIGHT 1.0
+#define DISTANCE 1.0
+
+/* render_frame()
+ * ----------------------------------------
+ * Render a complete frame from scratch in a single pass, discarding anything
+ * accumulated before
+ *
+ * @param ThreadPool pool
+ * @param[out] Framebuffer framebuffer
+ * @param Vec3 origin
+ * @param Scene scene
+ * @param RenderSettings settings
+ */
+void render_frame(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings) {
+    reset_accumulation(framebuffer);
+    render_pass(pool, framebuffer, origin, scene, settings);
+}
+
+/* accumulate_pixel()
+ * ----------------------------------------
+ * Fold the paths of one pass through a pixel into its running mean, its
+ * luminance variance (Welford) and the running means of its first hit
+ * features. Sample indices carry on from the paths already traced
+ *
+ * @param[out] Framebuffer framebuffer
+ * @param int pixel
+ * @param Vec3 radiance[] of every path
+ * @param PathFeatures features[] of every path
+ * @param int samples paths this pass
+ */
+void accumulate_pixel(Framebuffer &framebuffer, int pixel, const Vec3 radiance[], const PathFeatures features[], int samples) {
+    STAT_TIMER(STAGE_ACCUMULATE);
+    uint32_t count = framebuffer.sampleCount[pixel];
+    float *mean = &framebuffer.accumulation[3 * pixel];
+    Vec3 sum = {0, 0, 0};
+    Vec3 normalSum = {0, 0, 0};
+    Vec3 albedoSum = {0, 0, 0};
+    float depthSum = 0;
+    float luminanceMean = luminance(Vec3 {mean[0], mean[1], mean[2]});
+    float m2 = framebuffer.luminanceM2[pixel];
+    for (int i = 0; i < samples; i++) {
+        sum += radiance[i];
+        normalSum += features[i].normal;
+        albedoSum += features[i].albedo;
+        depthSum += features[i].depth;
+
+        float value = luminance(radiance[i]);
+        float delta = value - luminanceMean;
+        luminanceMean += delta / static_cast<float>(count + i + 1);
+        m2 += delta * (value - luminanceMean);
+    }
+
+    float weight = static_cast<float>(samples) / static_cast<float>(count + samples);
+    mean[0] += (sum.x / samples - mean[0]) * weight;
+    mean[1] += (sum.y / samples - mean[1]) * weight;
+    mean[2] += (sum.z / samples - mean[2]) * weight;
+    Vec3 normal = normalSum / samples;
+    Vec3 albedo = albedoSum / samples;
+    float *normals = &framebuffer.normals[3 * pixel];
+    float *albedos = &framebuffer.albedo[3 * pixel];
+    normals[0] += (normal.x - normals[0]) * weight;
+    normals[1] += (normal.y - normals[1]) * weight;
+    normals[2] += (normal.z - normals[2]) * weight;
+    albedos[0] += (albedo.x - albedos[0]) * weight;
+    albedos[1] += (albedo.y - albedos[1]) * weight;
+    albedos[2] += (albedo.z - albedos[2]) * weight;
+    framebuffer.depth[pixel] += (depthSum / samples - framebuffer.depth[pixel]) * weight;
+    framebuffer.luminanceM2[pixel] = m2;
+    framebuffer.sampleCount[pixel] = count + samples;
+}
+
+/* prime_irradiance_cache()
+ * ----------------------------------------
+ * Trace one path through every pixel and throw the radiance away, so the
+ * irradiance cache holds the records the frame needs before any pixel is
+ * shaded. Otherwise tiles rendered early would interpolate from fewer
+ * records than their neighbours, and the seams between them would stay in
+ * the accumulated image
+ */
+static void prime_irradiance_cache(ThreadPool &pool, const Framebuffer &framebuffer, Vec3 origin, const Scene &scene,
+                                   const RenderSettings &settings) {
+    int tilesX = (framebuffer.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (framebuffer.height + TILE_SIZE - 1) / TILE_SIZE;
+    pool.run(tilesX * tilesY, [&](int tile, int) {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        Sampler sampler(settings.sampler, 1);
+        for (int py = y0; py < std::min(y0 + TILE_SIZE, framebuffer.height); py++) {
+            for (int px = x0; px < std::min(x0 + TILE_SIZE, framebuffer.width); px++) {
+                Vec3 transformed = view_to_canvas(px - framebuffer.width / 2, framebuffer.height / 2 - py - 1, framebuffer.width,
+                                                  framebuffer.height);
+                sampler.start_sample(px, py, 0, framebuffer.passes);
+                trace_path(origin, transformed, scene, sampler, settings.maxDepth, nullptr, settings.irradianceCache);
+            }
+        }
+    });
+}
+
+/* render_pass()
+ * ----------------------------------------
+ * Split the canvas into TILE_SIZE squares and trace every pixel of every tile
+ * on the thread pool, folding the result into the running mean of each
+ * pixel. Tiles write to disjoint parts of the framebuffer so no locking is
+ * needed. Calling this repeatedly with a few samples per pixel converges to
+ * the same image as one pass with many, while showing a usable preview after
+ * the first pass. With adaptive sampling on, converged pixels are skipped.
+ * The first pass after a reset primes the irradiance cache, if there is one.
+ * With settings.wavefront or packets the pass is run by render_pass_wavefront() instead.
+ * Each pass is one frame of the arenas, its scratch lives in them
+ *
+ * @param ThreadPool pool
+ * @param[out] Framebuffer framebuffer
+ * @param Vec3 origin
+ * @param Scene scene
+ * @param RenderSettings settings paths per pixel for this pass and their depth
+ * @return int pixels that were sampled
+ */
+int render_pass(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings) {
+    int tilesX = (framebuffer.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (framebuffer.height + TILE_SIZE - 1) / TILE_SIZE;
+    int samples = std::max(settings.samplesPerPixel, 1);
+    bool adaptive = settings.errorThreshold > 0;
+    std::atomic<int> sampledPixels {0};
+#ifdef RAYTRACER_STATS
+    framebuffer.tileTicks.resize(tilesX * tilesY);
+#endif
+    begin_frame();
+    if (settings.irradianceCache != nullptr && framebuffer.passes == 0) {
+        prime_irradiance_cache(pool, framebuffer, origin, scene, settings);
+    }
+    if (settings.wavefront || settings.packetSize > 0) {
+        int sampled = render_pass_wavefront(pool, framebuffer, origin, scene, settings);
+        end_frame();
+        return sampled;
+    }
+
+    pool.run(tilesX * tilesY, [&](int tile, int worker) {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        int x1 = std::min(x0 + TILE_SIZE, framebuffer.width);
+        int y1 = std::min(y0 + TILE_SIZE, framebuffer.height);
+        Sampler sampler(settings.sampler, samples);
+        FrameArena &arena = frame_arena();
+        ArenaScope scratch(arena);
+        Vec3 *radiance = arena.allocate<Vec3>(samples);
+        PathFeatures *features = arena.allocate<PathFeatures>(samples);
+        int sampled = 0;
+#ifdef RAYTRACER_STATS
+        uint64_t tileStart = stat_ticks();
+#endif
+
+        for (int py = y0; py < y1; py++) {
+            for (int px = x0; px < x1; px++) {
+                int pixel = py * framebuffer.width + px;
+                uint32_t count = framebuffer.sampleCount[pixel];
+                if (adaptive && static_cast<int>(count) >= settings.minSamples &&
+                    framebuffer.error(px, py) < settings.errorThreshold) {
+                    continue;
+                }
+                sampled++;
+
+                // screen pixels run top down, the canvas is centred with y pointing up
+                int x = px - framebuffer.width / 2;
+                int y = framebuffer.height / 2 - py - 1;
+
+                // Determine which squares on the grid correspond to this square on the canvas
+                Vec3 transformed = view_to_canvas(x, y, framebuffer.width, framebuffer.height);
+
+                // Determine the color seen through that grid square. Sample indices carry on from the
+                // paths already traced so low discrepancy sequences keep filling in
+                for (int i = 0; i < samples; i++) {
+                    {
+                        STAT_TIMER(STAGE_GENERATE);
+                        sampler.start_sample(px, py, static_cast<int>(count) + i, framebuffer.passes);
+                    }
+                    STAT_ADD(STAT_CAMERA_RAYS, 1);
+                    radiance[i] = trace_path(origin, transformed, scene, sampler, settings.maxDepth, &features[i], settings.irradianceCache);
+                }
+                accumulate_pixel(framebuffer, pixel, radiance, features, samples);
+            }
+        }
+#ifdef RAYTRACER_STATS
+        framebuffer.tileTicks[tile] += stat_ticks() - tileStart;
+#endif
+        // converged tiles are republished too so display changes reach them
+        publish_tile(framebuffer, x0, y0, x1, y1);
+        sampledPixels += sampled;
+    });
+    framebuffer.passes++;
+    end_frame();
+    return sampledPixels;
+}
+
+/* render_adaptive()
+ * ----------------------------------------
+ * Keep running passes until every pixel has reached the error threshold of
+ * the settings, maxPasses have run or the time budget is spent, whichever
+ * comes first. The budget is checked between passes, so the last pass may
+ * run over it
+ *
+ * @param ThreadPool pool
+ * @param[out] Framebuffer framebuffer
+ * @param Vec3 origin
+ * @param Scene scene
+ * @param RenderSettings settings
+ * @param int maxPasses
+ * @param double timeBudget seconds, zero for no limit
+ * @return int passes run
+ */
+int render_adaptive(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings,
+                    int maxPasses, double timeBudget) {
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < maxPasses; pass++) {
+        if (render_pass(pool, framebuffer, origin, scene, settings) == 0) {
+            return pass;
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (timeBudget > 0 && elapsed >= timeBudget) {
+            return pass + 1;
+        }
+    }
+    return maxPasses;
+}
+
+/* reset_accumulation()
+ * ----------------------------------------
+ * Throw away all accumulated passes, for when the scene or camera changes
+ *
+ * @param[out] Framebuffer framebuffer
+ */
+void reset_accumulation(Framebuffer &framebuffer) {
+    std::fill(framebuffer.accumulation.begin(), framebuffer.accumulation.end(), 0.0f);
+    std::fill(framebuffer.sampleCount.begin(), framebuffer.sampleCount.end(), 0);
+    std::fill(framebuffer.luminanceM2.begin(), framebuffer.luminanceM2.end(), 0.0f);
+    std::fill(framebuffer.normals.begin(), framebuffer.normals.end(), 0.0f);
+    std::fill(framebuffer.albedo.begin(), framebuffer.albedo.end(), 0.0f);
+    std::fill(framebuffer.depth.begin(), framebuffer.depth.end(), 0.0f);
+    framebuffer.passes = 0;
+#ifdef RAYTRACER_STATS
+    std::fill(framebuffer.tileTicks.begin(), framebuffer.tileTicks.end(), 0);
+#endif
+}
+
+/* Framebuffer::error()
+ * ----------------------------------------
+ * Relative standard error of a pixel's luminance estimate, the standard
+ * deviation of the mean over the mean itself. Infinite until the pixel has
+ * two samples
+ *
+ * @param int x, y
+ * @return float
+ */
+float Framebuffer::error(int x, int y) const {
+    int pixel = y * width + x;
+    uint32_t count = sampleCount[pixel];
+    if (count < 2) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float variance = luminanceM2[pixel] / static_cast<float>(count - 1);
+    float standardError = std::sqrt(variance / static_cast<float>(count));
+    const float *mean = &accumulation[3 * pixel];
+    return standardError / (luminance(Vec3 {mean[0], mean[1], mean[2]}) + ADAPTIVE_LUMINANCE_FLOOR);
+}
+
+/* publish_tile()
+ * ----------------------------------------
+ * Tone map a finished tile into the RGBA8 display buffer. The tile is
+ * converted into a local buffer first so rgbaLock is only held for the copy
+ *
+ * @param Framebuffer framebuffer
+ * @param int x0, y0 top left pixel of the tile
+ * @param int x1, y1 one past the bottom right pixel of the tile
+ */
+void publish_tile(Framebuffer &framebuffer, int x0, int y0, int x1, int y1) {
+    STAT_TIMER(STAGE_PRESENT);
+    DisplaySettings display;
+    {
+        std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+        display = framebuffer.display;
+    }
+
+    uint8_t tile[4 * TILE_SIZE * TILE_SIZE];
+    int width = x1 - x0;
+    for (int py = y0; py < y1; py++) {
+        int offset = py * framebuffer.width + x0;
+        tonemap_span(&framebuffer.accumulation[3 * offset], tile + 4 * width * (py - y0), width, 1.0f, display);
+    }
+
+    std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+    for (int py = y0; py < y1; py++) {
+        memcpy(&framebuffer.rgba[4 * (py * framebuffer.width + x0)], tile + 4 * width * (py - y0), 4 * width);
+    }
+}
+
+/* tonemap_framebuffer()
+ * ----------------------------------------
+ * Redo the whole display buffer from the accumulated radiance, for when the
+ * display settings change. Blocks of TILE_SIZE rows are tone mapped on the
+ * pool into per job buffers, then copied in under rgbaLock, so the pass
+ * costs little even at 4K. radiance, 3 floats per pixel, is shown in place
+ * of the accumulation when given, such as the output of denoise()
+ *
+ * @param ThreadPool pool
+ * @param Framebuffer framebuffer
+ * @param vector<float> radiance optional
+ */
+void tonemap_framebuffer(ThreadPool &pool, Framebuffer &framebuffer, const std::vector<float> *radiance) {
+    DisplaySettings display;
+    {
+        std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+        display = framebuffer.display;
+    }
+    int blocks = (framebuffer.height + TILE_SIZE - 1) / TILE_SIZE;
+    const float *source = radiance != nullptr ? radiance->data() : framebuffer.accumulation.data();
+
+    pool.run(blocks, [&](int block, int) {
+        STAT_TIMER(STAGE_PRESENT);
+        int y0 = block * TILE_SIZE;
+        int y1 = std::min(y0 + TILE_SIZE, framebuffer.height);
+        size_t offset = static_cast<size_t>(y0) * framebuffer.width;
+        int pixels = (y1 - y0) * framebuffer.width;
+        std::vector<uint8_t> rows(4 * static_cast<size_t>(pixels));
+        tonemap_span(source + 3 * offset, rows.data(), pixels, 1.0f, display);
+
+        std::lock_guard<std::mutex> guard(framebuffer.rgbaLock);
+        memcpy(&framebuffer.rgba[4 * offset], rows.data(), rows.size());
+    });
+}
+
+/* print_worker_utilisation()
+ * ----------------------------------------
+ * Print how busy each worker was during the last frame, so scaling across
+ * cores can be checked from the console
+ *
+ * @param ThreadPool pool
+ */
+void print_worker_utilisation(const ThreadPool &pool) {
+    double wall = pool.batch_seconds();
+    double busy = 0.0;
+    const std::vector<WorkerStats> &stats = pool.stats();
+
+    for (int i = 0; i < pool.size(); i++) {
+        busy += stats[i].busySeconds;
+        printf("Worker %2d: %5.1f%% busy, %4d tiles (%d stolen)\n", i,
+               wall > 0 ? 100.0 * stats[i].busySeconds / wall : 0.0, stats[i].jobs, stats[i].stolen);
+    }
+    printf("Pool utilisation: %5.1f%% over %d workers\n", wall > 0 ? 100.0 * busy / (wall * pool.size()) : 0.0, pool.size());
+    fflush(stdout);
+}
+
+/* luminance()
+ * ----------------------
+ * Rec. 709 luminance of linear RGB radiance
+ */
+float luminance(Vec3 radiance) {
+    return 0.2126f * radiance.x + 0.7152f * radiance.y + 0.0722f * radiance.z;
+}
+
+/* view_to_canvas()
+ * ----------------------
+ * Takes a pixel coordinate on the canvas and returns in viewport coordinates (0,1)
+ */
+Vec3 view_to_canvas(int canvas_x, int canvas_y, int canvas_width, int canvas_height) {
+    Vec3 f_array{0, 0,0};
+    f_array.x = (canvas_x * VIEW_WIDTH/canvas_width);
+    f_array.y = (canvas_y * VIEW_HEIGHT/canvas_height);
+    f_array.z = DISTANCE;
+    return f_array;
+}
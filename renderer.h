@@ -0,0 +1,105 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_RENDERER_H
+#define RAYTRACINGFROMSCRATCH_RENDERER_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "renderer_math.h"
+#include "objects.h"
+#include "thread_pool.h"
+#include "trace_path.h"
+#include "sampler.h"
+#include "scene.h"
+#include "tonemap.h"
+#include "stats.h"
+
+#define TILE_SIZE 16
+
+// stops the relative error of nearly black pixels from blowing up
+#define ADAPTIVE_LUMINANCE_FLOOR 0.01f
+
+/* RenderSettings
+ * ------------------------
+ * Runtime quality settings: paths traced per pixel in each pass, the number
+ * of indirect bounces along each path and how their random numbers are drawn.
+ * With errorThreshold above zero sampling is adaptive: a pixel that has at
+ * least minSamples paths and whose relative standard error has dropped
+ * below errorThreshold is skipped by later passes. With an irradiance
+ * cache the indirect light of camera hits comes from its records, which
+ * carry over from pass to pass. wavefront traces the pass in stages over
+ * large batches of paths instead of one path at a time, see wavefront.h.
+ * packetSize above zero traces its camera and shadow rays in packets of
+ * that many, which implies wavefront, see packet.h
+ */
+typedef struct RenderSettings {
+    int samplesPerPixel {NUM_SAMPLES};
+    int maxDepth {NUM_BOUNCES};
+    SamplerType sampler {SAMPLER_SOBOL};
+    float errorThreshold {0};
+    int minSamples {16};
+    IrradianceCache *irradianceCache {nullptr};
+    bool wavefront {false};
+    int packetSize {0};
+} RenderSettings;
+
+/* Framebuffer
+ * ------------------------
+ * Colour of every pixel on the canvas, stored row by row from the top left
+ * corner of the screen. accumulation holds the running mean of the linear
+ * float radiance of every path traced through each pixel since the last
+ * reset, sampleCount the number of those paths and luminanceM2 the sum of
+ * squared deviations of their luminance (Welford), from which error()
+ * estimates how far the mean still is from converged. normals, albedo and
+ * depth are running means of the first hit features of the same paths,
+ * the guides of the denoiser. rgba holds
+ * the image tone mapped with display and packed as RGBA8; it is updated a
+ * tile at a time under rgbaLock so a viewer can copy it out while a pass is
+ * in progress. display may only be changed while holding rgbaLock. With
+ * RAYTRACER_STATS, tileTicks sums the time spent on each tile since the last
+ * reset for the cost heatmap
+ */
+typedef struct Framebuffer {
+    int width {0};
+    int height {0};
+    std::vector<float> accumulation {};
+    std::vector<uint32_t> sampleCount {};
+    std::vector<float> luminanceM2 {};
+    std::vector<float> normals {};
+    std::vector<float> albedo {};
+    std::vector<float> depth {};
+    int passes {0};
+    DisplaySettings display {};
+    std::vector<uint8_t> rgba {};
+    std::mutex rgbaLock {};
+#ifdef RAYTRACER_STATS
+    std::vector<uint64_t> tileTicks {};
+#endif
+
+    Framebuffer(int width, int height) : width(width), height(height), accumulation(3 * width * height),
+                                         sampleCount(width * height), luminanceM2(width * height),
+                                         normals(3 * width * height), albedo(3 * width * height), depth(width * height),
+                                         rgba(4 * width * height) {}
+    Vec3 mean(int x, int y) const {
+        const float *sum = &accumulation[3 * (y * width + x)];
+        return Vec3 {sum[0], sum[1], sum[2]};
+    }
+    float error(int x, int y) const;
+} Framebuffer;
+
+void render_frame(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings);
+int render_pass(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings);
+int render_adaptive(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings,
+                    int maxPasses, double timeBudget);
+void accumulate_pixel(Framebuffer &framebuffer, int pixel, const Vec3 radiance[], const PathFeatures features[], int samples);
+void reset_accumulation(Framebuffer &framebuffer);
+void publish_tile(Framebuffer &framebuffer, int x0, int y0, int x1, int y1);
+void tonemap_framebuffer(ThreadPool &pool, Framebuffer &framebuffer, const std::vector<float> *radiance = nullptr);
+void print_worker_utilisation(const ThreadPool &pool);
+float luminance(Vec3 radiance);
+Vec3 view_to_canvas(int canvas_x, int canvas_y, int canvas_width, int canvas_height);
+
+#endif //RAYTRACINGFROMSCRATCH_RENDERER_H
@@ -5,30 +5,142 @@
 #ifndef RAYTRACINGFROMSCRATCH_RENDERER_MATH_H
 #define RAYTRACINGFROMSCRATCH_RENDERER_MATH_H
 
-class Vec3 {
-public:
-    float x,y,z;
-    Vec3 subtract(Vec3 b) const;
-    Vec3 add(Vec3 b);
-    Vec3 multiplyScalar(float a);
-    Vec3 flipped();
-    Vec3 cross(Vec3 b);
-    Vec3 normalize();
-    float dot(Vec3 b) const;
-    float length();
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RENDERER_MATH_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RENDERER_MATH_NEON 1
+#endif
+
+/* Vector3
+ * ------------------------
+ * Three component vector, header only so every call inlines into the trace
+ * loops. The named methods and the operators are interchangeable, and
+ * everything except the square root based ones is constexpr
+ */
+template <typename T>
+struct Vector3 {
+    T x, y, z;
+
+    constexpr Vector3 subtract(Vector3 b) const { return Vector3 {x - b.x, y - b.y, z - b.z}; }
+    constexpr Vector3 add(Vector3 b) const { return Vector3 {x + b.x, y + b.y, z + b.z}; }
+    constexpr Vector3 multiplyScalar(T a) const { return Vector3 {x * a, y * a, z * a}; }
+    constexpr Vector3 multiply(Vector3 b) const { return Vector3 {x * b.x, y * b.y, z * b.z}; }
+    constexpr Vector3 flipped() const { return Vector3 {-x, -y, -z}; }
+    constexpr Vector3 cross(Vector3 b) const { return Vector3 {y*b.z - z*b.y, z*b.x - x*b.z, x*b.y - y*b.x}; }
+    constexpr T dot(Vector3 b) const { return (x * b.x) + (y * b.y) + (z * b.z); }
+    T length() const { return std::sqrt(dot(*this)); }
+
+    // one square root and three multiplies instead of three divides by length()
+    Vector3 normalize() const { return multiplyScalar(T(1) / std::sqrt(dot(*this))); }
+
+    constexpr Vector3 operator+(Vector3 b) const { return add(b); }
+    constexpr Vector3 operator-(Vector3 b) const { return subtract(b); }
+    constexpr Vector3 operator-() const { return flipped(); }
+    constexpr Vector3 operator*(T a) const { return multiplyScalar(a); }
+    constexpr Vector3 operator/(T a) const { return multiplyScalar(T(1) / a); }
+    constexpr Vector3 &operator+=(Vector3 b) { return *this = add(b); }
+    constexpr Vector3 &operator-=(Vector3 b) { return *this = subtract(b); }
+    constexpr Vector3 &operator*=(T a) { return *this = multiplyScalar(a); }
+};
+
+template <typename T>
+constexpr Vector3<T> operator*(T a, Vector3<T> v) { return v.multiplyScalar(a); }
+
+/* Color3
+ * ------------------------
+ * Three channel color. Scaling by a float truncates back to the channel type
+ */
+template <typename T>
+struct Color3 {
+    T r, g, b;
+
+    constexpr Color3 multiplyScalar(float a) const {
+        return Color3 {static_cast<T>(r * a), static_cast<T>(g * a), static_cast<T>(b * a)};
+    }
+    constexpr Color3 add(Color3 k) const { return Color3 {r + k.r, g + k.g, b + k.b}; }
+
+    constexpr Color3 operator+(Color3 k) const { return add(k); }
+    constexpr Color3 operator*(float a) const { return multiplyScalar(a); }
+    constexpr Color3 &operator+=(Color3 k) { return *this = add(k); }
 };
 
-class Vec3i {
-public:
-    int r,g,b;
-    Vec3i multiplyScalar(float a);
-    Vec3i add(Vec3i k);
-    };
+typedef Vector3<float> Vec3;
+typedef Vector3<double> Vec3d;
+typedef Color3<int> Vec3i;
+
+/* Vec3A
+ * ------------------------
+ * 16 byte aligned vector held in one SSE or NEON register where available,
+ * with a fourth lane that is kept at zero. For code that works on whole
+ * vectors at a time; convert from and to Vec3 at the edges. min() and max()
+ * pick like std::min() and std::max(), so a NaN in b is never returned,
+ * and the BVH slab test gives the same answer in every build
+ */
+struct alignas(16) Vec3A {
+#if defined(RENDERER_MATH_SSE)
+    __m128 v;
+
+    Vec3A() : v(_mm_setzero_ps()) {}
+    explicit Vec3A(__m128 value) : v(value) {}
+    explicit Vec3A(Vec3 a) : v(_mm_set_ps(0.0f, a.z, a.y, a.x)) {}
+    // x, y and z from p, which must be followed by one more readable float
+    static Vec3A load(const float *p) {
+        return Vec3A(_mm_and_ps(_mm_loadu_ps(p), _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1))));
+    }
+    Vec3A operator+(Vec3A b) const { return Vec3A(_mm_add_ps(v, b.v)); }
+    Vec3A operator-(Vec3A b) const { return Vec3A(_mm_sub_ps(v, b.v)); }
+    Vec3A operator*(Vec3A b) const { return Vec3A(_mm_mul_ps(v, b.v)); }
+    Vec3A operator*(float a) const { return Vec3A(_mm_mul_ps(v, _mm_set1_ps(a))); }
+    Vec3A min(Vec3A b) const { return Vec3A(_mm_min_ps(b.v, v)); }
+    Vec3A max(Vec3A b) const { return Vec3A(_mm_max_ps(b.v, v)); }
+    float x() const { return _mm_cvtss_f32(v); }
+    float y() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))); }
+    float z() const { return _mm_cvtss_f32(_mm_movehl_ps(v, v)); }
+#elif defined(RENDERER_MATH_NEON)
+    float32x4_t v;
 
-class Vec2 {
-public:
+    Vec3A() : v(vdupq_n_f32(0.0f)) {}
+    explicit Vec3A(float32x4_t value) : v(value) {}
+    explicit Vec3A(Vec3 a) {
+        float lanes[4] = {a.x, a.y, a.z, 0.0f};
+        v = vld1q_f32(lanes);
+    }
+    static Vec3A load(const float *p) { return Vec3A(vsetq_lane_f32(0.0f, vld1q_f32(p), 3)); }
+    Vec3A operator+(Vec3A b) const { return Vec3A(vaddq_f32(v, b.v)); }
+    Vec3A operator-(Vec3A b) const { return Vec3A(vsubq_f32(v, b.v)); }
+    Vec3A operator*(Vec3A b) const { return Vec3A(vmulq_f32(v, b.v)); }
+    Vec3A operator*(float a) const { return Vec3A(vmulq_n_f32(v, a)); }
+    Vec3A min(Vec3A b) const { return Vec3A(vbslq_f32(vcltq_f32(b.v, v), b.v, v)); }
+    Vec3A max(Vec3A b) const { return Vec3A(vbslq_f32(vcltq_f32(v, b.v), b.v, v)); }
+    float x() const { return vgetq_lane_f32(v, 0); }
+    float y() const { return vgetq_lane_f32(v, 1); }
+    float z() const { return vgetq_lane_f32(v, 2); }
+#else
+    float v[4];
+
+    Vec3A() : v{0.0f, 0.0f, 0.0f, 0.0f} {}
+    explicit Vec3A(Vec3 a) : v{a.x, a.y, a.z, 0.0f} {}
+    static Vec3A load(const float *p) { return Vec3A(Vec3 {p[0], p[1], p[2]}); }
+    Vec3A operator+(Vec3A b) const { return Vec3A(Vec3 {v[0] + b.v[0], v[1] + b.v[1], v[2] + b.v[2]}); }
+    Vec3A operator-(Vec3A b) const { return Vec3A(Vec3 {v[0] - b.v[0], v[1] - b.v[1], v[2] - b.v[2]}); }
+    Vec3A operator*(Vec3A b) const { return Vec3A(Vec3 {v[0] * b.v[0], v[1] * b.v[1], v[2] * b.v[2]}); }
+    Vec3A operator*(float a) const { return Vec3A(Vec3 {v[0] * a, v[1] * a, v[2] * a}); }
+    Vec3A min(Vec3A b) const { return Vec3A(Vec3 {std::min(v[0], b.v[0]), std::min(v[1], b.v[1]), std::min(v[2], b.v[2])}); }
+    Vec3A max(Vec3A b) const { return Vec3A(Vec3 {std::max(v[0], b.v[0]), std::max(v[1], b.v[1]), std::max(v[2], b.v[2])}); }
+    float x() const { return v[0]; }
+    float y() const { return v[1]; }
+    float z() const { return v[2]; }
+#endif
+    Vec3 vec3() const { return Vec3 {x(), y(), z()}; }
+};
+
+struct Vec2 {
     float t1, t2;
 };
 
 #endif //RAYTRACINGFROMSCRATCH_RENDERER_MATH_H
-
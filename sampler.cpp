@@ -0,0 +1,352 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "sampler.h"
+#include "arena.h"
+
+/* hash()
+ * ----------------------------------------
+ * 32 bit integer hash with good avalanche (lowbias32), used to turn pixel,
+ * sample and dimension indices into independent seeds
+ */
+static uint32_t hash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t value) {
+    return hash(seed ^ (value + 0x9e3779b9U + (seed << 6) + (seed >> 2)));
+}
+
+static float to_float(uint32_t bits) {
+    return (bits >> 8) * 0x1p-24f;
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffU) << 8) | ((x & 0xff00ff00U) >> 8);
+    x = ((x & 0x0f0f0f0fU) << 4) | ((x & 0xf0f0f0f0U) >> 4);
+    x = ((x & 0x33333333U) << 2) | ((x & 0xccccccccU) >> 2);
+    x = ((x & 0x55555555U) << 1) | ((x & 0xaaaaaaaaU) >> 1);
+    return x;
+}
+
+/* nested_uniform_scramble()
+ * ----------------------------------------
+ * Owen scramble the bits of x using the hash based Laine-Karras permutation
+ * (Burley, "Practical Hash-based Owen Scrambling", 2020)
+ */
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47cU;
+    x ^= x * 0xb82f1e52U;
+    x ^= x * 0xc7afe638U;
+    x ^= x * 0x8d22f6e6U;
+    return reverse_bits(x);
+}
+
+/* sobol_2d()
+ * ----------------------------------------
+ * The first two dimensions of the Sobol sequence, as 32 bit fractions. The
+ * first is the van der Corput sequence, the second uses the Pascal matrix
+ */
+static void sobol_2d(uint32_t index, uint32_t &x, uint32_t &y) {
+    x = reverse_bits(index);
+    y = 0;
+    for (uint32_t v = 1U << 31; index != 0; index >>= 1, v ^= v >> 1) {
+        if (index & 1) {
+            y ^= v;
+        }
+    }
+}
+
+/* permute()
+ * ----------------------------------------
+ * Index i of a pseudo random permutation of 0..length-1 chosen by seed
+ * (Kensler, "Correlated Multi-Jittered Sampling", 2013)
+ */
+static uint32_t permute(uint32_t i, uint32_t length, uint32_t seed) {
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893dU;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fU;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69U;
+        i ^= (i & mask) >> 11;
+        i *= 0x74dcb303U;
+        i ^= (i & mask) >> 2;
+        i *= 0x9e501cc3U;
+        i ^= (i & mask) >> 2;
+        i *= 0xc860a3dfU;
+        i &= mask;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+/* start_sample()
+ * ----------------------------------------
+ * Seed the sampler for one path. The same pixel, sample index and frame
+ * always produce the same numbers, whichever thread traces them
+ *
+ * @param int x, y pixel on the canvas
+ * @param int sampleIndex index of this sample within the pixel
+ * @param int frame
+ */
+void Sampler::start_sample(int x, int y, int sampleIndex, int frame) {
+    pixelX = x;
+    pixelY = y;
+    this->sampleIndex = static_cast<uint32_t>(sampleIndex);
+    dimension = 0;
+
+    // the low discrepancy samplers keep their sequence going across frames
+    // through the sample index, so the frame only decorrelates random numbers
+    uint32_t seed = hash_combine(hash(static_cast<uint32_t>(x)), static_cast<uint32_t>(y));
+    pixelSeed = seed;
+    if (type == SAMPLER_RANDOM || type == SAMPLER_STRATIFIED) {
+        seed = hash_combine(seed, static_cast<uint32_t>(frame));
+        pixelSeed = seed;
+    }
+    rng = Pcg32(hash_combine(seed, this->sampleIndex), seed);
+}
+
+/* get_1d()
+ * ----------------------------------------
+ * Next sample dimension in [0, 1)
+ *
+ * @return float
+ */
+float Sampler::get_1d() {
+    uint32_t dimensionSeed = hash_combine(pixelSeed, dimension++);
+
+    switch (type) {
+        case SAMPLER_STRATIFIED: {
+            uint32_t stratum = permute(sampleIndex % samplesPerPixel, samplesPerPixel, dimensionSeed);
+            return (stratum + rng.next_float()) / samplesPerPixel;
+        }
+        case SAMPLER_SOBOL: {
+            uint32_t index = nested_uniform_scramble(sampleIndex, dimensionSeed);
+            return to_float(nested_uniform_scramble(reverse_bits(index), hash(dimensionSeed)));
+        }
+        case SAMPLER_BLUE_NOISE: {
+            // golden ratio sequence, rotated per pixel by the mask shifted for this dimension
+            float offset = blue_noise_mask(pixelX + 7 * dimension, pixelY + 13 * dimension);
+            float value = offset + 0.6180339887f * sampleIndex;
+            return value - std::floor(value);
+        }
+        case SAMPLER_RANDOM:
+        default:
+            return rng.next_float();
+    }
+}
+
+/* get_2d()
+ * ----------------------------------------
+ * Next two sample dimensions in [0, 1)^2, stratified together
+ *
+ * @param[out] float u
+ * @param[out] float v
+ */
+void Sampler::get_2d(float &u, float &v) {
+    uint32_t dimensionSeed = hash_combine(pixelSeed, dimension);
+    dimension += 2;
+
+    switch (type) {
+        case SAMPLER_STRATIFIED: {
+            // square grid of strata, any samples beyond the grid are jittered over the whole square
+            uint32_t side = static_cast<uint32_t>(std::sqrt(static_cast<float>(samplesPerPixel)));
+            uint32_t stratum = permute(sampleIndex % samplesPerPixel, samplesPerPixel, dimensionSeed);
+            if (stratum < side * side) {
+                u = (stratum % side + rng.next_float()) / side;
+                v = (stratum / side + rng.next_float()) / side;
+            } else {
+                u = rng.next_float();
+                v = rng.next_float();
+            }
+            return;
+        }
+        case SAMPLER_SOBOL: {
+            uint32_t x, y;
+            sobol_2d(nested_uniform_scramble(sampleIndex, dimensionSeed), x, y);
+            u = to_float(nested_uniform_scramble(x, hash(dimensionSeed)));
+            v = to_float(nested_uniform_scramble(y, hash(dimensionSeed + 1)));
+            return;
+        }
+        case SAMPLER_BLUE_NOISE: {
+            // R2 sequence (Roberts 2018) rotated per pixel by two shifted copies of the mask
+            float offsetU = blue_noise_mask(pixelX + 7 * dimension, pixelY + 13 * dimension);
+            float offsetV = blue_noise_mask(pixelX + 7 * dimension + BLUE_NOISE_SIZE / 2, pixelY + 13 * dimension + 5);
+            u = offsetU + 0.7548776662f * sampleIndex;
+            v = offsetV + 0.5698402910f * sampleIndex;
+            u -= std::floor(u);
+            v -= std::floor(v);
+            return;
+        }
+        case SAMPLER_RANDOM:
+        default:
+            u = rng.next_float();
+            v = rng.next_float();
+            return;
+    }
+}
+
+/* build_blue_noise_mask()
+ * ----------------------------------------
+ * Build a tileable BLUE_NOISE_SIZE^2 threshold mask with the void and cluster
+ * method (Ulichney 1993). Points are ranked by repeatedly removing the
+ * tightest cluster of an initial pattern and then filling the largest void,
+ * using a Gaussian energy that is updated incrementally as points change
+ */
+static std::vector<float> build_blue_noise_mask() {
+    const int size = BLUE_NOISE_SIZE;
+    const int count = size * size;
+    const float sigma = 1.5f;
+
+    // toroidal Gaussian weight for every offset in the tile
+    std::vector<float> kernel(count);
+    for (int dy = 0; dy < size; dy++) {
+        for (int dx = 0; dx < size; dx++) {
+            float x = static_cast<float>(std::min(dx, size - dx));
+            float y = static_cast<float>(std::min(dy, size - dy));
+            kernel[dy * size + dx] = std::exp(-(x * x + y * y) / (2 * sigma * sigma));
+        }
+    }
+
+    std::vector<char> pattern(count, 0);
+    std::vector<float> energy(count, 0.0f);
+    auto toggle = [&](std::vector<char> &points, std::vector<float> &field, int p, bool on) {
+        points[p] = on;
+        float sign = on ? 1.0f : -1.0f;
+        int px = p % size;
+        int py = p / size;
+        for (int q = 0; q < count; q++) {
+            int dx = (q % size - px + size) % size;
+            int dy = (q / size - py + size) % size;
+            field[q] += sign * kernel[dy * size + dx];
+        }
+    };
+    auto extreme = [&](const std::vector<char> &points, const std::vector<float> &field, bool ones) {
+        int best = -1;
+        for (int q = 0; q < count; q++) {
+            if ((points[q] != 0) != ones) {
+                continue;
+            }
+            if (best < 0 || (ones ? field[q] > field[best] : field[q] < field[best])) {
+                best = q;
+            }
+        }
+        return best;
+    };
+
+    // random initial pattern over a tenth of the tile, relaxed until stable
+    Pcg32 rng(0x5eed);
+    int initial = count / 10;
+    for (int placed = 0; placed < initial;) {
+        int p = static_cast<int>(rng.next_uint() % count);
+        if (!pattern[p]) {
+            toggle(pattern, energy, p, true);
+            placed++;
+        }
+    }
+    for (int iteration = 0; iteration < count; iteration++) {
+        int cluster = extreme(pattern, energy, true);
+        toggle(pattern, energy, cluster, false);
+        int largestVoid = extreme(pattern, energy, false);
+        toggle(pattern, energy, largestVoid, true);
+        if (largestVoid == cluster) {
+            break;
+        }
+    }
+
+    std::vector<int> rank(count, 0);
+
+    // rank the initial points from the tightest cluster down
+    std::vector<char> points = pattern;
+    std::vector<float> field = energy;
+    for (int ones = initial; ones > 0; ones--) {
+        int cluster = extreme(points, field, true);
+        toggle(points, field, cluster, false);
+        rank[cluster] = ones - 1;
+    }
+
+    // rank the remaining points by filling the largest void
+    for (int ones = initial; ones < count; ones++) {
+        int largestVoid = extreme(pattern, energy, false);
+        toggle(pattern, energy, largestVoid, true);
+        rank[largestVoid] = ones;
+    }
+
+    std::vector<float> mask(count);
+    for (int q = 0; q < count; q++) {
+        mask[q] = (rank[q] + 0.5f) / count;
+    }
+    return mask;
+}
+
+/* blue_noise_mask()
+ * ----------------------------------------
+ * Threshold in (0, 1) of the tiled blue noise mask at a pixel
+ *
+ * @param int x, y
+ * @return float
+ */
+float blue_noise_mask(int x, int y) {
+    // built on first use, which may fall inside a frame
+    static const std::vector<float> mask = [] {
+        AllocationAuditPause pause;
+        return build_blue_noise_mask();
+    }();
+    x = ((x % BLUE_NOISE_SIZE) + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+    y = ((y % BLUE_NOISE_SIZE) + BLUE_NOISE_SIZE) % BLUE_NOISE_SIZE;
+    return mask[y * BLUE_NOISE_SIZE + x];
+}
+
+/* parse_sampler_type()
+ * ----------------------------------------
+ * Sampler type for a command line name (random, stratified, sobol, bluenoise)
+ *
+ * @param[in] char name
+ * @param[out] bool valid
+ * @return SamplerType
+ */
+SamplerType parse_sampler_type(const char *name, bool &valid) {
+    valid = true;
+    for (SamplerType type : {SAMPLER_RANDOM, SAMPLER_STRATIFIED, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE}) {
+        if (!strcmp(name, sampler_type_name(type))) {
+            return type;
+        }
+    }
+    valid = false;
+    return SAMPLER_RANDOM;
+}
+
+const char *sampler_type_name(SamplerType type) {
+    switch (type) {
+        case SAMPLER_STRATIFIED: return "stratified";
+        case SAMPLER_SOBOL: return "sobol";
+        case SAMPLER_BLUE_NOISE: return "bluenoise";
+        case SAMPLER_RANDOM:
+        default: return "random";
+    }
+}
@@ -0,0 +1,88 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_SAMPLER_H
+#define RAYTRACINGFROMSCRATCH_SAMPLER_H
+
+#include <cstdint>
+
+#define BLUE_NOISE_SIZE 32
+
+/* Pcg32
+ * ------------------------
+ * Small and fast PCG random number generator (O'Neill, pcg32_random_r).
+ * 16 bytes of state, so one can be created per pixel sample for free
+ */
+class Pcg32 {
+public:
+    Pcg32(uint64_t seed = 0x853c49e6748fea9bULL, uint64_t sequence = 0xda3e39cb94b95bdbULL) {
+        state = 0;
+        increment = (sequence << 1u) | 1u;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t xorShifted = static_cast<uint32_t>(((old >> 18u) ^ old) >> 27u);
+        uint32_t rotation = static_cast<uint32_t>(old >> 59u);
+        return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+    }
+
+    // uniform float in [0, 1)
+    float next_float() {
+        return (next_uint() >> 8) * 0x1p-24f;
+    }
+
+private:
+    uint64_t state;
+    uint64_t increment;
+};
+
+enum SamplerType {
+    SAMPLER_RANDOM,
+    SAMPLER_STRATIFIED,
+    SAMPLER_SOBOL,
+    SAMPLER_BLUE_NOISE,
+};
+
+/* Sampler
+ * ------------------------
+ * Hands out the random numbers used along one path. start_sample() seeds it
+ * deterministically from the pixel, the sample index within that pixel and
+ * the frame, and every get_1d()/get_2d() call after that moves on to the next
+ * dimension of the sample
+ *
+ * SAMPLER_RANDOM      independent PCG numbers
+ * SAMPLER_STRATIFIED  jittered strata over the samples of one pass
+ * SAMPLER_SOBOL       Owen scrambled (0,2) Sobol points, decorrelated per dimension pair
+ * SAMPLER_BLUE_NOISE  R2 low discrepancy points rotated by a blue noise mask so
+ *                     the error left between neighbouring pixels is high frequency
+ */
+class Sampler {
+public:
+    Sampler(SamplerType type, int samplesPerPixel) : type(type), samplesPerPixel(samplesPerPixel) {}
+
+    void start_sample(int x, int y, int sampleIndex, int frame);
+    float get_1d();
+    void get_2d(float &u, float &v);
+
+private:
+    SamplerType type;
+    int samplesPerPixel;
+    int pixelX {0};
+    int pixelY {0};
+    uint32_t sampleIndex {0};
+    uint32_t pixelSeed {0};
+    uint32_t dimension {0};
+    Pcg32 rng {};
+};
+
+SamplerType parse_sampler_type(const char *name, bool &valid);
+const char *sampler_type_name(SamplerType type);
+float blue_noise_mask(int x, int y);
+
+#endif //RAYTRACINGFROMSCRATCH_SAMPLER_H
@@ -0,0 +1,160 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+#include "scene.h"
+
+/* load_default_scene()
+ * ----------------------------------------
+ * Three spheres resting on a ground plane, lit by a point light
+ *
+ * @param[out] Scene scene
+ */
+void load_default_scene(Scene &scene) {
+    Sphere redCircle = {{0,-0.5,3}, 1, {255,0,0}, -1, 0.0};
+    Sphere blueCircle = {{2,0.0,4}, 1, {0,0,255}, -1, 0.0};
+    Sphere greenCircle = {{-2,0.0,4}, 1, {0,0,255}, -1, 0.0};
+    scene.objects = {redCircle, greenCircle, blueCircle};
+
+    Shape ground;
+    ground.type = SHAPE_PLANE;
+    ground.position = Vec3 {0, -1, 0};
+    ground.normal = Vec3 {0, 1, 0};
+    scene.shapes = {ground};
+
+    Light ambient = {LIGHT_AMBIENT, 0, Vec3 {0,0,0}};
+    Light point = {LIGHT_POINT, 0.8, Vec3 {2,1,0}};
+    Light directional = {LIGHT_DIRECTIONAL, 0.0, Vec3 {1,4,4}};
+    scene.lights = {ambient, point, directional};
+    scene.meshes.clear();
+    scene.camera = Vec3 {0, 0, 0};
+
+    prepare_scene(scene);
+}
+
+/* prepare_scene()
+ * ----------------------------------------
+ * Rebuild the intersection structures from the scene's objects: a BVH over
+ * the spheres with their SoA copy in BVH leaf order, and a BVH over the
+ * packed triangles of every mesh, also stored in leaf order. The lights are
+ * packed for sampling by power and the materials gathered into one table.
+ * Bounded shapes get a BVH of their own, planes are left out of it
+ *
+ * @param[out] Scene scene
+ */
+void prepare_scene(Scene &scene) {
+    build_light_soa(scene.lightSoA, scene.lights);
+    std::vector<int> meshMaterials;
+    build_materials(scene, meshMaterials);
+
+    std::vector<Aabb> bounds(scene.objects.size());
+    for (size_t i = 0; i < scene.objects.size(); i++) {
+        Vec3 centre = scene.objects[i].centre;
+        float radius = scene.objects[i].radius;
+        bounds[i].grow(centre.subtract(Vec3 {radius, radius, radius}));
+        bounds[i].grow(centre.add(Vec3 {radius, radius, radius}));
+    }
+    build_bvh(scene.sphereBvh, bounds);
+    build_sphere_soa(scene.sphereSoA, scene.objects.data(), scene.sphereBvh.indices);
+
+    std::vector<MeshTriangle> triangles;
+    bounds.clear();
+    for (int m = 0; m < static_cast<int>(scene.meshes.size()); m++) {
+        const Mesh &mesh = scene.meshes[m];
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            Vec3 v0 = mesh.vertices[mesh.indices[i]];
+            Vec3 v1 = mesh.vertices[mesh.indices[i + 1]];
+            Vec3 v2 = mesh.vertices[mesh.indices[i + 2]];
+            triangles.push_back(MeshTriangle {v0, v1.subtract(v0), v2.subtract(v0), meshMaterials[m]});
+
+            Aabb box;
+            box.grow(v0);
+            box.grow(v1);
+            box.grow(v2);
+            bounds.push_back(box);
+        }
+    }
+    build_bvh(scene.triangleBvh, bounds);
+    scene.triangles.resize(triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        scene.triangles[i] = triangles[scene.triangleBvh.indices[i]];
+    }
+
+    bounds.clear();
+    for (Shape &shape : scene.shapes) {
+        shape.normal = shape.normal.normalize();
+        Aabb box;
+        if (shape_bounds(shape, box)) {
+            bounds.push_back(box);
+        }
+    }
+    build_bvh(scene.shapeBvh, bounds);
+    pack_shapes(scene);
+}
+
+/* pack_shapes()
+ * ----------------------------------------
+ * Split the scene's shapes into the planes, tested by every ray on their
+ * own, and the bounded shapes in the leaf order of the shape BVH, which
+ * was built over the bounded shapes in scene order
+ *
+ * @param[in,out] Scene scene
+ * @return bool false if the BVH does not match the shapes
+ */
+bool pack_shapes(Scene &scene) {
+    std::vector<int> bounded;
+    scene.unboundedShapes.clear();
+    for (int i = 0; i < static_cast<int>(scene.shapes.size()); i++) {
+        Aabb box;
+        (shape_bounds(scene.shapes[i], box) ? bounded : scene.unboundedShapes).push_back(i);
+    }
+    if (scene.shapeBvh.indices.size() != bounded.size()) {
+        return false;
+    }
+    scene.boundedShapes.resize(bounded.size());
+    for (size_t i = 0; i < bounded.size(); i++) {
+        scene.boundedShapes[i] = bounded[scene.shapeBvh.indices[i]];
+    }
+    return true;
+}
+
+/* build_materials()
+ * ----------------------------------------
+ * Gather the colours, specular exponents and emission of the spheres,
+ * meshes and shapes into the scene's material table, one entry for each
+ * distinct combination, and point every sphere and shape at its entry
+ *
+ * @param[in,out] Scene scene
+ * @param[out] vector<int> meshMaterials the entry of each mesh
+ */
+void build_materials(Scene &scene, std::vector<int> &meshMaterials) {
+    typedef std::tuple<int, int, int, int, float> Look;
+    std::map<Look, int> entries;
+    auto entry = [&](Vec3i color, int specular, float emission) {
+        auto inserted = entries.emplace(Look {color.r, color.g, color.b, specular, emission}, static_cast<int>(scene.materials.size()));
+        if (inserted.second) {
+            scene.materials.push_back(make_material(color, specular, emission));
+        }
+        return inserted.first->second;
+    };
+
+    scene.materials.clear();
+    scene.sphereMaterials.resize(scene.objects.size());
+    for (size_t i = 0; i < scene.objects.size(); i++) {
+        const Sphere &sphere = scene.objects[i];
+        scene.sphereMaterials[i] = entry(sphere.color, sphere.specular, sphere.emission);
+    }
+    meshMaterials.resize(scene.meshes.size());
+    for (size_t m = 0; m < scene.meshes.size(); m++) {
+        meshMaterials[m] = entry(scene.meshes[m].color, scene.meshes[m].specular, 0.0f);
+    }
+    scene.shapeMaterials.resize(scene.shapes.size());
+    for (size_t i = 0; i < scene.shapes.size(); i++) {
+        const Shape &shape = scene.shapes[i];
+        scene.shapeMaterials[i] = entry(shape.color, shape.specular, shape.emission);
+    }
+}
@@ -0,0 +1,52 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_SCENE_H
+#define RAYTRACINGFROMSCRATCH_SCENE_H
+
+#include <vector>
+#include "objects.h"
+#include "sphere_soa.h"
+#include "bvh.h"
+#include "mesh.h"
+#include "lights.h"
+#include "material.h"
+#include "shapes.h"
+
+/* Scene
+ * ------------------------
+ * Every object and light the renderer traces against, plus the structures
+ * derived from them for fast intersection and shading. Call prepare_scene()
+ * after changing the objects. camera is the eye position the scene was set
+ * up for. materials holds one entry per distinct look of the spheres,
+ * meshes and shapes, sphereMaterials and shapeMaterials the entry of each
+ * of the objects and shapes. The planes among the shapes are listed in
+ * unboundedShapes, the rest in boundedShapes in shapeBvh leaf order
+ */
+typedef struct Scene {
+    std::vector<Sphere> objects;
+    std::vector<Light> lights;
+    std::vector<Mesh> meshes;
+    std::vector<Shape> shapes;
+    Vec3 camera {0, 0, 0};
+
+    LightSoA lightSoA;
+    Bvh sphereBvh;
+    SphereSoA sphereSoA;
+    Bvh triangleBvh;
+    std::vector<MeshTriangle> triangles;
+    Bvh shapeBvh;
+    std::vector<int> boundedShapes;
+    std::vector<int> unboundedShapes;
+    MaterialTable materials;
+    std::vector<int> sphereMaterials;
+    std::vector<int> shapeMaterials;
+} Scene;
+
+void load_default_scene(Scene &scene);
+void prepare_scene(Scene &scene);
+void build_materials(Scene &scene, std::vector<int> &meshMaterials);
+bool pack_shapes(Scene &scene);
+
+#endif //RAYTRACINGFROMSCRATCH_SCENE_H
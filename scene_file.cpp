@@ -0,0 +1,817 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "scene_file.h"
+
+#define SCENE_CACHE_MAGIC "RTSC"
+
+static_assert(std::is_trivially_copyable<Sphere>::value, "spheres are cached as raw bytes");
+static_assert(std::is_trivially_copyable<MeshTriangle>::value, "triangles are cached as raw bytes");
+static_assert(std::is_trivially_copyable<BvhNode>::value, "BVH nodes are cached as raw bytes");
+static_assert(std::is_trivially_copyable<Light>::value, "lights are cached as raw bytes");
+static_assert(std::is_trivially_copyable<Shape>::value, "shapes are cached as raw bytes");
+
+/* JsonValue
+ * ------------------------
+ * Parsed JSON document node. Object members keep their file order in keys
+ * and items, and line is where the value started for error messages
+ */
+typedef struct JsonValue {
+    enum Type {JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT};
+    Type type {JSON_NULL};
+    double number {0.0};
+    std::string string {};
+    std::vector<std::string> keys {};
+    std::vector<JsonValue> items {};
+    int line {1};
+
+    const JsonValue *find(const char *key) const {
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) {
+                return &items[i];
+            }
+        }
+        return nullptr;
+    }
+} JsonValue;
+
+/* JsonParser
+ * ------------------------
+ * Recursive descent parser over a whole file held in memory
+ */
+typedef struct JsonParser {
+    const char *p;
+    const char *end;
+    int line {1};
+    const char *error {nullptr};
+} JsonParser;
+
+static bool parse_json_value(JsonParser &parser, JsonValue &value, int depth);
+
+static void skip_whitespace(JsonParser &parser) {
+    while (parser.p < parser.end && (*parser.p == ' ' || *parser.p == '\t' || *parser.p == '\r' || *parser.p == '\n')) {
+        parser.line += *parser.p == '\n';
+        parser.p++;
+    }
+}
+
+static bool json_fail(JsonParser &parser, const char *message) {
+    if (parser.error == nullptr) {
+        parser.error = message;
+    }
+    return false;
+}
+
+static bool parse_json_string(JsonParser &parser, std::string &string) {
+    parser.p++;
+    string.clear();
+    while (parser.p < parser.end && *parser.p != '"') {
+        char c = *parser.p++;
+        if (c == '\n') {
+            return json_fail(parser, "newline in string");
+        }
+        if (c == '\\') {
+            if (parser.p >= parser.end) {
+                break;
+            }
+            c = *parser.p++;
+            switch (c) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case '"': case '\\': case '/': break;
+                default: return json_fail(parser, "unsupported escape in string");
+            }
+        }
+        string.push_back(c);
+    }
+    if (parser.p >= parser.end) {
+        return json_fail(parser, "unterminated string");
+    }
+    parser.p++;
+    return true;
+}
+
+static bool parse_json_value(JsonParser &parser, JsonValue &value, int depth) {
+    if (depth > 64) {
+        return json_fail(parser, "nested too deeply");
+    }
+    skip_whitespace(parser);
+    value.line = parser.line;
+    if (parser.p >= parser.end) {
+        return json_fail(parser, "unexpected end of file");
+    }
+
+    char c = *parser.p;
+    if (c == '{' || c == '[') {
+        bool object = c == '{';
+        char close = object ? '}' : ']';
+        value.type = object ? JsonValue::JSON_OBJECT : JsonValue::JSON_ARRAY;
+        parser.p++;
+        skip_whitespace(parser);
+        if (parser.p < parser.end && *parser.p == close) {
+            parser.p++;
+            return true;
+        }
+        while (true) {
+            if (object) {
+                skip_whitespace(parser);
+                if (parser.p >= parser.end || *parser.p != '"') {
+                    return json_fail(parser, "expected a member name");
+                }
+                value.keys.emplace_back();
+                if (!parse_json_string(parser, value.keys.back())) {
+                    return false;
+                }
+                skip_whitespace(parser);
+                if (parser.p >= parser.end || *parser.p != ':') {
+                    return json_fail(parser, "expected ':' after member name");
+                }
+                parser.p++;
+            }
+            value.items.emplace_back();
+            if (!parse_json_value(parser, value.items.back(), depth + 1)) {
+                return false;
+            }
+            skip_whitespace(parser);
+            if (parser.p < parser.end && *parser.p == ',') {
+                parser.p++;
+                continue;
+            }
+            if (parser.p < parser.end && *parser.p == close) {
+                parser.p++;
+                return true;
+            }
+            return json_fail(parser, object ? "expected ',' or '}'" : "expected ',' or ']'");
+        }
+    }
+    if (c == '"') {
+        value.type = JsonValue::JSON_STRING;
+        return parse_json_string(parser, value.string);
+    }
+    if (c == '-' || (c >= '0' && c <= '9')) {
+        // the file buffer is null terminated so strtod cannot run off the end
+        char *numberEnd = nullptr;
+        value.type = JsonValue::JSON_NUMBER;
+        value.number = strtod(parser.p, &numberEnd);
+        if (numberEnd == parser.p) {
+            return json_fail(parser, "malformed number");
+        }
+        parser.p = numberEnd;
+        return true;
+    }
+
+    static const char *literals[] = {"true", "false", "null"};
+    for (const char *literal : literals) {
+        size_t length = strlen(literal);
+        if (static_cast<size_t>(parser.end - parser.p) >= length && !strncmp(parser.p, literal, length)) {
+            value.type = literal[0] == 'n' ? JsonValue::JSON_NULL : JsonValue::JSON_BOOL;
+            value.number = literal[0] == 't' ? 1.0 : 0.0;
+            parser.p += length;
+            return true;
+        }
+    }
+    return json_fail(parser, "unexpected character");
+}
+
+/* SceneMaterial
+ * ------------------------
+ * Named surface description that spheres, meshes and shapes refer to
+ */
+typedef struct SceneMaterial {
+    Vec3i color {255, 255, 255};
+    int specular {-1};
+    float emission {0.0f};
+} SceneMaterial;
+
+static bool scene_error(const std::string &path, const JsonValue &value, const char *message) {
+    fprintf(stderr, "%s:%d: %s\n", path.c_str(), value.line, message);
+    return false;
+}
+
+static bool read_number(const std::string &path, const JsonValue &value, float &number) {
+    if (value.type != JsonValue::JSON_NUMBER) {
+        return scene_error(path, value, "expected a number");
+    }
+    number = static_cast<float>(value.number);
+    return true;
+}
+
+static bool read_vec3(const std::string &path, const JsonValue &value, Vec3 &vector) {
+    if (value.type != JsonValue::JSON_ARRAY || value.items.size() != 3) {
+        return scene_error(path, value, "expected an array of three numbers");
+    }
+    return read_number(path, value.items[0], vector.x) && read_number(path, value.items[1], vector.y) &&
+           read_number(path, value.items[2], vector.z);
+}
+
+/* read_material()
+ * ----------------------------------------
+ * Resolve the "material" member of a sphere, mesh or shape, then let any
+ * color, specular or emission given inline override it
+ */
+static bool read_material(const std::string &path, const JsonValue &value, const std::map<std::string, SceneMaterial> &materials,
+                          SceneMaterial &material) {
+    material = SceneMaterial {};
+    if (const JsonValue *name = value.find("material")) {
+        auto found = name->type == JsonValue::JSON_STRING ? materials.find(name->string) : materials.end();
+        if (found == materials.end()) {
+            return scene_error(path, *name, "unknown material");
+        }
+        material = found->second;
+    }
+    if (const JsonValue *color = value.find("color")) {
+        Vec3 rgb {};
+        if (!read_vec3(path, *color, rgb)) {
+            return false;
+        }
+        material.color = Vec3i {static_cast<int>(rgb.x), static_cast<int>(rgb.y), static_cast<int>(rgb.z)};
+    }
+    if (const JsonValue *specular = value.find("specular")) {
+        float exponent;
+        if (!read_number(path, *specular, exponent)) {
+            return false;
+        }
+        if (exponent != -1.0f && (exponent < 0.0f || exponent != std::floor(exponent) || exponent >= static_cast<float>(INT_MAX))) {
+            return scene_error(path, *specular, "specular must be -1 or a non-negative integer");
+        }
+        material.specular = static_cast<int>(exponent);
+    }
+    if (const JsonValue *emission = value.find("emission")) {
+        if (!read_number(path, *emission, material.emission)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool read_mesh(const std::string &path, const std::string &directory, const JsonValue &value,
+                      const std::map<std::string, SceneMaterial> &materials, Mesh &mesh, std::vector<std::string> &dependencies) {
+    if (const JsonValue *file = value.find("file")) {
+        if (file->type != JsonValue::JSON_STRING) {
+            return scene_error(path, *file, "expected a file name");
+        }
+        std::string objPath = file->string[0] == '/' ? file->string : directory + file->string;
+        if (!load_obj(objPath, mesh)) {
+            return scene_error(path, *file, "could not load mesh");
+        }
+        dependencies.push_back(objPath);
+    } else if (const JsonValue *cube = value.find("cube")) {
+        const JsonValue *min = cube->find("min");
+        const JsonValue *max = cube->find("max");
+        Vec3 low {}, high {};
+        if (min == nullptr || max == nullptr) {
+            return scene_error(path, *cube, "cube needs min and max corners");
+        }
+        if (!read_vec3(path, *min, low) || !read_vec3(path, *max, high)) {
+            return false;
+        }
+        mesh = make_cube_mesh(low, high, mesh.color);
+    } else {
+        const JsonValue *vertices = value.find("vertices");
+        const JsonValue *indices = value.find("indices");
+        if (vertices == nullptr || indices == nullptr || vertices->type != JsonValue::JSON_ARRAY ||
+            indices->type != JsonValue::JSON_ARRAY || indices->items.size() % 3 != 0) {
+            return scene_error(path, value, "mesh needs a file, a cube, or vertices and triangle indices");
+        }
+        for (const JsonValue &vertex : vertices->items) {
+            mesh.vertices.emplace_back();
+            if (!read_vec3(path, vertex, mesh.vertices.back())) {
+                return false;
+            }
+        }
+        for (const JsonValue &index : indices->items) {
+            if (index.type != JsonValue::JSON_NUMBER || index.number < 0 || index.number >= mesh.vertices.size()) {
+                return scene_error(path, index, "vertex index out of range");
+            }
+            mesh.indices.push_back(static_cast<uint32_t>(index.number));
+        }
+    }
+
+    // optional placement, scaled about the origin then moved
+    float scale = 1.0f;
+    Vec3 translate {0, 0, 0};
+    if (const JsonValue *scaleValue = value.find("scale")) {
+        if (!read_number(path, *scaleValue, scale)) {
+            return false;
+        }
+    }
+    if (const JsonValue *translateValue = value.find("translate")) {
+        if (!read_vec3(path, *translateValue, translate)) {
+            return false;
+        }
+    }
+    for (Vec3 &vertex : mesh.vertices) {
+        vertex = vertex.multiplyScalar(scale).add(translate);
+    }
+
+    SceneMaterial material;
+    if (!read_material(path, value, materials, material)) {
+        return false;
+    }
+    mesh.color = material.color;
+    mesh.specular = material.specular;
+    return true;
+}
+
+/* read_shape()
+ * ----------------------------------------
+ * One entry of the planes, disks or boxes of a scene file. Planes give a
+ * point and a normal, disks a centre, normal and radius, boxes their min
+ * and max corners
+ */
+static bool read_shape(const std::string &path, const JsonValue &value, ShapeType type,
+                       const std::map<std::string, SceneMaterial> &materials, Shape &shape) {
+    shape.type = type;
+    if (type == SHAPE_BOX) {
+        const JsonValue *min = value.find("min");
+        const JsonValue *max = value.find("max");
+        if (min == nullptr || max == nullptr) {
+            return scene_error(path, value, "box needs min and max corners");
+        }
+        if (!read_vec3(path, *min, shape.position) || !read_vec3(path, *max, shape.corner)) {
+            return false;
+        }
+        if (shape.position.x > shape.corner.x || shape.position.y > shape.corner.y || shape.position.z > shape.corner.z) {
+            return scene_error(path, value, "box min corner must not be above its max corner");
+        }
+    } else {
+        const JsonValue *position = value.find(type == SHAPE_DISK ? "centre" : "point");
+        const JsonValue *normal = value.find("normal");
+        if (position == nullptr || normal == nullptr) {
+            return scene_error(path, value, type == SHAPE_DISK ? "disk needs a centre and a normal" : "plane needs a point and a normal");
+        }
+        if (!read_vec3(path, *position, shape.position) || !read_vec3(path, *normal, shape.normal)) {
+            return false;
+        }
+        if (shape.normal.dot(shape.normal) == 0.0f) {
+            return scene_error(path, *normal, "normal must not be zero");
+        }
+        if (type == SHAPE_DISK) {
+            const JsonValue *radius = value.find("radius");
+            if (radius == nullptr) {
+                return scene_error(path, value, "disk needs a radius");
+            }
+            if (!read_number(path, *radius, shape.radius)) {
+                return false;
+            }
+        }
+    }
+
+    SceneMaterial material;
+    if (!read_material(path, value, materials, material)) {
+        return false;
+    }
+    shape.color = material.color;
+    shape.specular = material.specular;
+    shape.emission = material.emission;
+    return true;
+}
+
+/* parse_scene_file()
+ * ----------------------------------------
+ * Load a JSON scene description:
+ *
+ *   {
+ *     "camera": {"position": [0, 0, 0]},
+ *     "materials": {"red": {"color": [255, 0, 0], "specular": -1}},
+ *     "spheres": [{"centre": [0, -0.5, 3], "radius": 1, "material": "red"}],
+ *     "planes": [{"point": [0, -1, 0], "normal": [0, 1, 0]}],
+ *     "disks": [{"centre": [0, 2, 3], "normal": [0, -1, 0], "radius": 0.5}],
+ *     "boxes": [{"min": [1, -1, 5], "max": [2, 0, 6], "material": "red"}],
+ *     "meshes": [{"file": "bunny.obj", "scale": 2, "translate": [0, -1, 3]},
+ *                {"cube": {"min": [-1, -1, 4], "max": [0, 0, 5]}}],
+ *     "lights": [{"type": "point", "intensity": 0.8, "position": [2, 1, 0]},
+ *                {"type": "area", "intensity": 0.5, "position": [-1, 3, 2],
+ *                 "edge1": [2, 0, 0], "edge2": [0, 0, 2]}]
+ *   }
+ *
+ * Spheres, meshes and shapes may give color, specular and emission inline
+ * instead of, or on top of, a named material. Mesh files are relative to
+ * the scene file. Every file read is added to dependencies. The
+ * acceleration structures are not built, call prepare_scene() afterwards
+ *
+ * @param string path
+ * @param[out] Scene scene
+ * @param[out] vector<string> dependencies
+ * @return bool success
+ */
+bool parse_scene_file(const std::string &path, Scene &scene, std::vector<std::string> &dependencies) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Could not open %s\n", path.c_str());
+        return false;
+    }
+    std::string text;
+    char chunk[1 << 16];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        text.append(chunk, read);
+    }
+    fclose(file);
+
+    JsonParser parser {text.c_str(), text.c_str() + text.size()};
+    JsonValue root;
+    if (parse_json_value(parser, root, 0)) {
+        skip_whitespace(parser);
+        if (parser.p != parser.end) {
+            json_fail(parser, "trailing characters after the scene");
+        }
+    }
+    if (parser.error != nullptr) {
+        fprintf(stderr, "%s:%d: %s\n", path.c_str(), parser.line, parser.error);
+        return false;
+    }
+    if (root.type != JsonValue::JSON_OBJECT) {
+        return scene_error(path, root, "the scene must be an object");
+    }
+
+    std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    dependencies.assign(1, path);
+    scene.objects.clear();
+    scene.lights.clear();
+    scene.meshes.clear();
+    scene.shapes.clear();
+    scene.camera = Vec3 {0, 0, 0};
+
+    if (const JsonValue *camera = root.find("camera")) {
+        const JsonValue *position = camera->find("position");
+        if (position != nullptr && !read_vec3(path, *position, scene.camera)) {
+            return false;
+        }
+    }
+
+    std::map<std::string, SceneMaterial> materials;
+    if (const JsonValue *table = root.find("materials")) {
+        if (table->type != JsonValue::JSON_OBJECT) {
+            return scene_error(path, *table, "materials must be an object of named materials");
+        }
+        for (size_t i = 0; i < table->keys.size(); i++) {
+            if (!read_material(path, table->items[i], materials, materials[table->keys[i]])) {
+                return false;
+            }
+        }
+    }
+
+    if (const JsonValue *spheres = root.find("spheres")) {
+        for (const JsonValue &value : spheres->items) {
+            const JsonValue *centre = value.find("centre");
+            const JsonValue *radius = value.find("radius");
+            if (centre == nullptr || radius == nullptr) {
+                return scene_error(path, value, "sphere needs a centre and a radius");
+            }
+            Sphere sphere;
+            SceneMaterial material;
+            if (!read_vec3(path, *centre, sphere.centre) || !read_number(path, *radius, sphere.radius) ||
+                !read_material(path, value, materials, material)) {
+                return false;
+            }
+            sphere.color = material.color;
+            sphere.specular = material.specular;
+            sphere.emission = material.emission;
+            scene.objects.push_back(sphere);
+        }
+    }
+
+    static const char *shapeLists[] = {"planes", "disks", "boxes"};
+    for (int type = SHAPE_PLANE; type <= SHAPE_BOX; type++) {
+        if (const JsonValue *shapes = root.find(shapeLists[type])) {
+            for (const JsonValue &value : shapes->items) {
+                Shape shape;
+                if (!read_shape(path, value, static_cast<ShapeType>(type), materials, shape)) {
+                    return false;
+                }
+                scene.shapes.push_back(shape);
+            }
+        }
+    }
+
+    if (const JsonValue *meshes = root.find("meshes")) {
+        for (const JsonValue &value : meshes->items) {
+            Mesh mesh;
+            if (!read_mesh(path, directory, value, materials, mesh, dependencies)) {
+                return false;
+            }
+            scene.meshes.push_back(std::move(mesh));
+        }
+    }
+
+    if (const JsonValue *lights = root.find("lights")) {
+        for (const JsonValue &value : lights->items) {
+            const JsonValue *type = value.find("type");
+            const JsonValue *intensity = value.find("intensity");
+            if (type == nullptr || type->type != JsonValue::JSON_STRING || intensity == nullptr) {
+                return scene_error(path, value, "light needs a type and an intensity");
+            }
+            // point and area lights keep their position in direction, as the renderer expects
+            static const char *names[] = {"ambient", "point", "directional", "area"};
+            Light light;
+            int kind = 0;
+            while (kind < 4 && type->string != names[kind]) {
+                kind++;
+            }
+            if (kind == 4) {
+                return scene_error(path, *type, "light type must be ambient, point, directional or area");
+            }
+            light.type = static_cast<LightType>(kind);
+            if (!read_number(path, *intensity, light.intensity)) {
+                return false;
+            }
+            if (light.type != LIGHT_AMBIENT) {
+                const JsonValue *where = value.find(light.type == LIGHT_DIRECTIONAL ? "direction" : "position");
+                if (where == nullptr) {
+                    return scene_error(path, value, light.type == LIGHT_DIRECTIONAL ? "directional light needs a direction" :
+                                                                                      "light needs a position");
+                }
+                if (!read_vec3(path, *where, light.direction)) {
+                    return false;
+                }
+            }
+            if (light.type == LIGHT_AREA) {
+                const JsonValue *edge1 = value.find("edge1");
+                const JsonValue *edge2 = value.find("edge2");
+                if (edge1 == nullptr || edge2 == nullptr) {
+                    return scene_error(path, value, "area light needs edge1 and edge2");
+                }
+                if (!read_vec3(path, *edge1, light.edge1) || !read_vec3(path, *edge2, light.edge2)) {
+                    return false;
+                }
+            }
+            scene.lights.push_back(light);
+        }
+    }
+    return true;
+}
+
+/* CacheWriter
+ * ------------------------
+ * Appends plain values and length prefixed arrays to the cache file
+ */
+typedef struct CacheWriter {
+    FILE *file;
+    bool ok {true};
+
+    void bytes(const void *data, size_t size) {
+        if (size > 0) {
+            ok &= fwrite(data, 1, size, file) == size;
+        }
+    }
+    template <typename T> void value(const T &data) {
+        bytes(&data, sizeof(T));
+    }
+    template <typename T, typename Allocator> void array(const std::vector<T, Allocator> &data) {
+        value(static_cast<uint64_t>(data.size()));
+        bytes(data.data(), data.size() * sizeof(T));
+    }
+    void string(const std::string &data) {
+        value(static_cast<uint64_t>(data.size()));
+        bytes(data.data(), data.size());
+    }
+} CacheWriter;
+
+/* CacheReader
+ * ------------------------
+ * Bounds checked cursor over the memory mapped cache file
+ */
+typedef struct CacheReader {
+    const char *p;
+    const char *end;
+    bool ok {true};
+
+    void bytes(void *data, size_t size) {
+        if (!ok || static_cast<size_t>(end - p) < size) {
+            ok = false;
+            return;
+        }
+        memcpy(data, p, size);
+        p += size;
+    }
+    template <typename T> T value() {
+        T data {};
+        bytes(&data, sizeof(T));
+        return data;
+    }
+    template <typename T, typename Allocator> void array(std::vector<T, Allocator> &data) {
+        uint64_t count = value<uint64_t>();
+        if (!ok || count > static_cast<uint64_t>(end - p) / sizeof(T)) {
+            ok = false;
+            return;
+        }
+        data.resize(count);
+        bytes(data.data(), count * sizeof(T));
+    }
+    std::string string() {
+        std::vector<char> data;
+        array(data);
+        return std::string(data.begin(), data.end());
+    }
+} CacheReader;
+
+/* file_stamp()
+ * ----------------------------------------
+ * Size and modification time of a file, used to tell whether a cache is
+ * older than the files it was built from
+ */
+static bool file_stamp(const std::string &path, int64_t &size, int64_t &modified) {
+    struct stat info {};
+    if (stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+    size = static_cast<int64_t>(info.st_size);
+    modified = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+/* write_scene_cache()
+ * ----------------------------------------
+ * Store a prepared scene, including its BVHs and packed triangles, in the
+ * versioned binary cache format. The size and modification time of every
+ * dependency is recorded so a stale cache is rejected on load
+ *
+ * @param string path
+ * @param Scene scene
+ * @param vector<string> dependencies
+ * @return bool success
+ */
+bool write_scene_cache(const std::string &path, const Scene &scene, const std::vector<std::string> &dependencies) {
+    // write to a temporary name and rename, so a reader never maps a half written cache
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    CacheWriter writer {file};
+    writer.bytes(SCENE_CACHE_MAGIC, 4);
+    writer.value(static_cast<uint32_t>(SCENE_CACHE_VERSION));
+    writer.value(static_cast<uint32_t>(sizeof(Sphere)));
+    writer.value(static_cast<uint32_t>(sizeof(MeshTriangle)));
+    writer.value(static_cast<uint32_t>(sizeof(BvhNode)));
+    writer.value(static_cast<uint32_t>(sizeof(Light)));
+    writer.value(static_cast<uint32_t>(sizeof(Shape)));
+
+    writer.value(static_cast<uint64_t>(dependencies.size()));
+    for (const std::string &dependency : dependencies) {
+        int64_t size = 0, modified = 0;
+        writer.ok &= file_stamp(dependency, size, modified);
+        writer.string(dependency);
+        writer.value(size);
+        writer.value(modified);
+    }
+
+    writer.value(scene.camera);
+    writer.array(scene.objects);
+    writer.array(scene.lights);
+    writer.array(scene.shapes);
+    writer.value(static_cast<uint64_t>(scene.meshes.size()));
+    for (const Mesh &mesh : scene.meshes) {
+        writer.value(mesh.color);
+        writer.value(mesh.specular);
+        writer.array(mesh.vertices);
+        writer.array(mesh.indices);
+    }
+    writer.array(scene.sphereBvh.nodes);
+    writer.array(scene.sphereBvh.indices);
+    writer.array(scene.triangleBvh.nodes);
+    writer.array(scene.triangleBvh.indices);
+    writer.array(scene.triangles);
+    writer.array(scene.shapeBvh.nodes);
+    writer.array(scene.shapeBvh.indices);
+
+    bool ok = writer.ok && fclose(file) == 0;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+/* read_scene_cache()
+ * ----------------------------------------
+ * Load a scene written by write_scene_cache(). The file is memory mapped
+ * and its arrays copied straight into the scene, so no parsing or BVH
+ * building happens. Fails without touching the scene if the cache is
+ * missing, from another version or older than any of its dependencies
+ *
+ * @param string path
+ * @param[out] Scene scene
+ * @return bool success
+ */
+bool read_scene_cache(const std::string &path, Scene &scene) {
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat info {};
+    if (fstat(descriptor, &info) != 0 || info.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    CacheReader reader {static_cast<const char *>(mapping), static_cast<const char *>(mapping) + size};
+    char magic[4];
+    reader.bytes(magic, 4);
+    reader.ok &= !memcmp(magic, SCENE_CACHE_MAGIC, 4);
+    reader.ok &= reader.value<uint32_t>() == SCENE_CACHE_VERSION;
+    reader.ok &= reader.value<uint32_t>() == sizeof(Sphere);
+    reader.ok &= reader.value<uint32_t>() == sizeof(MeshTriangle);
+    reader.ok &= reader.value<uint32_t>() == sizeof(BvhNode);
+    reader.ok &= reader.value<uint32_t>() == sizeof(Light);
+    reader.ok &= reader.value<uint32_t>() == sizeof(Shape);
+
+    uint64_t dependencies = reader.value<uint64_t>();
+    for (uint64_t i = 0; i < dependencies && reader.ok; i++) {
+        std::string dependency = reader.string();
+        int64_t size = reader.value<int64_t>();
+        int64_t modified = reader.value<int64_t>();
+        int64_t currentSize = 0, currentModified = 0;
+        reader.ok &= file_stamp(dependency, currentSize, currentModified) && currentSize == size && currentModified == modified;
+    }
+
+    Scene loaded;
+    loaded.camera = reader.value<Vec3>();
+    reader.array(loaded.objects);
+    reader.array(loaded.lights);
+    reader.array(loaded.shapes);
+    uint64_t meshes = reader.value<uint64_t>();
+    for (uint64_t i = 0; i < meshes && reader.ok; i++) {
+        Mesh mesh;
+        mesh.color = reader.value<Vec3i>();
+        mesh.specular = reader.value<int>();
+        reader.array(mesh.vertices);
+        reader.array(mesh.indices);
+        loaded.meshes.push_back(std::move(mesh));
+    }
+    reader.array(loaded.sphereBvh.nodes);
+    reader.array(loaded.sphereBvh.indices);
+    reader.array(loaded.triangleBvh.nodes);
+    reader.array(loaded.triangleBvh.indices);
+    reader.array(loaded.triangles);
+    reader.array(loaded.shapeBvh.nodes);
+    reader.array(loaded.shapeBvh.indices);
+    reader.ok &= reader.p == reader.end;
+    reader.ok &= loaded.sphereBvh.indices.size() == loaded.objects.size();
+    reader.ok &= loaded.triangleBvh.indices.size() == loaded.triangles.size();
+    munmap(mapping, size);
+    reader.ok = reader.ok && pack_shapes(loaded);
+
+    if (!reader.ok) {
+        return false;
+    }
+    // the SoA copies are linear repacks of the spheres in BVH order and of the lights, the cached triangles already name their materials
+    build_sphere_soa(loaded.sphereSoA, loaded.objects.data(), loaded.sphereBvh.indices);
+    build_light_soa(loaded.lightSoA, loaded.lights);
+    std::vector<int> meshMaterials;
+    build_materials(loaded, meshMaterials);
+    scene = std::move(loaded);
+    return true;
+}
+
+/* load_scene()
+ * ----------------------------------------
+ * Load a scene file ready for rendering. With useCache the binary cache
+ * next to it (path + ".cache") is used when it is up to date, otherwise the
+ * file is parsed, prepared and the cache rewritten
+ *
+ * @param string path
+ * @param[out] Scene scene
+ * @param bool useCache
+ * @return bool success
+ */
+bool load_scene(const std::string &path, Scene &scene, bool useCache) {
+    std::string cachePath = path + ".cache";
+    if (useCache && read_scene_cache(cachePath, scene)) {
+        return true;
+    }
+
+    std::vector<std::string> dependencies;
+    if (!parse_scene_file(path, scene, dependencies)) {
+        return false;
+    }
+    prepare_scene(scene);
+    if (useCache && !write_scene_cache(cachePath, scene, dependencies)) {
+        fprintf(stderr, "Could not write scene cache %s\n", cachePath.c_str());
+    }
+    return true;
+}
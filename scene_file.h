@@ -0,0 +1,20 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_SCENE_FILE_H
+#define RAYTRACINGFROMSCRATCH_SCENE_FILE_H
+
+#include <string>
+#include <vector>
+#include "scene.h"
+
+// bump whenever the layout of the cache or of anything stored in it changes
+#define SCENE_CACHE_VERSION 4
+
+bool load_scene(const std::string &path, Scene &scene, bool useCache = true);
+bool parse_scene_file(const std::string &path, Scene &scene, std::vector<std::string> &dependencies);
+bool write_scene_cache(const std::string &path, const Scene &scene, const std::vector<std::string> &dependencies);
+bool read_scene_cache(const std::string &path, Scene &scene);
+
+#endif //RAYTRACINGFROMSCRATCH_SCENE_FILE_H
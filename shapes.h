@@ -0,0 +1,153 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_SHAPES_H
+#define RAYTRACINGFROMSCRATCH_SHAPES_H
+
+#include <algorithm>
+#include <cmath>
+#include "renderer_math.h"
+#include "bvh.h"
+
+enum ShapeType {
+    SHAPE_PLANE,
+    SHAPE_DISK,
+    SHAPE_BOX,
+};
+
+/* Shape
+ * ------------------------
+ * Analytic primitive with its own closed form intersector. A plane is the
+ * infinite plane through position facing normal, a disk the part of such a
+ * plane within radius of position, and a box spans position to corner with
+ * its faces along the axes. Planes have no bounds, so they are kept out of
+ * the BVH and every ray tests them on its own. Looks are given like a
+ * sphere's
+ */
+typedef struct Shape {
+    ShapeType type {SHAPE_PLANE};
+    Vec3 position {0, 0, 0};
+    Vec3 normal {0, 1, 0};
+    float radius {0};
+    Vec3 corner {0, 0, 0};
+    Vec3i color {255, 255, 255};
+    int specular {-1};
+    float emission {0};
+} Shape;
+
+/* shape_bounds()
+ * ----------------------------------------
+ * Bounding box of a disk or box. A disk reaches radius * sin of the angle
+ * between its normal and each axis either side of its centre
+ *
+ * @param[in] Shape shape
+ * @param[out] Aabb bounds
+ * @return bool false for planes, which have no bounds
+ */
+inline bool shape_bounds(const Shape &shape, Aabb &bounds) {
+    switch (shape.type) {
+        case SHAPE_DISK: {
+            Vec3 n = shape.normal;
+            Vec3 reach = Vec3 {std::sqrt(std::max(1.0f - n.x * n.x, 0.0f)), std::sqrt(std::max(1.0f - n.y * n.y, 0.0f)),
+                               std::sqrt(std::max(1.0f - n.z * n.z, 0.0f))} * shape.radius;
+            bounds.grow(shape.position - reach);
+            bounds.grow(shape.position + reach);
+            return true;
+        }
+        case SHAPE_BOX:
+            bounds.grow(shape.position);
+            bounds.grow(shape.corner);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* intersect_box_slabs()
+ * ----------------------------------------
+ * Slab test of a ray against an axis aligned box: the distances at which
+ * it enters and leaves, the box is missed when enter > leave
+ */
+inline void intersect_box_slabs(Vec3 low, Vec3 high, Vec3 origin, Vec3 direction, float &enter, float &leave) {
+    Vec3 inverse = {1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z};
+    float x1 = (low.x - origin.x) * inverse.x, x2 = (high.x - origin.x) * inverse.x;
+    float y1 = (low.y - origin.y) * inverse.y, y2 = (high.y - origin.y) * inverse.y;
+    float z1 = (low.z - origin.z) * inverse.z, z2 = (high.z - origin.z) * inverse.z;
+    enter = std::max(std::max(std::min(x1, x2), std::min(y1, y2)), std::min(z1, z2));
+    leave = std::min(std::min(std::max(x1, x2), std::max(y1, y2)), std::max(z1, z2));
+}
+
+/* intersect_shape()
+ * ----------------------------------------
+ * Closed form test of a ray against a shape, accepting hits with
+ * tMin < t < tMax. Planes and disks need one division, boxes a slab test;
+ * a ray starting inside a box hits it where it leaves
+ *
+ * @param[in] Shape shape
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMin
+ * @param[in] float tMax
+ * @param[out] float t
+ * @return bool
+ */
+inline bool intersect_shape(const Shape &shape, Vec3 origin, Vec3 direction, float tMin, float tMax, float &t) {
+    float distance;
+    if (shape.type == SHAPE_BOX) {
+        float enter, leave;
+        intersect_box_slabs(shape.position, shape.corner, origin, direction, enter, leave);
+        if (enter > leave) {
+            return false;
+        }
+        distance = enter > tMin ? enter : leave;
+    } else {
+        float facing = direction.dot(shape.normal);
+        if (facing == 0.0f) {
+            return false;
+        }
+        distance = (shape.position - origin).dot(shape.normal) / facing;
+        if (shape.type == SHAPE_DISK) {
+            Vec3 offset = origin + direction * distance - shape.position;
+            if (offset.dot(offset) > shape.radius * shape.radius) {
+                return false;
+            }
+        }
+    }
+    if (distance <= tMin || distance >= tMax) {
+        return false;
+    }
+    t = distance;
+    return true;
+}
+
+/* shape_normal()
+ * ----------------------------------------
+ * Unit normal of a shape at a point on it. Planes and disks are shaded the
+ * same from either side like mesh triangles, so their normal faces back
+ * along the ray. A box's normal points out of the face the point is on,
+ * the axis along which the point is furthest from the centre relative to
+ * the box's size
+ *
+ * @param Shape shape
+ * @param Vec3 point
+ * @param Vec3 direction of the ray that hit the point
+ * @return Vec3 normal
+ */
+inline Vec3 shape_normal(const Shape &shape, Vec3 point, Vec3 direction) {
+    if (shape.type != SHAPE_BOX) {
+        return shape.normal.dot(direction) > 0 ? -shape.normal : shape.normal;
+    }
+    Vec3 half = (shape.corner - shape.position) * 0.5f;
+    Vec3 local = point - (shape.position + half);
+    float x = std::fabs(local.x / half.x), y = std::fabs(local.y / half.y), z = std::fabs(local.z / half.z);
+    if (x >= y && x >= z) {
+        return Vec3 {local.x > 0 ? 1.0f : -1.0f, 0, 0};
+    }
+    if (y >= z) {
+        return Vec3 {0, local.y > 0 ? 1.0f : -1.0f, 0};
+    }
+    return Vec3 {0, 0, local.z > 0 ? 1.0f : -1.0f};
+}
+
+#endif //RAYTRACINGFROMSCRATCH_SHAPES_H
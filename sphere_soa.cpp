@@ -0,0 +1,341 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "sphere_soa.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SPHERE_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+typedef bool (*SphereKernelFunction)(const SphereSoA &, int, int, Vec3, Vec3, float, float, float &, int &);
+
+/* build_sphere_soa()
+ * ----------------------------------------
+ * Pack spheres into the structure of arrays layout, entry i holding sphere
+ * order[i]. Padding entries have a radius squared of -infinity so their
+ * discriminant is always negative
+ *
+ * @param[out] SphereSoA spheres
+ * @param[in] Sphere objects[]
+ * @param[in] vector<int> order
+ */
+void build_sphere_soa(SphereSoA &spheres, const Sphere objects[], const std::vector<int> &order) {
+    int count = static_cast<int>(order.size());
+    int padded = (count + SPHERE_LANES - 1) / SPHERE_LANES * SPHERE_LANES + SPHERE_LANES;
+    spheres.count = count;
+    spheres.centreX.assign(padded, 0.0f);
+    spheres.centreY.assign(padded, 0.0f);
+    spheres.centreZ.assign(padded, 0.0f);
+    spheres.radius2.assign(padded, -std::numeric_limits<float>::infinity());
+    spheres.object.assign(padded, -1);
+
+    for (int i = 0; i < count; i++) {
+        const Sphere &sphere = objects[order[i]];
+        spheres.centreX[i] = sphere.centre.x;
+        spheres.centreY[i] = sphere.centre.y;
+        spheres.centreZ[i] = sphere.centre.z;
+        spheres.radius2[i] = sphere.radius * sphere.radius;
+        spheres.object[i] = order[i];
+    }
+}
+
+/* intersect_spheres_scalar()
+ * ----------------------------------------
+ * Reference kernel, one sphere at a time. Uses the half b form of the
+ * quadratic so the square root is only taken once per sphere
+ */
+static bool intersect_spheres_scalar(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction,
+                                     float tMin, float tMax, float &closestT, int &closestIndex) {
+    float a = direction.dot(direction);
+    float invA = 1.0f / a;
+    float best = std::min(tMax, closestT);
+    int bestIndex = -1;
+
+    for (int i = first; i < first + count; i++) {
+        float COx = origin.x - spheres.centreX[i];
+        float COy = origin.y - spheres.centreY[i];
+        float COz = origin.z - spheres.centreZ[i];
+        float b = COx * direction.x + COy * direction.y + COz * direction.z;
+        float c = COx * COx + COy * COy + COz * COz - spheres.radius2[i];
+
+        float discriminant = b * b - a * c;
+        if (discriminant < 0) {
+            continue;
+        }
+        float root = std::sqrt(discriminant);
+        float tNear = (-b - root) * invA;
+        float tFar = (-b + root) * invA;
+
+        if (tMin < tNear && tNear < best) {
+            best = tNear;
+            bestIndex = i;
+        } else if (tMin < tFar && tFar < best) {
+            best = tFar;
+            bestIndex = i;
+        }
+    }
+
+    if (bestIndex < 0) {
+        return false;
+    }
+    closestT = best;
+    closestIndex = spheres.object[bestIndex];
+    return true;
+}
+
+#ifdef SPHERE_KERNEL_X86
+
+/* intersect_spheres_sse()
+ * ----------------------------------------
+ * Test the ray against 4 spheres per iteration with SSE2, keeping the best
+ * hit per lane and reducing across lanes at the end
+ */
+static bool intersect_spheres_sse(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction,
+                                  float tMin, float tMax, float &closestT, int &closestIndex) {
+    float a = direction.dot(direction);
+    const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+    const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+    const __m128 va = _mm_set1_ps(a), invA = _mm_set1_ps(1.0f / a);
+    const __m128 minT = _mm_set1_ps(tMin), zero = _mm_setzero_ps();
+
+    __m128 best = _mm_set1_ps(std::min(tMax, closestT));
+    __m128i bestIndex = _mm_set1_epi32(-1);
+    __m128i index = _mm_setr_epi32(first, first + 1, first + 2, first + 3);
+    const __m128i step = _mm_set1_epi32(4);
+    const __m128i end = _mm_set1_epi32(first + count);
+
+    for (int i = first; i < first + count; i += 4) {
+        __m128 COx = _mm_sub_ps(ox, _mm_loadu_ps(&spheres.centreX[i]));
+        __m128 COy = _mm_sub_ps(oy, _mm_loadu_ps(&spheres.centreY[i]));
+        __m128 COz = _mm_sub_ps(oz, _mm_loadu_ps(&spheres.centreZ[i]));
+        __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(COx, dx), _mm_mul_ps(COy, dy)), _mm_mul_ps(COz, dz));
+        __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(COx, COx), _mm_mul_ps(COy, COy)), _mm_mul_ps(COz, COz)),
+                              _mm_loadu_ps(&spheres.radius2[i]));
+
+        __m128 discriminant = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(va, c));
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(discriminant, zero), _mm_castsi128_ps(_mm_cmplt_epi32(index, end)));
+        __m128 root = _mm_sqrt_ps(_mm_max_ps(discriminant, zero));
+        __m128 tNear = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, b), root), invA);
+        __m128 tFar = _mm_mul_ps(_mm_add_ps(_mm_sub_ps(zero, b), root), invA);
+
+        __m128 nearValid = _mm_and_ps(_mm_cmpgt_ps(tNear, minT), _mm_cmplt_ps(tNear, best));
+        __m128 farValid = _mm_and_ps(_mm_cmpgt_ps(tFar, minT), _mm_cmplt_ps(tFar, best));
+        __m128 t = _mm_or_ps(_mm_and_ps(nearValid, tNear), _mm_andnot_ps(nearValid, tFar));
+        __m128 take = _mm_and_ps(hit, _mm_or_ps(nearValid, farValid));
+
+        best = _mm_or_ps(_mm_and_ps(take, t), _mm_andnot_ps(take, best));
+        __m128i takeIndex = _mm_castps_si128(take);
+        bestIndex = _mm_or_si128(_mm_and_si128(takeIndex, index), _mm_andnot_si128(takeIndex, bestIndex));
+        index = _mm_add_epi32(index, step);
+    }
+
+    alignas(16) float lanesT[4];
+    alignas(16) int lanesIndex[4];
+    _mm_store_ps(lanesT, best);
+    _mm_store_si128(reinterpret_cast<__m128i *>(lanesIndex), bestIndex);
+
+    int found = -1;
+    for (int lane = 0; lane < 4; lane++) {
+        if (lanesIndex[lane] >= 0 && (found < 0 || lanesT[lane] < lanesT[found])) {
+            found = lane;
+        }
+    }
+    if (found < 0) {
+        return false;
+    }
+    closestT = lanesT[found];
+    closestIndex = spheres.object[lanesIndex[found]];
+    return true;
+}
+
+/* intersect_spheres_avx2()
+ * ----------------------------------------
+ * Same as the SSE kernel, 8 spheres per iteration with AVX2 and FMA. Compiled
+ * for those instructions only, and only called when the CPU reports them
+ */
+__attribute__((target("avx2,fma")))
+static bool intersect_spheres_avx2(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction,
+                                   float tMin, float tMax, float &closestT, int &closestIndex) {
+    float a = direction.dot(direction);
+    const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+    const __m256 dx = _mm256_set1_ps(direction.x), dy = _mm256_set1_ps(direction.y), dz = _mm256_set1_ps(direction.z);
+    const __m256 va = _mm256_set1_ps(a), invA = _mm256_set1_ps(1.0f / a);
+    const __m256 minT = _mm256_set1_ps(tMin), zero = _mm256_setzero_ps();
+
+    __m256 best = _mm256_set1_ps(std::min(tMax, closestT));
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32(first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m256i step = _mm256_set1_epi32(8);
+    const __m256i end = _mm256_set1_epi32(first + count);
+
+    for (int i = first; i < first + count; i += 8) {
+        __m256 COx = _mm256_sub_ps(ox, _mm256_loadu_ps(&spheres.centreX[i]));
+        __m256 COy = _mm256_sub_ps(oy, _mm256_loadu_ps(&spheres.centreY[i]));
+        __m256 COz = _mm256_sub_ps(oz, _mm256_loadu_ps(&spheres.centreZ[i]));
+        __m256 b = _mm256_fmadd_ps(COz, dz, _mm256_fmadd_ps(COy, dy, _mm256_mul_ps(COx, dx)));
+        __m256 c = _mm256_fmadd_ps(COz, COz, _mm256_fmadd_ps(COy, COy, _mm256_mul_ps(COx, COx)));
+        c = _mm256_sub_ps(c, _mm256_loadu_ps(&spheres.radius2[i]));
+
+        __m256 discriminant = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, c));
+        __m256 inRange = _mm256_castsi256_ps(_mm256_cmpgt_epi32(end, index));
+        __m256 hit = _mm256_and_ps(_mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ), inRange);
+        __m256 root = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+        __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), root), invA);
+        __m256 tFar = _mm256_mul_ps(_mm256_add_ps(_mm256_sub_ps(zero, b), root), invA);
+
+        __m256 nearValid = _mm256_and_ps(_mm256_cmp_ps(tNear, minT, _CMP_GT_OQ), _mm256_cmp_ps(tNear, best, _CMP_LT_OQ));
+        __m256 farValid = _mm256_and_ps(_mm256_cmp_ps(tFar, minT, _CMP_GT_OQ), _mm256_cmp_ps(tFar, best, _CMP_LT_OQ));
+        __m256 t = _mm256_blendv_ps(tFar, tNear, nearValid);
+        __m256 take = _mm256_and_ps(hit, _mm256_or_ps(nearValid, farValid));
+
+        best = _mm256_blendv_ps(best, t, take);
+        bestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(index), take));
+        index = _mm256_add_epi32(index, step);
+    }
+
+    alignas(32) float lanesT[8];
+    alignas(32) int lanesIndex[8];
+    _mm256_store_ps(lanesT, best);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lanesIndex), bestIndex);
+
+    int found = -1;
+    for (int lane = 0; lane < 8; lane++) {
+        if (lanesIndex[lane] >= 0 && (found < 0 || lanesT[lane] < lanesT[found])) {
+            found = lane;
+        }
+    }
+    if (found < 0) {
+        return false;
+    }
+    closestT = lanesT[found];
+    closestIndex = spheres.object[lanesIndex[found]];
+    return true;
+}
+
+#endif
+
+/* detect_sphere_kernel()
+ * ----------------------------------------
+ * Widest kernel the running CPU supports
+ */
+static SphereKernel detect_sphere_kernel() {
+#ifdef SPHERE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SPHERE_KERNEL_AVX2;
+    }
+    return SPHERE_KERNEL_SSE;
+#else
+    return SPHERE_KERNEL_SCALAR;
+#endif
+}
+
+/* kernel_function()
+ * ----------------------------------------
+ * Implementation of a kernel, scalar for anything not built in
+ */
+static SphereKernelFunction kernel_function(SphereKernel kernel) {
+    switch (kernel) {
+#ifdef SPHERE_KERNEL_X86
+        case SPHERE_KERNEL_AVX2: return intersect_spheres_avx2;
+        case SPHERE_KERNEL_SSE: return intersect_spheres_sse;
+#endif
+        default: return intersect_spheres_scalar;
+    }
+}
+
+static SphereKernel activeKernel = detect_sphere_kernel();
+static SphereKernelFunction activeFunction = kernel_function(activeKernel);
+
+/* select_sphere_kernel()
+ * ----------------------------------------
+ * Choose the kernel used by intersect_spheres(). SPHERE_KERNEL_AUTO picks
+ * the widest one the CPU supports, which is also the default. Returns false
+ * and leaves the current kernel in place if the CPU cannot run the request
+ *
+ * @param SphereKernel kernel
+ * @return bool
+ */
+bool select_sphere_kernel(SphereKernel kernel) {
+    SphereKernel supported = detect_sphere_kernel();
+    if (kernel == SPHERE_KERNEL_AUTO) {
+        kernel = supported;
+    }
+    if (kernel > supported) {
+        return false;
+    }
+    activeKernel = kernel;
+    activeFunction = kernel_function(kernel);
+    return true;
+}
+
+/* active_sphere_kernel()
+ * ----------------------------------------
+ * The kernel in use, for code that picks its own implementation to match
+ */
+SphereKernel active_sphere_kernel() {
+    return activeKernel;
+}
+
+const char *sphere_kernel_name() {
+    switch (activeKernel) {
+        case SPHERE_KERNEL_AVX2: return "avx2";
+        case SPHERE_KERNEL_SSE: return "sse";
+        default: return "scalar";
+    }
+}
+
+/* intersect_spheres()
+ * ----------------------------------------
+ * Find the closest of spheres [first, first + count) hit by the ray with
+ * tMin < t < min(tMax, closestT) using the selected kernel. On a hit
+ * closestT and closestIndex (index into the original sphere array) are
+ * updated
+ *
+ * @param[in] SphereSoA spheres
+ * @param[in] int first
+ * @param[in] int count
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMin
+ * @param[in] float tMax
+ * @param[in,out] float closestT
+ * @param[out] int closestIndex
+ * @return bool
+ */
+bool intersect_spheres(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction, float tMin, float tMax,
+                       float &closestT, int &closestIndex) {
+    return activeFunction(spheres, first, count, origin, direction, tMin, tMax, closestT, closestIndex);
+}
+
+/* occluded_spheres()
+ * ----------------------------------------
+ * Any hit test of spheres [first, first + count) with tMin < t < tMax.
+ * The range is handed to the kernel one vector width at a time so a long
+ * linear scan stops at the first block that blocks the ray
+ *
+ * @param[in] SphereSoA spheres
+ * @param[in] int first
+ * @param[in] int count
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMin
+ * @param[in] float tMax
+ * @return bool
+ */
+bool occluded_spheres(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction, float tMin, float tMax) {
+    for (int block = first; block < first + count; block += SPHERE_LANES) {
+        float closestT = tMax;
+        int closestIndex;
+        if (activeFunction(spheres, block, std::min(SPHERE_LANES, first + count - block), origin, direction, tMin, tMax,
+                           closestT, closestIndex)) {
+            return true;
+        }
+    }
+    return false;
+}
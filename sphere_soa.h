@@ -0,0 +1,81 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_SPHERE_SOA_H
+#define RAYTRACINGFROMSCRATCH_SPHERE_SOA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "renderer_math.h"
+#include "objects.h"
+
+// widest kernel, sphere arrays are padded to a multiple of this
+#define SPHERE_LANES 8
+#define SPHERE_ALIGNMENT 32
+
+/* AlignedAllocator
+ * ------------------------
+ * Allocator for std::vector storage that SIMD kernels load with aligned loads
+ */
+template <typename T, size_t Alignment>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(size_t n) {
+        size_t bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void *memory = std::aligned_alloc(Alignment, bytes);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(memory);
+    }
+    void deallocate(T *memory, size_t) { std::free(memory); }
+
+    bool operator==(const AlignedAllocator &) const { return true; }
+    bool operator!=(const AlignedAllocator &) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T, SPHERE_ALIGNMENT>>;
+
+/* SphereSoA
+ * ------------------------
+ * Spheres split into one aligned array per field so a kernel can test one
+ * ray against several spheres per instruction. Spheres are stored in the
+ * order given at build time (the BVH leaf order) so a leaf is a contiguous
+ * range, and the arrays are padded with at least SPHERE_LANES spheres that
+ * can never be hit so kernels may load whole vectors past the end of a
+ * range. object is the index of the sphere the entry was built from
+ */
+typedef struct SphereSoA {
+    int count {0};
+    AlignedVector<float> centreX {};
+    AlignedVector<float> centreY {};
+    AlignedVector<float> centreZ {};
+    AlignedVector<float> radius2 {};
+    AlignedVector<int> object {};
+} SphereSoA;
+
+enum SphereKernel {
+    SPHERE_KERNEL_AUTO,
+    SPHERE_KERNEL_SCALAR,
+    SPHERE_KERNEL_SSE,
+    SPHERE_KERNEL_AVX2,
+};
+
+void build_sphere_soa(SphereSoA &spheres, const Sphere objects[], const std::vector<int> &order);
+bool intersect_spheres(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction, float tMin, float tMax,
+                       float &closestT, int &closestIndex);
+bool occluded_spheres(const SphereSoA &spheres, int first, int count, Vec3 origin, Vec3 direction, float tMin, float tMax);
+bool select_sphere_kernel(SphereKernel kernel);
+SphereKernel active_sphere_kernel();
+const char *sphere_kernel_name();
+
+#endif //RAYTRACINGFROMSCRATCH_SPHERE_SOA_H
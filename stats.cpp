@@ -0,0 +1,158 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include "stats.h"
+
+#ifdef RAYTRACER_STATS
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "arena.h"
+#include "image_io.h"
+#include "renderer.h"
+
+#define STAT_CALIBRATION_MS 20
+
+thread_local RenderStats *threadStats = nullptr;
+
+// blocks outlive their threads so counts from finished workers are still merged
+static std::mutex registryLock;
+static std::vector<std::unique_ptr<RenderStats>> registry;
+
+/* register_thread_stats()
+ * ----------------------------------------
+ * Give the calling thread its own counters on first use
+ *
+ * @return RenderStats
+ */
+RenderStats *register_thread_stats() {
+    AllocationAuditPause pause;
+    std::lock_guard<std::mutex> guard(registryLock);
+    registry.push_back(std::unique_ptr<RenderStats>(new RenderStats()));
+    threadStats = registry.back().get();
+    return threadStats;
+}
+
+/* collect_render_stats()
+ * ----------------------------------------
+ * Sum the counters of every thread and start them again from zero. Call it
+ * between frames, while no pool batch is running
+ *
+ * @return RenderStats
+ */
+RenderStats collect_render_stats() {
+    RenderStats total;
+    std::lock_guard<std::mutex> guard(registryLock);
+    for (const std::unique_ptr<RenderStats> &stats : registry) {
+        for (int i = 0; i < STAT_COUNTER_COUNT; i++) {
+            total.counters[i] += stats->counters[i];
+        }
+        for (int i = 0; i < STAGE_COUNT; i++) {
+            total.stageTicks[i] += stats->stageTicks[i];
+        }
+        *stats = RenderStats();
+    }
+    return total;
+}
+
+/* stat_tick_seconds()
+ * ----------------------------------------
+ * Length of one stat_ticks() tick, measured once against the steady clock
+ *
+ * @return double seconds
+ */
+double stat_tick_seconds() {
+    static const double seconds = [] {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startTicks = stat_ticks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(STAT_CALIBRATION_MS));
+        uint64_t ticks = stat_ticks() - startTicks;
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return ticks > 0 ? elapsed / ticks : 0.0;
+    }();
+    return seconds;
+}
+
+/* print_render_stats()
+ * ----------------------------------------
+ * Print the merged counters, the averages per ray and the time spent in
+ * each stage summed over all threads
+ *
+ * @param RenderStats stats
+ */
+void print_render_stats(const RenderStats &stats) {
+    static const char *stageNames[STAGE_COUNT] = {"generate", "sort", "intersect", "shade", "shadow", "accumulate",
+                                                   "present"};
+    const uint64_t *counters = stats.counters;
+    uint64_t closestRays = counters[STAT_CAMERA_RAYS] + counters[STAT_INDIRECT_RAYS];
+    uint64_t rays = closestRays + counters[STAT_SHADOW_RAYS];
+    double perRay = rays > 0 ? 1.0 / rays : 0.0;
+
+    printf("Rays: %llu camera, %llu indirect, %llu shadow\n", (unsigned long long) counters[STAT_CAMERA_RAYS],
+           (unsigned long long) counters[STAT_INDIRECT_RAYS], (unsigned long long) counters[STAT_SHADOW_RAYS]);
+    printf("Per ray: %.2f sphere tests, %.2f triangle tests, %.2f shape tests, %.2f BVH nodes\n", counters[STAT_SPHERE_TESTS] * perRay,
+           counters[STAT_TRIANGLE_TESTS] * perRay, counters[STAT_SHAPE_TESTS] * perRay, counters[STAT_BVH_NODES] * perRay);
+
+    double tick = stat_tick_seconds();
+    uint64_t ticks[STAGE_COUNT];
+    std::copy(stats.stageTicks, stats.stageTicks + STAGE_COUNT, ticks);
+    ticks[STAGE_SHADE] -= std::min(ticks[STAGE_SHADE], ticks[STAGE_SHADOW]);
+    printf("Stages:");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        printf(" %s %.3f s%s", stageNames[i], ticks[i] * tick, i + 1 < STAGE_COUNT ? "," : "\n");
+    }
+    fflush(stdout);
+}
+
+/* heat_color()
+ * ----------------------------------------
+ * Black through red and yellow to white for a cost in [0, 1]
+ */
+static void heat_color(float cost, uint8_t rgba[4]) {
+    float r = std::min(std::max(cost * 3.0f, 0.0f), 1.0f);
+    float g = std::min(std::max(cost * 3.0f - 1.0f, 0.0f), 1.0f);
+    float b = std::min(std::max(cost * 3.0f - 2.0f, 0.0f), 1.0f);
+    rgba[0] = static_cast<uint8_t>(r * 255.0f + 0.5f);
+    rgba[1] = static_cast<uint8_t>(g * 255.0f + 0.5f);
+    rgba[2] = static_cast<uint8_t>(b * 255.0f + 0.5f);
+    rgba[3] = 255;
+}
+
+/* write_tile_heatmap()
+ * ----------------------------------------
+ * Write the time every tile took since the last reset as an image the size
+ * of the framebuffer, scaled so the most expensive tile is white. A pfm
+ * output holds the raw seconds per tile instead
+ *
+ * @param Framebuffer framebuffer
+ * @param string path
+ * @return bool success
+ */
+bool write_tile_heatmap(const Framebuffer &framebuffer, const std::string &path) {
+    int tilesX = (framebuffer.width + TILE_SIZE - 1) / TILE_SIZE;
+    if (framebuffer.tileTicks.empty()) {
+        return false;
+    }
+    uint64_t maxTicks = *std::max_element(framebuffer.tileTicks.begin(), framebuffer.tileTicks.end());
+    double tick = stat_tick_seconds();
+
+    Framebuffer heatmap(framebuffer.width, framebuffer.height);
+    heatmap.passes = 1;
+    for (int py = 0; py < framebuffer.height; py++) {
+        for (int px = 0; px < framebuffer.width; px++) {
+            uint64_t ticks = framebuffer.tileTicks[(py / TILE_SIZE) * tilesX + px / TILE_SIZE];
+            size_t pixel = static_cast<size_t>(py) * framebuffer.width + px;
+            heat_color(maxTicks > 0 ? static_cast<float>(ticks) / maxTicks : 0.0f, &heatmap.rgba[4 * pixel]);
+            float seconds = static_cast<float>(ticks * tick);
+            std::fill(&heatmap.accumulation[3 * pixel], &heatmap.accumulation[3 * pixel] + 3, seconds);
+        }
+    }
+    return write_image(heatmap, path);
+}
+
+#endif //RAYTRACER_STATS
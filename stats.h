@@ -0,0 +1,116 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_STATS_H
+#define RAYTRACINGFROMSCRATCH_STATS_H
+
+/* Render statistics
+ * ------------------------
+ * Ray, intersection and BVH counters plus per stage timers, built only when
+ * RAYTRACER_STATS is defined (cmake -DRAYTRACER_STATS=ON). Every thread
+ * counts into its own RenderStats, so the hot paths never share a cache
+ * line, and collect_render_stats() merges them at the end of a frame.
+ * Without the flag STAT_ADD and STAT_TIMER expand to nothing
+ */
+#ifdef RAYTRACER_STATS
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+enum StatCounter {
+    STAT_CAMERA_RAYS,
+    STAT_INDIRECT_RAYS,
+    STAT_SHADOW_RAYS,
+    STAT_SPHERE_TESTS,
+    STAT_TRIANGLE_TESTS,
+    STAT_SHAPE_TESTS,
+    STAT_BVH_NODES,
+    STAT_COUNTER_COUNT
+};
+
+// shade includes the shadow rays it traces, print_render_stats() reports it without them.
+// sort only runs in the wavefront renderer
+enum StatStage {
+    STAGE_GENERATE,
+    STAGE_SORT,
+    STAGE_INTERSECT,
+    STAGE_SHADE,
+    STAGE_SHADOW,
+    STAGE_ACCUMULATE,
+    STAGE_PRESENT,
+    STAGE_COUNT
+};
+
+/* RenderStats
+ * ------------------------
+ * Counters and stage time in ticks of one thread, or of every thread once
+ * merged. Aligned so two threads' blocks never share a cache line
+ */
+typedef struct alignas(64) RenderStats {
+    uint64_t counters[STAT_COUNTER_COUNT] {};
+    uint64_t stageTicks[STAGE_COUNT] {};
+} RenderStats;
+
+extern thread_local RenderStats *threadStats;
+RenderStats *register_thread_stats();
+
+inline RenderStats &thread_stats() {
+    RenderStats *stats = threadStats;
+    return stats != nullptr ? *stats : *register_thread_stats();
+}
+
+// time stamp counter where there is one, a few cycles to read
+inline uint64_t stat_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/* StatTimer
+ * ------------------------
+ * Adds the ticks between its construction and destruction to one stage of
+ * the calling thread
+ */
+class StatTimer {
+public:
+    explicit StatTimer(StatStage stage) : stage(stage), start(stat_ticks()) {}
+    ~StatTimer() { thread_stats().stageTicks[stage] += stat_ticks() - start; }
+
+    StatTimer(const StatTimer &) = delete;
+    StatTimer &operator=(const StatTimer &) = delete;
+
+private:
+    StatStage stage;
+    uint64_t start;
+};
+
+struct Framebuffer;
+
+RenderStats collect_render_stats();
+double stat_tick_seconds();
+void print_render_stats(const RenderStats &stats);
+bool write_tile_heatmap(const Framebuffer &framebuffer, const std::string &path);
+
+#define STAT_CONCAT_INNER(a, b) a##b
+#define STAT_CONCAT(a, b) STAT_CONCAT_INNER(a, b)
+#define STAT_ADD(counter, n) (thread_stats().counters[counter] += static_cast<uint64_t>(n))
+#define STAT_TIMER(stage) StatTimer STAT_CONCAT(statTimer, __LINE__)(stage)
+
+#else
+
+#define STAT_ADD(counter, n) ((void) 0)
+#define STAT_TIMER(stage) ((void) 0)
+
+#endif //RAYTRACER_STATS
+
+#endif //RAYTRACINGFROMSCRATCH_STATS_H
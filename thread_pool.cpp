@@ -0,0 +1,155 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <chrono>
+#include "thread_pool.h"
+
+/* ThreadPool()
+ * ----------------------------------------
+ * Start the worker threads. A thread count of 0 uses one worker per hardware
+ * thread
+ *
+ * @param int threads
+ */
+ThreadPool::ThreadPool(int threads) : queues(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+    int count = static_cast<int>(queues.size());
+    workerStats.resize(count);
+    for (int i = 0; i < count; i++) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(batchLock);
+        stopping = true;
+    }
+    batchStart.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+/* run_batch()
+ * ----------------------------------------
+ * Run jobs 0..jobCount-1 on the pool and block until all of them are done.
+ * Each worker is seeded with a contiguous block of job indices so
+ * neighbouring jobs stay on the same core unless they are stolen
+ *
+ * @param int jobCount
+ * @param JobFunction job called as job(context, job index, worker index)
+ * @param void context
+ */
+void ThreadPool::run_batch(int jobCount, JobFunction job, const void *context) {
+    auto start = std::chrono::steady_clock::now();
+    int count = size();
+
+    for (int i = 0; i < count; i++) {
+        std::lock_guard<std::mutex> guard(queues[i].lock);
+        queues[i].front = jobCount * i / count;
+        queues[i].back = jobCount * (i + 1) / count;
+        workerStats[i] = WorkerStats {};
+    }
+
+    std::unique_lock<std::mutex> guard(batchLock);
+    batchJob = job;
+    batchContext = context;
+    active = count;
+    generation++;
+    batchStart.notify_all();
+    batchDone.wait(guard, [this] { return active == 0; });
+    batchJob = nullptr;
+    batchContext = nullptr;
+
+    batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* worker_loop()
+ * ----------------------------------------
+ * Sleep until a batch is started, then drain the local range followed by
+ * the ranges of the other workers
+ *
+ * @param int worker
+ */
+void ThreadPool::worker_loop(int worker) {
+    unsigned long seen = 0;
+    while (true) {
+        JobFunction job;
+        const void *context;
+        {
+            std::unique_lock<std::mutex> guard(batchLock);
+            batchStart.wait(guard, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            job = batchJob;
+            context = batchContext;
+        }
+
+        WorkerStats &stats = workerStats[worker];
+        int index;
+        while (true) {
+            bool stolen = false;
+            if (!pop_local(worker, index)) {
+                if (!steal(worker, index)) {
+                    break;
+                }
+                stolen = true;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            job(context, index, worker);
+            stats.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            stats.jobs++;
+            stats.stolen += stolen;
+        }
+
+        std::lock_guard<std::mutex> guard(batchLock);
+        if (--active == 0) {
+            batchDone.notify_one();
+        }
+    }
+}
+
+/* pop_local()
+ * ----------------------------------------
+ * Take the last job of this worker's own range
+ *
+ * @param[in] int worker
+ * @param[out] int job
+ * @return bool
+ */
+bool ThreadPool::pop_local(int worker, int &job) {
+    WorkQueue &queue = queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.front == queue.back) {
+        return false;
+    }
+    job = --queue.back;
+    return true;
+}
+
+/* steal()
+ * ----------------------------------------
+ * Take the first job of the first other worker that still has work,
+ * starting at the next worker along so thieves spread over their victims
+ *
+ * @param[in] int worker
+ * @param[out] int job
+ * @return bool
+ */
+bool ThreadPool::steal(int worker, int &job) {
+    int count = size();
+    for (int i = 1; i < count; i++) {
+        WorkQueue &queue = queues[(worker + i) % count];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.front != queue.back) {
+            job = queue.front++;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_THREAD_POOL_H
+#define RAYTRACINGFROMSCRATCH_THREAD_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* WorkerStats
+ * ------------------------
+ * Per worker counters for the last batch run on the pool. busySeconds is the
+ * time spent inside jobs, so busySeconds / batchSeconds is the utilisation
+ */
+typedef struct WorkerStats {
+    double busySeconds {0};
+    int jobs {0};
+    int stolen {0};
+} WorkerStats;
+
+/* ThreadPool
+ * ------------------------
+ * A fixed set of worker threads, each owning a contiguous range of job
+ * indices. A worker pops jobs from the back of its own range and, once that
+ * is empty, steals from the front of the other workers' ranges so expensive
+ * jobs do not leave the rest of the pool idle. Starting a batch touches no
+ * heap: the job is called through a pointer to the caller's function object
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // job(job index, worker index) for jobs 0..jobCount-1, returns once all of them are done
+    template <typename Job>
+    void run(int jobCount, const Job &job) {
+        run_batch(jobCount, [](const void *context, int index, int worker) { (*static_cast<const Job *>(context))(index, worker); }, &job);
+    }
+
+    int size() const { return static_cast<int>(queues.size()); }
+    const std::vector<WorkerStats> &stats() const { return workerStats; }
+    double batch_seconds() const { return batchSeconds; }
+
+private:
+    typedef void (*JobFunction)(const void *context, int job, int worker);
+
+    // jobs front..back-1 are still queued
+    typedef struct WorkQueue {
+        std::mutex lock;
+        int front {0};
+        int back {0};
+    } WorkQueue;
+
+    void run_batch(int jobCount, JobFunction job, const void *context);
+    void worker_loop(int worker);
+    bool pop_local(int worker, int &job);
+    bool steal(int worker, int &job);
+
+    std::vector<std::thread> workers;
+    std::vector<WorkQueue> queues;
+    std::vector<WorkerStats> workerStats;
+
+    std::mutex batchLock;
+    std::condition_variable batchStart;
+    std::condition_variable batchDone;
+    JobFunction batchJob {nullptr};
+    const void *batchContext {nullptr};
+    unsigned long generation {0};
+    int active {0};
+    bool stopping {false};
+    double batchSeconds {0};
+};
+
+#endif //RAYTRACINGFROMSCRATCH_THREAD_POOL_H
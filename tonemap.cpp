@@ -0,0 +1,166 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "tonemap.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TONEMAP_SSE 1
+#endif
+
+// pixels converted per block, 48 floats so the SSE path packs whole vectors
+#define TONEMAP_BLOCK 16
+
+// brighter input is white under every operator, capping it keeps x * x finite
+#define TONEMAP_MAX_INPUT 1e6f
+
+// linear part of the sRGB curve, below this the encoding is 12.92 * x
+#define SRGB_LINEAR_LIMIT 0.0031308f
+
+/* tonemap_channel()
+ * ----------------------------------------
+ * Reference version of one channel: exposure, tone mapping, clamp and
+ * encoding to a byte. The sRGB power curve uses the same fit as the SIMD
+ * path, so both produce the same bytes up to rounding
+ */
+static uint8_t tonemap_channel(float x, float scale, const DisplaySettings &display) {
+    // written so NaN also ends up at zero
+    x *= scale;
+    x = x > 0.0f ? std::min(x, TONEMAP_MAX_INPUT) : 0.0f;
+    switch (display.toneMap) {
+        case TONEMAP_REINHARD:
+            x = x / (1.0f + x);
+            break;
+        case TONEMAP_ACES:
+            x = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+            break;
+        default:
+            break;
+    }
+    x = std::min(x, 1.0f);
+    if (display.srgb) {
+        if (x <= SRGB_LINEAR_LIMIT) {
+            x *= 12.92f;
+        } else {
+            float s1 = std::sqrt(x), s2 = std::sqrt(s1), s3 = std::sqrt(s2);
+            x = 0.662002687f * s1 + 0.684122060f * s2 - 0.323583601f * s3 - 0.0225411470f * x;
+        }
+    }
+    return static_cast<uint8_t>(std::min(x * 255.0f + 0.5f, 255.0f));
+}
+
+#if defined(TONEMAP_SSE)
+/* tonemap_sse()
+ * ----------------------------------------
+ * Four channels of tonemap_channel() at once. sRGB's x^(1/2.4) is fitted
+ * from three nested square roots (max error a quarter of a byte step), which
+ * vectorise where a pow() would not
+ */
+static __m128i tonemap_sse(__m128 x, __m128 scale, const DisplaySettings &display) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    // max with zero second turns NaN into zero
+    x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x, scale), zero), _mm_set1_ps(TONEMAP_MAX_INPUT));
+    if (display.toneMap == TONEMAP_REINHARD) {
+        x = _mm_div_ps(x, _mm_add_ps(one, x));
+    } else if (display.toneMap == TONEMAP_ACES) {
+        __m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+        __m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))),
+                                        _mm_set1_ps(0.14f));
+        x = _mm_div_ps(numerator, denominator);
+    }
+    x = _mm_min_ps(x, one);
+    if (display.srgb) {
+        __m128 s1 = _mm_sqrt_ps(x);
+        __m128 s2 = _mm_sqrt_ps(s1);
+        __m128 s3 = _mm_sqrt_ps(s2);
+        __m128 curve = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.662002687f), s1), _mm_mul_ps(_mm_set1_ps(0.684122060f), s2));
+        curve = _mm_sub_ps(curve, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(0.323583601f), s3), _mm_mul_ps(_mm_set1_ps(0.0225411470f), x)));
+        __m128 linear = _mm_mul_ps(x, _mm_set1_ps(12.92f));
+        __m128 dark = _mm_cmple_ps(x, _mm_set1_ps(SRGB_LINEAR_LIMIT));
+        x = _mm_or_ps(_mm_and_ps(dark, linear), _mm_andnot_ps(dark, curve));
+    }
+    x = _mm_min_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)), _mm_set1_ps(255.0f));
+    return _mm_cvttps_epi32(x);
+}
+#endif
+
+/* tonemap_span()
+ * ----------------------------------------
+ * Turn a run of pixels of linear RGB radiance into RGBA8 display pixels.
+ * scale multiplies the radiance first, which lets callers fold averaging
+ * over passes into the exposure. Channels are processed as one flat array,
+ * four at a time with SSE, and interleaved with alpha at the end
+ *
+ * @param[in] float radiance[] 3 floats per pixel
+ * @param[out] uint8_t rgba[] 4 bytes per pixel
+ * @param int pixels
+ * @param float scale
+ * @param DisplaySettings display
+ */
+void tonemap_span(const float *radiance, uint8_t *rgba, int pixels, float scale, const DisplaySettings &display) {
+    scale *= std::exp2(display.exposure);
+    int pixel = 0;
+
+#if defined(TONEMAP_SSE)
+    __m128 scales = _mm_set1_ps(scale);
+    for (; pixel + TONEMAP_BLOCK <= pixels; pixel += TONEMAP_BLOCK) {
+        const float *in = radiance + 3 * pixel;
+        alignas(16) uint8_t rgb[3 * TONEMAP_BLOCK];
+        for (int i = 0; i < 3 * TONEMAP_BLOCK; i += 16) {
+            __m128i a = tonemap_sse(_mm_loadu_ps(in + i), scales, display);
+            __m128i b = tonemap_sse(_mm_loadu_ps(in + i + 4), scales, display);
+            __m128i c = tonemap_sse(_mm_loadu_ps(in + i + 8), scales, display);
+            __m128i d = tonemap_sse(_mm_loadu_ps(in + i + 12), scales, display);
+            __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+            _mm_store_si128(reinterpret_cast<__m128i *>(rgb + i), bytes);
+        }
+        uint8_t *out = rgba + 4 * pixel;
+        for (int i = 0; i < TONEMAP_BLOCK; i++) {
+            out[4 * i] = rgb[3 * i];
+            out[4 * i + 1] = rgb[3 * i + 1];
+            out[4 * i + 2] = rgb[3 * i + 2];
+            out[4 * i + 3] = 255;
+        }
+    }
+#endif
+
+    for (; pixel < pixels; pixel++) {
+        for (int channel = 0; channel < 3; channel++) {
+            rgba[4 * pixel + channel] = tonemap_channel(radiance[3 * pixel + channel], scale, display);
+        }
+        rgba[4 * pixel + 3] = 255;
+    }
+}
+
+/* parse_tonemap()
+ * ----------------------------------------
+ * Tone mapping operator for a command line name (none, reinhard, aces)
+ *
+ * @param[in] char name
+ * @param[out] bool valid
+ * @return ToneMapOperator
+ */
+ToneMapOperator parse_tonemap(const char *name, bool &valid) {
+    valid = true;
+    for (ToneMapOperator toneMap : {TONEMAP_NONE, TONEMAP_REINHARD, TONEMAP_ACES}) {
+        if (!strcmp(name, tonemap_name(toneMap))) {
+            return toneMap;
+        }
+    }
+    valid = false;
+    return TONEMAP_NONE;
+}
+
+const char *tonemap_name(ToneMapOperator toneMap) {
+    switch (toneMap) {
+        case TONEMAP_REINHARD: return "reinhard";
+        case TONEMAP_ACES: return "aces";
+        case TONEMAP_NONE:
+        default: return "none";
+    }
+}
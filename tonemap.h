@@ -0,0 +1,31 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_TONEMAP_H
+#define RAYTRACINGFROMSCRATCH_TONEMAP_H
+
+#include <cstdint>
+
+enum ToneMapOperator {
+    TONEMAP_NONE,
+    TONEMAP_REINHARD,
+    TONEMAP_ACES,
+};
+
+/* DisplaySettings
+ * ------------------------
+ * How linear radiance becomes display pixels: scaled by 2^exposure, passed
+ * through the tone mapping operator, clamped to 0..1 and sRGB encoded
+ */
+typedef struct DisplaySettings {
+    float exposure {0.0f};
+    ToneMapOperator toneMap {TONEMAP_ACES};
+    bool srgb {true};
+} DisplaySettings;
+
+void tonemap_span(const float *radiance, uint8_t *rgba, int pixels, float scale, const DisplaySettings &display);
+ToneMapOperator parse_tonemap(const char *name, bool &valid);
+const char *tonemap_name(ToneMapOperator toneMap);
+
+#endif //RAYTRACINGFROMSCRATCH_TONEMAP_H
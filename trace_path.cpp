@@ -3,105 +3,131 @@
 //
 
 #include <algorithm>
-#include <random>
 #include "trace_path.h"
+#include "irradiance_cache.h"
+#include "bsdf.h"
 #include "objects.h"
+#include "stats.h"
 
-#define LIGHTS 3
-#define OBJECTS 4
-#define TMIN 0.001
-#define TMAX 1000
-
-#define NUM_BOUNCES 1
-#define NUM_SAMPLES 100
+static float area_light_pdf(const LightSoA &lights, int light, Vec3 direction, float distance2, float selection);
 
 /* trace_path()
  * ----------------------------------------
- * Shoot a ray from a point into the direction specified. If no objects are hit
- * return black, otherwise find the point on the closest object hit and
- * calculate the direct lighting. Sample vectors in the hemisphere of that
- * point and recursively call trace path, returning the sum of the emissivity
- * of that point and all lighting sampled from further calls of trace_path()
+ * Follow a single path from a point into the direction specified. At every
+ * hit the direct lighting of that point, scaled by the throughput of the path
+ * so far, is added to the colour. The path then continues in one direction
+ * drawn from the surface's BSDF and the throughput is multiplied by
+ * f * cos(theta) / pdf, so the cost grows linearly with the depth instead of
+ * branching at every bounce. Area lights are reached both by the light
+ * samples of the direct lighting and by these BSDF samples, and each is
+ * weighted against the other with the power heuristic. Lights are not seen
+ * by the camera ray itself. After RR_DEPTH bounces paths are terminated with
+ * Russian roulette and survivors reweighted to keep the estimate unbiased.
+ * With an irradiance cache the indirect light at the first hit is
+ * interpolated from its records instead, and the path ends there
  *
  * @param Vec3 origin
  * @param Vec3 direction
- * @param Object objects[]
- * @param Light lights[]
- * @return Vec3i color
+ * @param Scene scene
+ * @param Sampler sampler already started for this path
+ * @param int maxDepth number of indirect bounces
+ * @param[out] PathFeatures features of the first hit, optional
+ * @param IrradianceCache cache optional, records are added where none cover the first hit
+ * @return Vec3 linear RGB radiance
  */
-Vec3i trace_path(Vec3 origin, Vec3 direction, Sphere objects[], Light lights[], int depth) {
-    Vec3i color = {0,0,0};
-    Vec3i indirectDiffuse {0,0,0};
+Vec3 trace_path(Vec3 origin, Vec3 direction, const Scene &scene, Sampler &sampler, int maxDepth, PathFeatures *features,
+                IrradianceCache *cache) {
+    Vec3 radiance = {0, 0, 0};
+    Vec3 throughput = {1, 1, 1};
+    // density the last bounce was drawn with, for weighting the area lights it hits
+    float bsdfPdf = 0;
+
+    for (int depth = 0; depth <= maxDepth; depth++) {
+        // check if ray from origin in direction intersects with object, set the closest hit
+        Hit hit;
+        bool found;
+        if (depth > 0) {
+            STAT_ADD(STAT_INDIRECT_RAYS, 1);
+        }
+        {
+            STAT_TIMER(STAGE_INTERSECT);
+            found = closest_hit(scene, origin, direction, TMAX, hit);
+        }
+        if (depth > 0 && !scene.lightSoA.areaLights.empty()) {
+            float tLight = found ? hit.t : TMAX;
+            radiance += throughput * area_light_emission(scene.lightSoA, origin, direction, tLight, bsdfPdf);
+        }
+        if (!found) {
+            // if no, the path sees black
+            if (depth == 0 && features != nullptr) {
+                *features = PathFeatures {Vec3 {0, 0, 0}, Vec3 {0, 0, 0}, TMAX};
+            }
+            break;
+        }
 
-    // check if ray from origin in direction intersects with object, set the closest object
-    Sphere closestObject;
-    float closestT = std::numeric_limits<float>::infinity();
-    if (!closest_intersection_sphere(objects, origin, direction, TMAX,  closestObject, closestT)) {
-        // if no, return black
-        return color;
-    }
+        // a path that goes on from here samples the BSDF, so the direct lighting shares area lights with it
+        bool cached = depth == 0 && cache != nullptr && maxDepth > 0;
+        bool continues = depth < maxDepth && !cached;
+
+        // calculate the point hit and the unit normal from that point
+        STAT_TIMER(STAGE_SHADE);
+        Vec3 point = origin + direction * hit.t;  // Compute intersection
+        Vec3 normal = hit_normal(scene, hit, point, direction);
+        const Material &material = scene.materials[hit.material];
+        Vec3 direct = direct_lighting(scene, material, point, normal, direction, sampler, continues);
+        Vec3 reflectance = material.albedo;
+        int specular = material.specular;
+        if (depth == 0 && features != nullptr) {
+            *features = PathFeatures {normal, reflectance, hit.t};
+        }
 
-    // calculate the point hit and the unit normal from that point
-    Vec3 point = origin.add(direction.multiplyScalar(closestT));  // Compute intersection
-    Vec3 normal = point.subtract(closestObject.centre); // Compute sphere normal at intersection
-    normal = normal.multiplyScalar(1/normal.length()); // unit normal
+        // calculate direct lighting
+        radiance += direct.multiply(throughput);
 
-    // calculate direct lighting
-    color = color.add(direct_lighting_sphere(origin, direction, closestObject, closestT, objects, lights));
+        // check if max depth was reached
+        if (depth == maxDepth) {
+            break;
+        }
 
-    // add sphere emission
-    //color = color.add(closestObject.color.multiplyScalar(closestObject.emission));
+        // the diffuse reflection of the irradiance E is albedo / pi * E
+        if (cached) {
+            Vec3 irradiance {};
+            if (!cache->lookup(point, normal, irradiance)) {
+                IrradianceRecord record = compute_irradiance_record(scene, point, normal, maxDepth - 1);
+                cache->insert(record);
+                irradiance = record.irradiance;
+            }
+            radiance += reflectance.multiply(irradiance) * static_cast<float>(M_1_PI);
+            break;
+        }
 
-    // check if max depth was reached
-    if (depth >= NUM_BOUNCES) {
-        //color = color.multiplyScalar(1.0/M_PI);
-        return color;
-    }
+        // draw the next direction from the BSDF of the hit
+        Vec3 view = (-direction).normalize();
+        float u, v;
+        sampler.get_2d(u, v);
+        float lobe = sampler.get_1d();
+        Vec3 sample {};
+        if (!sample_phong(normal, view, specular, u, v, lobe, sample, bsdfPdf)) {
+            break;
+        }
+        float weight = phong_brdf(normal, view, specular, sample) * normal.dot(sample) / bsdfPdf;
+        throughput = throughput.multiply(reflectance) * weight;
+
+        // Russian roulette, survivors carry the energy of the terminated paths
+        float roulette = sampler.get_1d();
+        if (depth + 1 >= RR_DEPTH) {
+            float survival = std::min(std::max(std::max(throughput.x, throughput.y), throughput.z), RR_MAX_SURVIVAL);
+            if (roulette >= survival) {
+                break;
+            }
+            throughput *= 1.0f / survival;
+        }
 
-    // generate sample points on origin local coordinates hemisphere
-    Vec3 normalTangent {};
-    Vec3 normalBiTangent {};
-    local_coordinates(normal, normalTangent, normalBiTangent);
-
-    // Code taken from https://en.cppreference.com/w/cpp/numeric/random/uniform_real_distribution
-    std::random_device rd;  // Will be used to obtain a seed for the random number engine
-    std::mt19937 generator(rd()); // Standard mersenne_twister_engine seeded with rd()
-    std::uniform_real_distribution<float> distribution(0.0, 1.0);
-
-    float pdf = 1 / (2 * M_PI);
-
-    // generate points in a hemisphere and transform to point local coordinates
-    for (int i = 0; i < NUM_SAMPLES; i++) {
-        float r1 = distribution(generator);
-        float r2 = distribution(generator);
-        Vec3 s = sample_hemisphere(r1, r2);
-        Vec3 sample = {s.x * normalBiTangent.x + s.y * normal.x + s.z * normalTangent.x,
-                  s.x * normalBiTangent.y + s.y * normal.y + s.z * normalTangent.y,
-                  s.x * normalBiTangent.z + s.y * normal.z + s.z * normalTangent.z,};
-
-        // recursively call trace_path and add to intensity
-        Vec3i indirectLighting = trace_path(point.add(sample.multiplyScalar(0.0001)), sample, objects, lights, depth+1);
-        // multiply by cos(theta)
-        indirectLighting = indirectLighting.multiplyScalar(r1);
-        // divide by theta
-        indirectLighting = indirectLighting.multiplyScalar(1/pdf);
-        indirectDiffuse = indirectDiffuse.add(indirectLighting);
+        origin = point + sample * BOUNCE_OFFSET;
+        direction = sample;
     }
 
-    // divide by N and the constant PDF
-    indirectDiffuse = indirectDiffuse.multiplyScalar(1.0/NUM_SAMPLES);
-
-    // multiply by object albedo * 2
-    indirectDiffuse = indirectDiffuse.multiplyScalar(2*0.18);
-
-    // multiply the direct lighting by albedo/M_PI
-    //color = color.multiplyScalar(0.18/M_PI);
-
-    // add indirect diffuse
-    color = color.add(indirectDiffuse);
-
-    color = Vec3i {(std::clamp(color.r, 0, 255)), (std::clamp(color.g, 0, 255)), (std::clamp(color.b, 0, 255))};
-    return color;
+    return radiance;
 }
 
 /* vector_hemisphere()
@@ -159,29 +185,66 @@ Vec3 sample_hemisphere(const float &r1, const float &r2){
     return randomSample;
 }
 
-/* direct_lighting_sphere()
+/* direct_lighting()
  * ----------------------------------------
  * Shoot a ray from the point to all lights in the scene. If no objects are
  * between the light and point, we calculate the light intensity reflected
  * off the point to the camera and return the cumulative sum of all of these
- * lights as the direct lighting
+ * lights, coloured by the material, as the direct lighting. Every kind of
+ * primitive is shaded here once its hit is resolved to a normal and material
  *
+ * @param Scene scene
+ * @param Material material
  * @param Vec3 point
- * @param Vec3 transformed
- * @param Object closestSphere
- * @param float closestT
- * @param Sphere scene[]
- * @param Light lights[]
- * @return Vec3i Color
+ * @param Vec3 normal unit, see hit_normal()
+ * @param Vec3 direction of the ray that hit the point
+ * @param Sampler sampler
+ * @param bool weighted whether the path also samples the BSDF from this point
+ * @return Vec3 radiance
  */
-Vec3i direct_lighting_sphere(Vec3 origin, Vec3 transformed, Sphere closestSphere, float closestT, Sphere scene[], Light lights[]) {
+Vec3 direct_lighting(const Scene &scene, const Material &material, Vec3 point, Vec3 normal, Vec3 direction, Sampler &sampler,
+                     bool weighted) {
+    float illumination = std::max(compute_direct_lighting_sphere(scene, point, normal, -direction, material.specular, sampler, weighted), 0.0);
+    return material.albedo * illumination;
+}
 
-    Vec3 point = origin.add(transformed.multiplyScalar(closestT));  // Compute intersection
-    Vec3 normal = point.subtract(closestSphere.centre); // Compute sphere normal at intersection
-    normal = normal.multiplyScalar(1/normal.length()); // unit normal
+/* hit_normal()
+ * ----------------------------------------
+ * Unit normal of the surface at a hit. Spheres point outwards, triangles
+ * face back along the ray, see triangle_normal(), and shapes follow
+ * shape_normal()
+ *
+ * @param Scene scene
+ * @param Hit hit
+ * @param Vec3 point on the surface
+ * @param Vec3 direction of the ray that hit it
+ * @return Vec3 normal
+ */
+Vec3 hit_normal(const Scene &scene, const Hit &hit, Vec3 point, Vec3 direction) {
+    switch (hit.type) {
+        case PRIMITIVE_TRIANGLE:
+            return triangle_normal(scene.triangles[hit.primitive], direction);
+        case PRIMITIVE_SPHERE:
+            return (point - scene.objects[hit.primitive].centre).normalize();
+        case PRIMITIVE_SHAPE:
+            return shape_normal(scene.shapes[hit.primitive], point, direction);
+        default:
+            return Vec3 {0, 0, 0};
+    }
+}
 
-    float illumination = std::clamp(compute_direct_lighting_sphere(scene, point, normal, transformed.flipped(), lights, closestSphere.specular), 0.0, 100.0);
-    return closestSphere.color.multiplyScalar(illumination);
+/* triangle_normal()
+ * ----------------------------------------
+ * Unit geometric normal of a triangle, flipped to face back along the ray
+ * so meshes are shaded the same from either side
+ *
+ * @param MeshTriangle triangle
+ * @param Vec3 direction
+ * @return Vec3 normal
+ */
+Vec3 triangle_normal(const MeshTriangle &triangle, Vec3 direction) {
+    Vec3 normal = triangle.edge1.cross(triangle.edge2).normalize();
+    return normal.dot(direction) > 0 ? -normal : normal;
 }
 
 /* intersect_ray_sphere()
@@ -197,9 +260,9 @@ Vec3i direct_lighting_sphere(Vec3 origin, Vec3 transformed, Sphere closestSphere
  * @param[out] float t2
  * @return bool
  */
-bool intersect_ray_sphere(Vec3 origin, Vec3 direction, Sphere sphere, float &t1, float &t2) {
+bool intersect_ray_sphere(Vec3 origin, Vec3 direction, const Sphere &sphere, float &t1, float &t2) {
     float r = sphere.radius;
-    Vec3 CO = origin.subtract(sphere.centre);
+    Vec3 CO = origin - sphere.centre;
 
     float a = direction.dot(direction);
     float b = CO.dot(direction);
@@ -212,103 +275,508 @@ bool intersect_ray_sphere(Vec3 origin, Vec3 direction, Sphere sphere, float &t1,
         return false;
     }
 
-    t1 = ((-b) + sqrt(discriminant)) / (2*a);
-    t2 = ((-b) - sqrt(discriminant)) / (2*a);
+    float root = sqrt(discriminant);
+    t1 = ((-b) + root) / (2*a);
+    t2 = ((-b) - root) / (2*a);
     return true;
 }
 
+/* area_light_pdf()
+ * -----------------------
+ * Density in solid angle of a light sample reaching an area light in a
+ * direction: the uniform density over its surface, 1 / area, turned into
+ * solid angle by distance^2 / cos(theta light), times how often the light
+ * is picked. Zero for a light seen edge on
+ *
+ * @param LightSoA lights
+ * @param int light
+ * @param Vec3 direction unit
+ * @param float distance2 squared distance to the point on the light
+ * @param float selection expected number of samples of this light
+ * @return float pdf
+ */
+static float area_light_pdf(const LightSoA &lights, int light, Vec3 direction, float distance2, float selection) {
+    Vec3 edge1 = {lights.edge1X[light], lights.edge1Y[light], lights.edge1Z[light]};
+    Vec3 edge2 = {lights.edge2X[light], lights.edge2Y[light], lights.edge2Z[light]};
+    // area * cos(theta light), zero for a light seen edge on, which no BSDF sample can hit either
+    float projected = std::fabs(direction.dot(edge1.cross(edge2)));
+    return projected > 0 ? selection * distance2 / projected : 0.0f;
+}
+
+/* area_light_emission()
+ * -----------------------
+ * Light reaching a ray that was sampled from a BSDF with density bsdfPdf
+ * from the area lights it passes through before tMax. Area lights spread
+ * their intensity over their surface without falloff, so seen from a
+ * distance r at an angle theta to their face they send pi * I * r^2 /
+ * (area * cos(theta)), which is what a light sample estimates too. Each
+ * hit is weighted against the light samples that could have found it.
+ * Lights do not block rays, so the path goes on behind them. The lights
+ * are found through their BVH, so the cost grows with the lights along the
+ * ray rather than with all of them
+ *
+ * @param LightSoA lights
+ * @param Vec3 origin
+ * @param Vec3 direction unit
+ * @param float tMax
+ * @param float bsdfPdf
+ * @return float radiance
+ */
+float area_light_emission(const LightSoA &lights, Vec3 origin, Vec3 direction, float tMax, float bsdfPdf) {
+    bool sampled = lights.count > LIGHT_EXHAUSTIVE_LIMIT;
+    float emitted = 0;
+    // every light the ray passes adds, so no leaf reports a hit and tMax never shrinks
+    traverse_bvh(lights.areaLightBvh, origin, direction, TMIN, tMax, [&](int first, int count, float &) {
+        for (int i = first; i < first + count; i++) {
+            int light = lights.areaLights[i];
+            Vec3 corner = {lights.x[light], lights.y[light], lights.z[light]};
+            Vec3 edge1 = {lights.edge1X[light], lights.edge1Y[light], lights.edge1Z[light]};
+            Vec3 edge2 = {lights.edge2X[light], lights.edge2Y[light], lights.edge2Z[light]};
+            Vec3 facing = edge1.cross(edge2);
+            float facing2 = facing.dot(facing);
+            float denominator = direction.dot(facing);
+            if (denominator == 0 || facing2 == 0) {
+                continue;
+            }
+            float t = (corner - origin).dot(facing) / denominator;
+            if (t <= TMIN || t >= tMax) {
+                continue;
+            }
+
+            // coordinates of the hit along the two edges
+            Vec3 local = origin + direction * t - corner;
+            float u = local.cross(edge2).dot(facing) / facing2;
+            float v = edge1.cross(local).dot(facing) / facing2;
+            if (u < 0 || u > 1 || v < 0 || v > 1) {
+                continue;
+            }
+            float selection = sampled ? LIGHT_SAMPLES * lights.pdf[light] : 1.0f;
+            // area * cos(theta light) is |direction . facing|
+            float lightPdf = selection * t * t / std::fabs(denominator);
+            float radiance = static_cast<float>(M_PI) * lights.intensity[light] * t * t / std::fabs(denominator);
+            emitted += radiance * power_heuristic(bsdfPdf, lightPdf);
+        }
+        return false;
+    });
+    return emitted;
+}
+
+/* sample_direct_lighting()
+ * -----------------------
+ * Draw the light samples for a point and work out what each would add if
+ * nothing blocks its shadow ray. Scenes with up to LIGHT_EXHAUSTIVE_LIMIT lights have every
+ * light evaluated. Larger ones pick LIGHT_SAMPLES lights by power and weight each by
+ * 1 / (pdf * LIGHT_SAMPLES), so the cost does not grow with the number of lights. Area lights
+ * are sampled at one uniform point. Each light reflects pi * f * cos(theta) * I with the Phong
+ * BSDF f of the surface, per unit albedo. When weighted, area light samples get their power
+ * heuristic weight against the BSDF sample the path takes next, which may hit the same light.
+ * Samples that add nothing, such as lights behind the surface, are left out, so they cost no
+ * shadow ray. Shadow rays only run up to the light, lights with a position are reached at t = 1
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 point
+ * @param[in] Vec3 normal unit
+ * @param[in] Vec3 view
+ * @param[in] int specular
+ * @param[in] Sampler sampler
+ * @param[in] bool weighted
+ * @param[out] LightSample samples[] room for LIGHT_EXHAUSTIVE_LIMIT
+ * @return int samples that need a shadow ray
+ */
+int sample_direct_lighting(const Scene &scene, Vec3 point, Vec3 normal, Vec3 view, int specular, Sampler &sampler, bool weighted,
+                           LightSample samples[]) {
+    const LightSoA &lights = scene.lightSoA;
+    bool sampled = lights.count > LIGHT_EXHAUSTIVE_LIMIT;
+    int rays = sampled ? LIGHT_SAMPLES : lights.count;
+    Vec3 unitView = view.normalize();
+    int count = 0;
+
+    for (int i = 0; i < rays; i++) {
+        int light = i;
+        float weight = 1.0f;
+        if (sampled) {
+            float pdf;
+            light = sample_light(lights, sampler.get_1d(), pdf);
+            weight = 1.0f / (pdf * LIGHT_SAMPLES);
+        }
+
+        Vec3 position = {lights.x[light], lights.y[light], lights.z[light]};
+        Vec3 direction {};
+        float tMax = 1;
+        switch (lights.type[light]) {
+            case LIGHT_DIRECTIONAL:
+                direction = position;
+                tMax = std::numeric_limits<float>::infinity();
+                break;
+            case LIGHT_AREA: {
+                float u, v;
+                sampler.get_2d(u, v);
+                position += Vec3 {lights.edge1X[light], lights.edge1Y[light], lights.edge1Z[light]} * u;
+                position += Vec3 {lights.edge2X[light], lights.edge2Y[light], lights.edge2Z[light]} * v;
+                direction = position - point;
+                break;
+            }
+            default:
+                direction = position - point;
+                break;
+        }
+
+        float distance2 = direction.dot(direction);
+        Vec3 L = direction * (1.0f / std::sqrt(distance2));
+        float cosTheta = normal.dot(L);
+        if (cosTheta <= 0) {
+            continue;
+        }
+
+        // diffuse and specular lighting
+        float reflected = lights.intensity[light] * weight * static_cast<float>(M_PI) * phong_brdf(normal, unitView, specular, L) * cosTheta;
+        if (weighted && lights.type[light] == LIGHT_AREA) {
+            float selection = sampled ? LIGHT_SAMPLES * lights.pdf[light] : 1.0f;
+            reflected *= power_heuristic(area_light_pdf(lights, light, L, distance2, selection), phong_pdf(normal, unitView, specular, L));
+        }
+        if (reflected > 0) {
+            samples[count++] = LightSample {direction, tMax, reflected, light};
+        }
+    }
+    return count;
+}
+
 /* compute_direct_lighting_sphere()
  * -----------------------
- * Compute the amount of direct lighting coming from light sources to a given point on a sphere
+ * Compute the amount of direct lighting coming from light sources to a given point on a sphere:
+ * the ambient light plus every sample of sample_direct_lighting() whose shadow ray is clear.
+ * The shadow rays are traced as one batch per point
  *
- * @param Sphere scene[]
+ * @param Scene scene
  * @param Vec3 point
- * @param Vec3 normal
+ * @param Vec3 normal unit
  * @param Vec3 view
- * @param Light lights[]
  * @param int specular
+ * @param Sampler sampler
+ * @param bool weighted
  * @return float intensity
  */
+double compute_direct_lighting_sphere(const Scene &scene, Vec3 point, Vec3 normal, Vec3 view, int specular, Sampler &sampler,
+                                      bool weighted) {
+    double intensity = scene.lightSoA.ambient;
+    if (scene.lightSoA.count == 0) {
+        return intensity;
+    }
 
-double compute_direct_lighting_sphere(Sphere scene[], Vec3 point, Vec3 normal, Vec3 view, Light lights[], int specular) {
-    double intensity = 0.0;
-
-    for (int i = 0; i < LIGHTS; i++) {
-        Light light = lights[i];
-
-        if (light.type == "ambient") {
-            intensity += light.intensity;
-        } else {
-            Vec3 L{};
-            float tMax = 0;
-            if (light.type == "point") {
-                L = light.direction.subtract(point);
-                tMax = 1;
-            }
-            if (light.type == "directional") {
-                L = light.direction;
-                tMax = std::numeric_limits<float>::infinity();
-            }
+    LightSample samples[LIGHT_EXHAUSTIVE_LIMIT];
+    int rays = sample_direct_lighting(scene, point, normal, view, specular, sampler, weighted, samples);
+    if (rays == 0) {
+        return intensity;
+    }
+    Vec3 directions[LIGHT_EXHAUSTIVE_LIMIT] {};
+    float tMax[LIGHT_EXHAUSTIVE_LIMIT] {};
+    bool blocked[LIGHT_EXHAUSTIVE_LIMIT] {};
+    for (int i = 0; i < rays; i++) {
+        directions[i] = samples[i].direction;
+        tMax[i] = samples[i].tMax;
+    }
+    {
+        STAT_TIMER(STAGE_SHADOW);
+        STAT_ADD(STAT_SHADOW_RAYS, rays);
+        occluded_batch(scene, point, directions, TMIN, tMax, rays, blocked);
+    }
 
-            // Shadow check
-            Sphere closestSphere {};
-            float closestT = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < rays; i++) {
+        if (!blocked[i]) {
+            intensity += samples[i].intensity;
+        }
+    }
+    return intensity;
+}
 
-            if (closest_intersection_sphere(scene, point, L, 1000, closestSphere, closestT)) {
-                continue;
+/* occluded()
+ * -----------------------
+ * Shadow ray query: is anything, shape, sphere or triangle, hit between
+ * tMin and tMax along the ray. Stops at the first hit found rather than
+ * searching for the closest one, and copies nothing out
+ *
+ * @param Scene scene
+ * @param Vec3 origin
+ * @param Vec3 direction
+ * @param float tMin
+ * @param float tMax
+ * @return bool
+ */
+bool occluded(const Scene &scene, Vec3 origin, Vec3 direction, float tMin, float tMax) {
+    if (tMax <= tMin) {
+        return false;
+    }
+    if (occluded_shapes(scene, origin, direction, tMin, tMax)) {
+        return true;
+    }
+    bool blocked = occluded_bvh(scene.sphereBvh, origin, direction, tMin, tMax, [&](int first, int count) {
+        STAT_ADD(STAT_SPHERE_TESTS, count);
+        return occluded_spheres(scene.sphereSoA, first, count, origin, direction, tMin, tMax);
+    });
+    return blocked || occluded_bvh(scene.triangleBvh, origin, direction, tMin, tMax, [&](int first, int count) {
+        STAT_ADD(STAT_TRIANGLE_TESTS, count);
+        float t;
+        for (int i = first; i < first + count; i++) {
+            if (intersect_mesh_triangle(scene.triangles[i], origin, direction, tMin, tMax, t)) {
+                return true;
             }
+        }
+        return false;
+    });
+}
 
-            // diffuse lighting
-            float nDotL = normal.dot(L);
-            if (nDotL > 0) {
-                intensity += light.intensity * nDotL/(normal.length() * L.length());
+/* occluded_batch()
+ * -----------------------
+ * occluded() for a group of rays leaving one point, typically one shadow
+ * ray per light. Each BVH is walked once for up to BVH_MAX_BATCH rays and
+ * rays already blocked by a shape or sphere skip the rest. Rays with
+ * tMax <= tMin are reported unblocked
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 directions[]
+ * @param[in] float tMin
+ * @param[in] float tMax[]
+ * @param[in] int count
+ * @param[out] bool blocked[]
+ */
+void occluded_batch(const Scene &scene, Vec3 origin, const Vec3 directions[], float tMin, const float tMax[], int count, bool blocked[]) {
+    for (int base = 0; base < count; base += BVH_MAX_BATCH) {
+        int batch = std::min(BVH_MAX_BATCH, count - base);
+        const Vec3 *rays = directions + base;
+        const float *limits = tMax + base;
+
+        // the few shapes are tested ray by ray, only the rays they leave open walk the sphere BVH
+        uint32_t mask = 0;
+        float remaining[BVH_MAX_BATCH];
+        for (int i = 0; i < batch; i++) {
+            mask |= static_cast<uint32_t>(limits[i] > tMin && occluded_shapes(scene, origin, rays[i], tMin, limits[i])) << i;
+            remaining[i] = (mask >> i) & 1 ? 0 : limits[i];
+        }
+        mask |= occluded_bvh_batch(scene.sphereBvh, origin, rays, tMin, remaining, batch, [&](int first, int leafCount, int ray) {
+            STAT_ADD(STAT_SPHERE_TESTS, leafCount);
+            return occluded_spheres(scene.sphereSoA, first, leafCount, origin, rays[ray], tMin, remaining[ray]);
+        });
+
+        // only the rays the spheres left open are traced against the triangles
+        if (!scene.triangles.empty()) {
+            for (int i = 0; i < batch; i++) {
+                remaining[i] = (mask >> i) & 1 ? 0 : limits[i];
             }
-
-            // specular lighting
-            if (specular != -1) {
-                Vec3 R = ((normal.multiplyScalar(2)).multiplyScalar(normal.dot(L))).subtract(L);
-                float rDotV = R.dot(view);
-                if (rDotV > 0) {
-                    intensity += light.intensity * pow(rDotV / (R.length() * view.length()), specular);
+            mask |= occluded_bvh_batch(scene.triangleBvh, origin, rays, tMin, remaining, batch, [&](int first, int leafCount, int ray) {
+                STAT_ADD(STAT_TRIANGLE_TESTS, leafCount);
+                float t;
+                for (int i = first; i < first + leafCount; i++) {
+                    if (intersect_mesh_triangle(scene.triangles[i], origin, rays[ray], tMin, remaining[ray], t)) {
+                        return true;
+                    }
                 }
-            }
+                return false;
+            });
+        }
+
+        for (int i = 0; i < batch; i++) {
+            blocked[base + i] = (mask >> i) & 1;
         }
     }
-    return intensity;
 }
-/* closest_intersection()
+
+/* closest_hit()
+ * -----------------------
+ * Given a ray, find the closest shape, sphere or triangle it hits within
+ * tMax and describe the hit with a Hit record. Shapes go first, so a near
+ * ground plane cuts the BVH walks short
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMax
+ * @param[out] Hit hit
+ * @return bool
+ */
+bool closest_hit(const Scene &scene, Vec3 origin, Vec3 direction, float tMax, Hit &hit) {
+    float closestT = std::numeric_limits<float>::infinity();
+    int shape = -1, sphere = -1, triangle = -1;
+    if (!closest_intersection_shape(scene, origin, direction, tMax, shape, closestT)) {
+        shape = -1;
+    }
+    if (!closest_intersection_sphere_index(scene, origin, direction, tMax, sphere, closestT)) {
+        sphere = -1;
+    }
+    if (!closest_intersection_triangle(scene, origin, direction, tMax, triangle, closestT)) {
+        triangle = -1;
+    }
+    return resolve_hit(scene, origin, direction, closestT, shape, sphere, triangle, hit);
+}
+
+/* resolve_hit()
+ * -----------------------
+ * Hit record of the closest shape, closest nearer sphere and closest nearer
+ * triangle still of a ray, any of them -1 if there is none, as
+ * closest_intersection_shape(), closest_intersection_sphere_index() and
+ * closest_intersection_triangle() report them one after the other. The
+ * last one found is the closest
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float t distance to the hit
+ * @param[in] int shape
+ * @param[in] int sphere
+ * @param[in] int triangle
+ * @param[out] Hit hit
+ * @return bool whether anything was hit
+ */
+bool resolve_hit(const Scene &scene, Vec3 origin, Vec3 direction, float t, int shape, int sphere, int triangle, Hit &hit) {
+    if (triangle >= 0) {
+        const MeshTriangle &packed = scene.triangles[triangle];
+        hit = Hit {t, PRIMITIVE_TRIANGLE, triangle, packed.material};
+        triangle_barycentrics(packed, origin, direction, hit.u, hit.v);
+        return true;
+    }
+    if (sphere >= 0) {
+        hit = Hit {t, PRIMITIVE_SPHERE, sphere, scene.sphereMaterials[sphere]};
+        return true;
+    }
+    if (shape >= 0) {
+        hit = Hit {t, PRIMITIVE_SHAPE, shape, scene.shapeMaterials[shape]};
+        return true;
+    }
+    hit = Hit {t};
+    return false;
+}
+
+/* closest_intersection_sphere_index()
  * -----------------------
  * Given a ray, check if it intersects with any spheres in the scene within a
- * given range along the ray. Set the object and the distance if so.
+ * given range along the ray, and set the index of the closest in the
+ * scene's objects and the distance if so. The sphere BVH is traversed near child
+ * first and the spheres of each leaf are tested several at a time by the
+ * SIMD kernel. Only hits closer than both tMax and closestT count
  *
- * @param[in] Sphere scene[]
+ * @param[in] Scene scene
  * @param[in] Vec3 origin
  * @param[in] Vec3 transformed
  * @param[in] float tMax
- * @param[out] Sphere closestSphere
- * @param[out] float closestT
+ * @param[out] int closestIndex
+ * @param[in,out] float closestT
  * @return bool
  */
-bool closest_intersection_sphere(Sphere scene[], Vec3 origin, Vec3 transformed, float tMax, Sphere &closestSphere, float &closestT) {
-    bool found = false;
-    for (int i = 0; i < OBJECTS; i++) {
-        Sphere sphere = scene[i];
-        float t1, t2;
-        if(!intersect_ray_sphere(origin, transformed, sphere, t1, t2)) {
-            continue;
+bool closest_intersection_sphere_index(const Scene &scene, Vec3 origin, Vec3 transformed, float tMax, int &closestIndex, float &closestT) {
+    float tLimit = std::min(tMax, closestT);
+    bool found = traverse_bvh(scene.sphereBvh, origin, transformed, TMIN, tLimit, [&](int first, int count, float &tHit) {
+        STAT_ADD(STAT_SPHERE_TESTS, count);
+        return intersect_spheres(scene.sphereSoA, first, count, origin, transformed, TMIN, tHit, tHit, closestIndex);
+    });
+    if (!found) {
+        return false;
+    }
+    closestT = tLimit;
+    return true;
+}
+
+/* closest_intersection_triangle()
+ * -----------------------
+ * Given a ray, check if it hits any mesh triangle closer than both tMax and
+ * closestT. Set the triangle and the distance if so
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 transformed
+ * @param[in] float tMax
+ * @param[out] int closestTriangle
+ * @param[in,out] float closestT
+ * @return bool
+ */
+bool closest_intersection_triangle(const Scene &scene, Vec3 origin, Vec3 transformed, float tMax, int &closestTriangle, float &closestT) {
+    float tLimit = std::min(tMax, closestT);
+    bool found = traverse_bvh(scene.triangleBvh, origin, transformed, TMIN, tLimit, [&](int first, int count, float &tHit) {
+        STAT_ADD(STAT_TRIANGLE_TESTS, count);
+        bool hit = false;
+        for (int i = first; i < first + count; i++) {
+            if (intersect_mesh_triangle(scene.triangles[i], origin, transformed, TMIN, tHit, tHit)) {
+                closestTriangle = i;
+                hit = true;
+            }
         }
+        return hit;
+    });
+    if (!found) {
+        return false;
+    }
+    closestT = tLimit;
+    return true;
+}
 
-        if ((t1 < tMax) && (TMIN < t1) && (t1 < closestT)) {
-            closestT = t1;
-            closestSphere = sphere;
+/* closest_intersection_shape()
+ * -----------------------
+ * Given a ray, check if it hits any shape closer than both tMax and
+ * closestT: every plane on its own, then the bounded shapes through their
+ * BVH. Set the shape's index in the scene's shapes and the distance if so
+ *
+ * @param[in] Scene scene
+ * @param[in] Vec3 origin
+ * @param[in] Vec3 direction
+ * @param[in] float tMax
+ * @param[out] int closestShape
+ * @param[in,out] float closestT
+ * @return bool
+ */
+bool closest_intersection_shape(const Scene &scene, Vec3 origin, Vec3 direction, float tMax, int &closestShape, float &closestT) {
+    float tLimit = std::min(tMax, closestT);
+    bool found = false;
+    STAT_ADD(STAT_SHAPE_TESTS, scene.unboundedShapes.size());
+    for (int index : scene.unboundedShapes) {
+        if (intersect_shape(scene.shapes[index], origin, direction, TMIN, tLimit, tLimit)) {
+            closestShape = index;
             found = true;
         }
+    }
+    found |= traverse_bvh(scene.shapeBvh, origin, direction, TMIN, tLimit, [&](int first, int count, float &tHit) {
+        STAT_ADD(STAT_SHAPE_TESTS, count);
+        bool hit = false;
+        for (int i = first; i < first + count; i++) {
+            int index = scene.boundedShapes[i];
+            if (intersect_shape(scene.shapes[index], origin, direction, TMIN, tHit, tHit)) {
+                closestShape = index;
+                hit = true;
+            }
+        }
+        return hit;
+    });
+    if (!found) {
+        return false;
+    }
+    closestT = tLimit;
+    return true;
+}
 
-        if ((t2 < tMax) && (TMIN < t2) && (t2 < closestT)) {
-            closestT = t2;
-            closestSphere = sphere;
-            found = true;
+/* occluded_shapes()
+ * -----------------------
+ * occluded() for the shapes alone
+ *
+ * @param Scene scene
+ * @param Vec3 origin
+ * @param Vec3 direction
+ * @param float tMin
+ * @param float tMax
+ * @return bool
+ */
+bool occluded_shapes(const Scene &scene, Vec3 origin, Vec3 direction, float tMin, float tMax) {
+    float t;
+    STAT_ADD(STAT_SHAPE_TESTS, scene.unboundedShapes.size());
+    for (int index : scene.unboundedShapes) {
+        if (intersect_shape(scene.shapes[index], origin, direction, tMin, tMax, t)) {
+            return true;
         }
     }
-    return found;
+    return occluded_bvh(scene.shapeBvh, origin, direction, tMin, tMax, [&](int first, int count) {
+        STAT_ADD(STAT_SHAPE_TESTS, count);
+        for (int i = first; i < first + count; i++) {
+            if (intersect_shape(scene.shapes[scene.boundedShapes[i]], origin, direction, tMin, tMax, t)) {
+                return true;
+            }
+        }
+        return false;
+    });
 }
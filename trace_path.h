@@ -6,16 +6,99 @@
 #define RAYTRACINGFROMSCRATCH_TRACE_PATH_H
 
 #include "objects.h"
-#include "objects.h"
+#include "sampler.h"
+#include "scene.h"
+
+#define NUM_SAMPLES 100
+#define NUM_BOUNCES 4
+#define TMIN 0.001
+#define TMAX 1000
+// bounce rays start this far off the surface
+#define BOUNCE_OFFSET 0.0001f
+// Russian roulette starts after this many bounces, and keeps at most this share of paths
+#define RR_DEPTH 2
+#define RR_MAX_SURVIVAL 0.95f
+
+// lights evaluated one by one before switching to sampling them by power
+#define LIGHT_EXHAUSTIVE_LIMIT 8
+#define LIGHT_SAMPLES 4
+static_assert(LIGHT_SAMPLES <= LIGHT_EXHAUSTIVE_LIMIT, "light samples share the per light arrays");
+
+/* PathFeatures
+ * ------------------------
+ * What a path's camera ray hit first, for the denoiser: unit normal,
+ * albedo and distance along the ray. Rays that miss everything report no
+ * normal or albedo and the far end of the ray as depth
+ */
+typedef struct PathFeatures {
+    Vec3 normal {};
+    Vec3 albedo {};
+    float depth {0};
+} PathFeatures;
+
+/* LightSample
+ * ------------------------
+ * One shadow ray of the direct lighting at a point: the unnormalised
+ * direction to the light, how far along it the light is, the intensity
+ * the point reflects if nothing is in the way, and which light it is
+ */
+typedef struct LightSample {
+    Vec3 direction {};
+    float tMax {0};
+    float intensity {0};
+    int light {0};
+} LightSample;
 
-Vec3i trace_path(Vec3 point, Vec3 direction, Sphere objects[], Light lights[], int depth);
+enum PrimitiveType {
+    PRIMITIVE_NONE,
+    PRIMITIVE_SPHERE,
+    PRIMITIVE_TRIANGLE,
+    PRIMITIVE_SHAPE,
+};
+
+/* Hit
+ * ------------------------
+ * Closest hit of a ray, all shading needs to find the surface again: the
+ * distance along the ray, what kind of primitive was hit and its index in
+ * the scene's objects, packed triangles or shapes, the index of its material in the
+ * scene's material table, and for triangles the barycentrics of the hit
+ */
+typedef struct Hit {
+    float t {0};
+    PrimitiveType type {PRIMITIVE_NONE};
+    int primitive {-1};
+    int material {-1};
+    float u {0};
+    float v {0};
+} Hit;
+
+class IrradianceCache;
+
+Vec3 trace_path(Vec3 point, Vec3 direction, const Scene &scene, Sampler &sampler, int maxDepth = NUM_BOUNCES,
+                PathFeatures *features = nullptr, IrradianceCache *cache = nullptr);
 Vec3 vector_hemisphere(Vec3 point, Vec3 normal);
 void local_coordinates(Vec3 &normal, Vec3 &normalTangent, Vec3 &normalBiTangent);
 Vec3 sample_hemisphere(const float &r1, const float &r2);
 
-Vec3i direct_lighting_sphere(Vec3 origin, Vec3 transformed, Sphere closestSphere, float closestT, Sphere scene[], Light lights[]);
-bool intersect_ray_sphere(Vec3 origin, Vec3 direction, Sphere sphere, float &t1, float &t2);
-double compute_direct_lighting_sphere(Sphere scene[], Vec3 point, Vec3 normal, Vec3 view, Light lights[], int specular);
-bool closest_intersection_sphere(Sphere scene[], Vec3 origin, Vec3 transformed, float tMax, Sphere &closestSphere, float &closestT);
+bool closest_hit(const Scene &scene, Vec3 origin, Vec3 direction, float tMax, Hit &hit);
+bool resolve_hit(const Scene &scene, Vec3 origin, Vec3 direction, float t, int shape, int sphere, int triangle, Hit &hit);
+Vec3 hit_normal(const Scene &scene, const Hit &hit, Vec3 point, Vec3 direction);
+Vec3 direct_lighting(const Scene &scene, const Material &material, Vec3 point, Vec3 normal, Vec3 direction, Sampler &sampler,
+                     bool weighted = false);
+bool intersect_ray_sphere(Vec3 origin, Vec3 direction, const Sphere &sphere, float &t1, float &t2);
+double compute_direct_lighting_sphere(const Scene &scene, Vec3 point, Vec3 normal, Vec3 view, int specular, Sampler &sampler,
+                                      bool weighted = false);
+int sample_direct_lighting(const Scene &scene, Vec3 point, Vec3 normal, Vec3 view, int specular, Sampler &sampler, bool weighted,
+                           LightSample samples[]);
+float area_light_emission(const LightSoA &lights, Vec3 origin, Vec3 direction, float tMax, float bsdfPdf);
+bool closest_intersection_sphere_index(const Scene &scene, Vec3 origin, Vec3 transformed, float tMax, int &closestIndex, float &closestT);
+
+bool occluded(const Scene &scene, Vec3 origin, Vec3 direction, float tMin, float tMax);
+void occluded_batch(const Scene &scene, Vec3 origin, const Vec3 directions[], float tMin, const float tMax[], int count, bool blocked[]);
+
+Vec3 triangle_normal(const MeshTriangle &triangle, Vec3 direction);
+bool closest_intersection_triangle(const Scene &scene, Vec3 origin, Vec3 transformed, float tMax, int &closestTriangle, float &closestT);
+bool closest_intersection_shape(const Scene &scene, Vec3 origin, Vec3 direction, float tMax, int &closestShape, float &closestT);
+bool occluded_shapes(const Scene &scene, Vec3 origin, Vec3 direction, float tMin, float tMax);
 
 #endif //RAYTRACINGFROMSCRATCH_TRACE_PATH_H
@@ -6,8 +6,6 @@
 #include <cmath>
 #include "trace_ray_simple.h"
 
-#define OBJECTS 6
-
 /* trace_ray()
  * -----------------------
  * Calculates ray outwards from camera through viewport
@@ -0,0 +1,691 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "wavefront.h"
+#include "arena.h"
+#include "bsdf.h"
+#include "irradiance_cache.h"
+#include "packet.h"
+#include "trace_path.h"
+
+/* RayQueue
+ * ------------------------
+ * Rays waiting for the intersect stage, one array per component so the
+ * stage streams through them. path is the path a ray belongs to, -1 for a
+ * slot whose path has ended
+ */
+typedef struct RayQueue {
+    float *originX, *originY, *originZ;
+    float *directionX, *directionY, *directionZ;
+    int *path;
+
+    void allocate(FrameArena &arena, size_t size) {
+        for (float **component : {&originX, &originY, &originZ, &directionX, &directionY, &directionZ}) {
+            *component = arena.allocate<float>(size);
+        }
+        path = arena.allocate<int>(size);
+    }
+    void set(int slot, Vec3 origin, Vec3 direction, int pathIndex) {
+        originX[slot] = origin.x;
+        originY[slot] = origin.y;
+        originZ[slot] = origin.z;
+        directionX[slot] = direction.x;
+        directionY[slot] = direction.y;
+        directionZ[slot] = direction.z;
+        path[slot] = pathIndex;
+    }
+    Vec3 origin(int slot) const {
+        return Vec3 {originX[slot], originY[slot], originZ[slot]};
+    }
+    Vec3 direction(int slot) const {
+        return Vec3 {directionX[slot], directionY[slot], directionZ[slot]};
+    }
+} RayQueue;
+
+/* HitQueue
+ * ------------------------
+ * What each ray of the queue hit, by slot, as the compact hit record
+ * trace_path() shades from. The shade stage groups slots by its material,
+ * misses first
+ */
+typedef struct HitQueue {
+    Hit *record;
+
+    void allocate(FrameArena &arena, size_t size) {
+        record = arena.allocate<Hit>(size);
+    }
+} HitQueue;
+
+/* PathState
+ * ------------------------
+ * Everything a path carries from one bounce to the next, by path index,
+ * and its shadow queue: up to shadowSlots light samples from its latest
+ * hit, which reflect shadowWeight times their intensity if they get
+ * through
+ */
+typedef struct PathState {
+    Sampler *samplers;
+    Vec3 *throughput;
+    Vec3 *radiance;
+    float *bsdfPdf;
+    PathFeatures *features;
+    int shadowSlots;
+    Vec3 *shadowOrigin;
+    Vec3 *shadowWeight;
+    int *shadowCount;
+    LightSample *shadowRays;
+} PathState;
+
+/* Wavefront
+ * ------------------------
+ * The queues of one wave. Shading writes the next bounce of the ray in a
+ * slot to the same slot of next, the sort stage gathers the live ones back
+ * into rays. keys and order, with their scratch copies, hold the sorts,
+ * which count into one histogram and one live count per slice of the
+ * queue. Every array is taken from the frame arena of the thread running
+ * the pass
+ */
+typedef struct Wavefront {
+    RayQueue rays;
+    RayQueue next;
+    HitQueue hits;
+    PathState paths;
+    uint32_t *keys, *keyScratch;
+    int *order, *orderScratch;
+    uint32_t *histograms;
+    int *sliceLive;
+} Wavefront;
+
+/* slice_count()
+ * ----------------------------------------
+ * Slices the sorts split [0, count) into, one per worker but none shorter
+ * than WAVEFRONT_CHUNK. Slice i covers [count * i / slices,
+ * count * (i + 1) / slices), see slice_range()
+ */
+static int slice_count(const ThreadPool &pool, int count) {
+    return std::max(std::min(pool.size(), (count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK), 1);
+}
+
+static void slice_range(int slice, int slices, int count, int &first, int &last) {
+    first = static_cast<int>(static_cast<int64_t>(count) * slice / slices);
+    last = static_cast<int>(static_cast<int64_t>(count) * (slice + 1) / slices);
+}
+
+/* radix_sort()
+ * ----------------------------------------
+ * Stable LSD radix sort of the first count keys, WAVEFRONT_RADIX_BITS per
+ * pass, moving values along with them. Each pass counts a histogram per
+ * slice on the pool, turns them into where each slice's keys of a bucket
+ * start, bucket by bucket and slice by slice within a bucket, and
+ * scatters the slices on the pool again. A slice writes its keys of a
+ * bucket after those of the slices before it, so the result is the same
+ * however many slices there are
+ *
+ * @param ThreadPool pool
+ * @param Wavefront wavefront keys and order to sort, their scratch and
+ *        the histograms
+ * @param int count
+ * @param int bits significant bits of the keys
+ */
+static void radix_sort(ThreadPool &pool, Wavefront &wavefront, int count, int bits) {
+    const int buckets = 1 << WAVEFRONT_RADIX_BITS;
+    const uint32_t mask = buckets - 1;
+    int slices = slice_count(pool, count);
+    for (int shift = 0; shift < bits; shift += WAVEFRONT_RADIX_BITS) {
+        pool.run(slices, [&](int slice, int) {
+            STAT_TIMER(STAGE_SORT);
+            uint32_t *histogram = &wavefront.histograms[slice * buckets];
+            std::fill(histogram, histogram + buckets, 0u);
+            int first, last;
+            slice_range(slice, slices, count, first, last);
+            for (int i = first; i < last; i++) {
+                histogram[(wavefront.keys[i] >> shift) & mask]++;
+            }
+        });
+        {
+            STAT_TIMER(STAGE_SORT);
+            uint32_t offset = 0;
+            for (int bucket = 0; bucket < buckets; bucket++) {
+                for (int slice = 0; slice < slices; slice++) {
+                    uint32_t &entry = wavefront.histograms[slice * buckets + bucket];
+                    uint32_t size = entry;
+                    entry = offset;
+                    offset += size;
+                }
+            }
+        }
+        pool.run(slices, [&](int slice, int) {
+            STAT_TIMER(STAGE_SORT);
+            uint32_t *histogram = &wavefront.histograms[slice * buckets];
+            int first, last;
+            slice_range(slice, slices, count, first, last);
+            for (int i = first; i < last; i++) {
+                uint32_t position = histogram[(wavefront.keys[i] >> shift) & mask]++;
+                wavefront.keyScratch[position] = wavefront.keys[i];
+                wavefront.orderScratch[position] = wavefront.order[i];
+            }
+        });
+        std::swap(wavefront.keys, wavefront.keyScratch);
+        std::swap(wavefront.order, wavefront.orderScratch);
+    }
+}
+
+/* spread_bits()
+ * ----------------------------------------
+ * Move the low 10 bits of a value to every third bit, for morton codes
+ */
+static uint32_t spread_bits(uint32_t value) {
+    value &= 0x3ff;
+    value = (value | value << 16) & 0x030000ff;
+    value = (value | value << 8) & 0x0300f00f;
+    value = (value | value << 4) & 0x030c30c3;
+    value = (value | value << 2) & 0x09249249;
+    return value;
+}
+
+/* ray_key()
+ * ----------------------------------------
+ * Sort key of a bounce ray: the octant of its direction above the morton
+ * code of the grid cell its origin is in
+ *
+ * @param Vec3 origin
+ * @param Vec3 direction
+ * @param Aabb bounds of the scene
+ * @param Vec3 scale cells per unit on each axis
+ * @return uint32_t key of 3 + 3 * WAVEFRONT_CELL_BITS bits
+ */
+static uint32_t ray_key(Vec3 origin, Vec3 direction, const Aabb &bounds, Vec3 scale) {
+    const float last = static_cast<float>((1 << WAVEFRONT_CELL_BITS) - 1);
+    Vec3 cell = origin - bounds.min;
+    uint32_t x = static_cast<uint32_t>(std::min(std::max(cell.x * scale.x, 0.0f), last));
+    uint32_t y = static_cast<uint32_t>(std::min(std::max(cell.y * scale.y, 0.0f), last));
+    uint32_t z = static_cast<uint32_t>(std::min(std::max(cell.z * scale.z, 0.0f), last));
+    uint32_t octant = (direction.x < 0) | (direction.y < 0) << 1 | (direction.z < 0) << 2;
+    return octant << (3 * WAVEFRONT_CELL_BITS) | spread_bits(x) | spread_bits(y) << 1 | spread_bits(z) << 2;
+}
+
+/* scene_bounds()
+ * ----------------------------------------
+ * Bounds of everything in the scene's BVHs, which leave out the planes, a
+ * unit box around the origin for an empty scene
+ */
+static Aabb scene_bounds(const Scene &scene) {
+    Aabb bounds;
+    for (const Bvh *bvh : {&scene.sphereBvh, &scene.triangleBvh, &scene.shapeBvh}) {
+        if (!bvh->nodes.empty()) {
+            const BvhNode &root = bvh->nodes[0];
+            bounds.grow(Vec3 {root.minX, root.minY, root.minZ});
+            bounds.grow(Vec3 {root.maxX, root.maxY, root.maxZ});
+        }
+    }
+    if (bounds.min.x > bounds.max.x) {
+        bounds.grow(Vec3 {-1, -1, -1});
+        bounds.grow(Vec3 {1, 1, 1});
+    }
+    return bounds;
+}
+
+/* run_chunks()
+ * ----------------------------------------
+ * Run fn(first, last) over [0, count) on the pool in WAVEFRONT_CHUNK sized
+ * pieces
+ */
+template<typename Fn>
+static void run_chunks(ThreadPool &pool, int count, Fn fn) {
+    int chunks = (count + WAVEFRONT_CHUNK - 1) / WAVEFRONT_CHUNK;
+    pool.run(chunks, [&](int chunk, int) {
+        int first = chunk * WAVEFRONT_CHUNK;
+        fn(first, std::min(first + WAVEFRONT_CHUNK, count));
+    });
+}
+
+/* generate_rays()
+ * ----------------------------------------
+ * Start one path per sample of every pixel of the wave, the samples of a
+ * pixel next to each other, and queue their camera rays in the same order
+ *
+ * @return int paths started
+ */
+static int generate_rays(ThreadPool &pool, Wavefront &wavefront, const Framebuffer &framebuffer, Vec3 origin, const int pixels[],
+                         int pixelCount, int samples) {
+    int count = pixelCount * samples;
+    run_chunks(pool, count, [&](int first, int last) {
+        STAT_TIMER(STAGE_GENERATE);
+        for (int path = first; path < last; path++) {
+            int pixel = pixels[path / samples];
+            int px = pixel % framebuffer.width;
+            int py = pixel / framebuffer.width;
+            int sample = static_cast<int>(framebuffer.sampleCount[pixel]) + path % samples;
+            wavefront.paths.samplers[path].start_sample(px, py, sample, framebuffer.passes);
+            wavefront.paths.throughput[path] = Vec3 {1, 1, 1};
+            wavefront.paths.radiance[path] = Vec3 {0, 0, 0};
+            wavefront.paths.bsdfPdf[path] = 0;
+
+            // screen pixels run top down, the canvas is centred with y pointing up
+            Vec3 direction = view_to_canvas(px - framebuffer.width / 2, framebuffer.height / 2 - py - 1, framebuffer.width,
+                                            framebuffer.height);
+            wavefront.rays.set(path, origin, direction, path);
+        }
+        STAT_ADD(STAT_CAMERA_RAYS, last - first);
+    });
+    return count;
+}
+
+/* sort_rays()
+ * ----------------------------------------
+ * Gather the live bounce rays of next into the ray queue, sorted by
+ * ray_key(). The live rays of each slice are counted on the pool and
+ * packed after those of the slices before it, keeping their slot order
+ *
+ * @return int rays queued
+ */
+static int sort_rays(ThreadPool &pool, Wavefront &wavefront, int count, const Aabb &bounds, Vec3 scale) {
+    const RayQueue &next = wavefront.next;
+    int slices = slice_count(pool, count);
+    pool.run(slices, [&](int slice, int) {
+        STAT_TIMER(STAGE_SORT);
+        int first, last;
+        slice_range(slice, slices, count, first, last);
+        int live = 0;
+        for (int slot = first; slot < last; slot++) {
+            live += next.path[slot] >= 0;
+        }
+        wavefront.sliceLive[slice] = live;
+    });
+    int live = 0;
+    for (int slice = 0; slice < slices; slice++) {
+        int size = wavefront.sliceLive[slice];
+        wavefront.sliceLive[slice] = live;
+        live += size;
+    }
+    pool.run(slices, [&](int slice, int) {
+        STAT_TIMER(STAGE_SORT);
+        int first, last;
+        slice_range(slice, slices, count, first, last);
+        int position = wavefront.sliceLive[slice];
+        for (int slot = first; slot < last; slot++) {
+            if (next.path[slot] >= 0) {
+                wavefront.keys[position] = ray_key(next.origin(slot), next.direction(slot), bounds, scale);
+                wavefront.order[position] = slot;
+                position++;
+            }
+        }
+    });
+    radix_sort(pool, wavefront, live, 3 + 3 * WAVEFRONT_CELL_BITS);
+    run_chunks(pool, live, [&](int first, int last) {
+        STAT_TIMER(STAGE_SORT);
+        for (int i = first; i < last; i++) {
+            int slot = wavefront.order[i];
+            wavefront.rays.set(i, next.origin(slot), next.direction(slot), next.path[slot]);
+        }
+    });
+    return live;
+}
+
+/* intersect_rays()
+ * ----------------------------------------
+ * Closest hit of every queued ray against the spheres and triangles. With
+ * packetSize the camera rays go in packets of that many consecutive slots,
+ * neighbouring pixels of a row or samples of one pixel
+ */
+static void intersect_rays(ThreadPool &pool, Wavefront &wavefront, const Scene &scene, int count, int depth, int packetSize) {
+    run_chunks(pool, count, [&](int first, int last) {
+        STAT_TIMER(STAGE_INTERSECT);
+        if (depth > 0) {
+            STAT_ADD(STAT_INDIRECT_RAYS, last - first);
+        }
+        const RayQueue &rays = wavefront.rays;
+        HitQueue &hits = wavefront.hits;
+        if (depth == 0 && packetSize > 0) {
+            RayPacket packet;
+            PacketHits packetHits;
+            for (int slot = first; slot < last; slot += packetSize) {
+                packet.count = std::min(packetSize, last - slot);
+                for (int lane = 0; lane < packet.count; lane++) {
+                    packet.set(lane, rays.origin(slot + lane), rays.direction(slot + lane), TMAX);
+                }
+                intersect_packet(scene, packet, packetSize, packetHits);
+                for (int lane = 0; lane < packet.count; lane++) {
+                    resolve_hit(scene, rays.origin(slot + lane), rays.direction(slot + lane), packetHits.t[lane], packetHits.shape[lane],
+                                packetHits.sphere[lane], packetHits.triangle[lane], hits.record[slot + lane]);
+                }
+            }
+            return;
+        }
+        for (int slot = first; slot < last; slot++) {
+            closest_hit(scene, rays.origin(slot), rays.direction(slot), TMAX, hits.record[slot]);
+        }
+    });
+}
+
+/* group_by_material()
+ * ----------------------------------------
+ * Order the slots of the queue by the material of their hit, misses first,
+ * leaving the shading order in wavefront.order
+ */
+static void group_by_material(ThreadPool &pool, Wavefront &wavefront, const Scene &scene, int count) {
+    uint32_t materials = static_cast<uint32_t>(scene.materials.size()) + 1;
+    int bits = 1;
+    while (bits < 32 && (materials >> bits) != 0) {
+        bits++;
+    }
+    run_chunks(pool, count, [&](int first, int last) {
+        STAT_TIMER(STAGE_SORT);
+        for (int slot = first; slot < last; slot++) {
+            wavefront.keys[slot] = static_cast<uint32_t>(wavefront.hits.record[slot].material + 1);
+            wavefront.order[slot] = slot;
+        }
+    });
+    radix_sort(pool, wavefront, count, bits);
+}
+
+/* shade_hits()
+ * ----------------------------------------
+ * One bounce of trace_path() for every queued ray, in material order: add
+ * the area lights the ray passed, record the first hit features, queue the
+ * light samples of the hit in the path's shadow queue and write the next
+ * bounce, if the path goes on, to the ray's slot of next
+ */
+static void shade_hits(ThreadPool &pool, Wavefront &wavefront, const Scene &scene, const RenderSettings &settings, int count,
+                       int depth) {
+    const LightSoA &lights = scene.lightSoA;
+    run_chunks(pool, count, [&](int first, int last) {
+        STAT_TIMER(STAGE_SHADE);
+        const RayQueue &rays = wavefront.rays;
+        const HitQueue &hits = wavefront.hits;
+        PathState &paths = wavefront.paths;
+        for (int i = first; i < last; i++) {
+            int slot = wavefront.order[i];
+            int path = rays.path[slot];
+            Vec3 origin = rays.origin(slot);
+            Vec3 direction = rays.direction(slot);
+            const Hit &hit = hits.record[slot];
+            bool found = hit.type != PRIMITIVE_NONE;
+            paths.shadowCount[path] = 0;
+            wavefront.next.path[slot] = -1;
+
+            if (depth > 0 && !lights.areaLights.empty()) {
+                float tLight = found ? hit.t : TMAX;
+                paths.radiance[path] += paths.throughput[path] * area_light_emission(lights, origin, direction, tLight, paths.bsdfPdf[path]);
+            }
+            if (!found) {
+                if (depth == 0) {
+                    paths.features[path] = PathFeatures {Vec3 {0, 0, 0}, Vec3 {0, 0, 0}, TMAX};
+                }
+                continue;
+            }
+
+            // a path that goes on from here samples the BSDF, so the direct lighting shares area lights with it
+            bool cached = depth == 0 && settings.irradianceCache != nullptr && settings.maxDepth > 0;
+            bool continues = depth < settings.maxDepth && !cached;
+
+            Vec3 point = origin + direction * hit.t;
+            Vec3 normal = hit_normal(scene, hit, point, direction);
+            const Material &material = scene.materials[hit.material];
+            Vec3 reflectance = material.albedo;
+            int specular = material.specular;
+            if (depth == 0) {
+                paths.features[path] = PathFeatures {normal, reflectance, hit.t};
+            }
+
+            // the ambient light now, the light samples once the shadow stage has traced them
+            Vec3 weight = paths.throughput[path].multiply(reflectance);
+            Sampler &sampler = paths.samplers[path];
+            paths.radiance[path] += weight * lights.ambient;
+            if (lights.count > 0) {
+                LightSample *samples = &paths.shadowRays[static_cast<size_t>(path) * paths.shadowSlots];
+                paths.shadowCount[path] = sample_direct_lighting(scene, point, normal, -direction, specular, sampler, continues, samples);
+                paths.shadowOrigin[path] = point;
+                paths.shadowWeight[path] = weight;
+            }
+
+            if (depth == settings.maxDepth) {
+                continue;
+            }
+
+            // the diffuse reflection of the irradiance E is albedo / pi * E
+            if (cached) {
+                Vec3 irradiance {};
+                if (!settings.irradianceCache->lookup(point, normal, irradiance)) {
+                    IrradianceRecord record = compute_irradiance_record(scene, point, normal, settings.maxDepth - 1);
+                    settings.irradianceCache->insert(record);
+                    irradiance = record.irradiance;
+                }
+                paths.radiance[path] += weight.multiply(irradiance) * static_cast<float>(M_1_PI);
+                continue;
+            }
+
+            // draw the next direction from the BSDF of the hit
+            Vec3 view = (-direction).normalize();
+            float u, v;
+            sampler.get_2d(u, v);
+            float lobe = sampler.get_1d();
+            Vec3 sample {};
+            float &bsdfPdf = paths.bsdfPdf[path];
+            if (!sample_phong(normal, view, specular, u, v, lobe, sample, bsdfPdf)) {
+                continue;
+            }
+            Vec3 &throughput = paths.throughput[path];
+            throughput = weight * (phong_brdf(normal, view, specular, sample) * normal.dot(sample) / bsdfPdf);
+
+            // Russian roulette, survivors carry the energy of the terminated paths
+            float roulette = sampler.get_1d();
+            if (depth + 1 >= RR_DEPTH) {
+                float survival = std::min(std::max(std::max(throughput.x, throughput.y), throughput.z), RR_MAX_SURVIVAL);
+                if (roulette >= survival) {
+                    continue;
+                }
+                throughput *= 1.0f / survival;
+            }
+            wavefront.next.set(slot, point + sample * BOUNCE_OFFSET, sample, path);
+        }
+    });
+}
+
+/* trace_shadow_packets()
+ * ----------------------------------------
+ * The shadow rays of the paths in slots [first, last), gathered by the
+ * light they run to and traced in packets of packetSize, each packet a run
+ * of neighbouring hits towards one light. A ray left on its own is traced
+ * singly. The samples that get through are added in the order they were
+ * drawn, so the paths end up with the same radiance as without packets
+ */
+static void trace_shadow_packets(Wavefront &wavefront, const Scene &scene, int first, int last, int packetSize) {
+    PathState &paths = wavefront.paths;
+    uint64_t rays[WAVEFRONT_CHUNK * LIGHT_EXHAUSTIVE_LIMIT];
+    bool blocked[WAVEFRONT_CHUNK * LIGHT_EXHAUSTIVE_LIMIT];
+    int count = 0;
+    for (int slot = first; slot < last; slot++) {
+        int path = wavefront.rays.path[slot];
+        const LightSample *samples = &paths.shadowRays[static_cast<size_t>(path) * paths.shadowSlots];
+        for (int i = 0; i < paths.shadowCount[path]; i++) {
+            uint64_t entry = static_cast<uint64_t>(slot - first) * paths.shadowSlots + i;
+            rays[count++] = static_cast<uint64_t>(samples[i].light) << 32 | entry;
+        }
+    }
+    STAT_ADD(STAT_SHADOW_RAYS, count);
+    std::sort(rays, rays + count);
+
+    RayPacket packet;
+    for (int start = 0; start < count; start += packet.count) {
+        uint64_t light = rays[start] >> 32;
+        packet.count = 0;
+        while (packet.count < packetSize && start + packet.count < count && rays[start + packet.count] >> 32 == light) {
+            uint32_t entry = static_cast<uint32_t>(rays[start + packet.count]);
+            int path = wavefront.rays.path[first + static_cast<int>(entry) / paths.shadowSlots];
+            const LightSample &sample = paths.shadowRays[static_cast<size_t>(path) * paths.shadowSlots + entry % paths.shadowSlots];
+            packet.set(packet.count++, paths.shadowOrigin[path], sample.direction, sample.tMax);
+        }
+        if (packet.count == 1) {
+            Vec3 origin {packet.originX[0], packet.originY[0], packet.originZ[0]};
+            Vec3 direction {packet.directionX[0], packet.directionY[0], packet.directionZ[0]};
+            blocked[static_cast<uint32_t>(rays[start])] = occluded(scene, origin, direction, TMIN, packet.tMax[0]);
+            continue;
+        }
+        uint32_t mask = occluded_packet(scene, packet, packetSize, TMIN);
+        for (int lane = 0; lane < packet.count; lane++) {
+            blocked[static_cast<uint32_t>(rays[start + lane])] = (mask >> lane) & 1;
+        }
+    }
+
+    for (int slot = first; slot < last; slot++) {
+        int path = wavefront.rays.path[slot];
+        const LightSample *samples = &paths.shadowRays[static_cast<size_t>(path) * paths.shadowSlots];
+        const bool *pathBlocked = &blocked[static_cast<size_t>(slot - first) * paths.shadowSlots];
+        float intensity = 0;
+        for (int i = 0; i < paths.shadowCount[path]; i++) {
+            if (!pathBlocked[i]) {
+                intensity += samples[i].intensity;
+            }
+        }
+        if (paths.shadowCount[path] > 0) {
+            paths.radiance[path] += paths.shadowWeight[path] * intensity;
+        }
+    }
+}
+
+/* trace_shadow_rays()
+ * ----------------------------------------
+ * Trace the shadow queues of the paths in ray queue order, each as one
+ * occluded_batch() from its hit, or in packets with trace_shadow_packets(),
+ * and add the samples that get through. Timed as shading too, which the
+ * stats report without the shadow rays
+ */
+static void trace_shadow_rays(ThreadPool &pool, Wavefront &wavefront, const Scene &scene, int count, int packetSize) {
+    run_chunks(pool, count, [&](int first, int last) {
+        STAT_TIMER(STAGE_SHADE);
+        STAT_TIMER(STAGE_SHADOW);
+        if (packetSize > 0) {
+            trace_shadow_packets(wavefront, scene, first, last, packetSize);
+            return;
+        }
+        PathState &paths = wavefront.paths;
+        Vec3 directions[LIGHT_EXHAUSTIVE_LIMIT];
+        float tMax[LIGHT_EXHAUSTIVE_LIMIT];
+        bool blocked[LIGHT_EXHAUSTIVE_LIMIT];
+        for (int slot = first; slot < last; slot++) {
+            int path = wavefront.rays.path[slot];
+            int rays = paths.shadowCount[path];
+            if (rays == 0) {
+                continue;
+            }
+            const LightSample *samples = &paths.shadowRays[static_cast<size_t>(path) * paths.shadowSlots];
+            for (int i = 0; i < rays; i++) {
+                directions[i] = samples[i].direction;
+                tMax[i] = samples[i].tMax;
+            }
+            STAT_ADD(STAT_SHADOW_RAYS, rays);
+            occluded_batch(scene, paths.shadowOrigin[path], directions, TMIN, tMax, rays, blocked);
+
+            float intensity = 0;
+            for (int i = 0; i < rays; i++) {
+                if (!blocked[i]) {
+                    intensity += samples[i].intensity;
+                }
+            }
+            paths.radiance[path] += paths.shadowWeight[path] * intensity;
+        }
+    });
+}
+
+/* render_pass_wavefront()
+ * ----------------------------------------
+ * render_pass() in stages, see wavefront.h. The pixels adaptive sampling
+ * has not retired are split into waves of whole pixels, each wave is
+ * traced to the end and accumulated, and the tiles are published once the
+ * last wave is done. The tile cost heatmap is not kept in this mode
+ *
+ * @param ThreadPool pool
+ * @param[out] Framebuffer framebuffer
+ * @param Vec3 origin
+ * @param Scene scene
+ * @param RenderSettings settings
+ * @return int pixels that were sampled
+ */
+int render_pass_wavefront(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings) {
+    int samples = std::max(settings.samplesPerPixel, 1);
+    bool adaptive = settings.errorThreshold > 0;
+    FrameArena &arena = frame_arena();
+    int *pixels = arena.allocate<int>(static_cast<size_t>(framebuffer.width) * framebuffer.height);
+    int pixelCount = 0;
+    for (int py = 0; py < framebuffer.height; py++) {
+        for (int px = 0; px < framebuffer.width; px++) {
+            int pixel = py * framebuffer.width + px;
+            if (adaptive && static_cast<int>(framebuffer.sampleCount[pixel]) >= settings.minSamples &&
+                framebuffer.error(px, py) < settings.errorThreshold) {
+                continue;
+            }
+            pixels[pixelCount++] = pixel;
+        }
+    }
+
+    int pixelsPerWave = std::max(WAVEFRONT_PATHS / samples, 1);
+    size_t capacity = static_cast<size_t>(std::min(pixelsPerWave, pixelCount)) * samples;
+    Wavefront wavefront;
+    wavefront.rays.allocate(arena, capacity);
+    wavefront.next.allocate(arena, capacity);
+    wavefront.hits.allocate(arena, capacity);
+    for (uint32_t **keys : {&wavefront.keys, &wavefront.keyScratch}) {
+        *keys = arena.allocate<uint32_t>(capacity);
+    }
+    for (int **order : {&wavefront.order, &wavefront.orderScratch}) {
+        *order = arena.allocate<int>(capacity);
+    }
+    wavefront.histograms = arena.allocate<uint32_t>(static_cast<size_t>(pool.size()) << WAVEFRONT_RADIX_BITS);
+    wavefront.sliceLive = arena.allocate<int>(pool.size());
+    PathState &paths = wavefront.paths;
+    paths.samplers = arena.allocate<Sampler>(capacity, Sampler(settings.sampler, samples));
+    paths.throughput = arena.allocate<Vec3>(capacity);
+    paths.radiance = arena.allocate<Vec3>(capacity);
+    paths.bsdfPdf = arena.allocate<float>(capacity);
+    paths.features = arena.allocate<PathFeatures>(capacity);
+    paths.shadowSlots = std::min(scene.lightSoA.count, LIGHT_EXHAUSTIVE_LIMIT);
+    paths.shadowOrigin = arena.allocate<Vec3>(capacity);
+    paths.shadowWeight = arena.allocate<Vec3>(capacity);
+    paths.shadowCount = arena.allocate<int>(capacity);
+    paths.shadowRays = arena.allocate<LightSample>(capacity * paths.shadowSlots);
+
+    Aabb bounds = scene_bounds(scene);
+    Vec3 extent = bounds.max - bounds.min;
+    const float cells = static_cast<float>(1 << WAVEFRONT_CELL_BITS);
+    Vec3 scale = {cells / std::max(extent.x, 1e-6f), cells / std::max(extent.y, 1e-6f), cells / std::max(extent.z, 1e-6f)};
+
+    for (int firstPixel = 0; firstPixel < pixelCount; firstPixel += pixelsPerWave) {
+        int wavePixels = std::min(pixelCount - firstPixel, pixelsPerWave);
+        int count = generate_rays(pool, wavefront, framebuffer, origin, &pixels[firstPixel], wavePixels, samples);
+
+        for (int depth = 0; depth <= settings.maxDepth; depth++) {
+            if (depth > 0) {
+                count = sort_rays(pool, wavefront, count, bounds, scale);
+            }
+            if (count == 0) {
+                break;
+            }
+            intersect_rays(pool, wavefront, scene, count, depth, settings.packetSize);
+            group_by_material(pool, wavefront, scene, count);
+            shade_hits(pool, wavefront, scene, settings, count, depth);
+            trace_shadow_rays(pool, wavefront, scene, count, settings.packetSize);
+        }
+
+        run_chunks(pool, wavePixels, [&](int first, int last) {
+            for (int i = first; i < last; i++) {
+                size_t path = static_cast<size_t>(i) * samples;
+                accumulate_pixel(framebuffer, pixels[firstPixel + i], &paths.radiance[path], &paths.features[path], samples);
+            }
+        });
+    }
+
+    int tilesX = (framebuffer.width + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (framebuffer.height + TILE_SIZE - 1) / TILE_SIZE;
+    pool.run(tilesX * tilesY, [&](int tile, int) {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        publish_tile(framebuffer, x0, y0, std::min(x0 + TILE_SIZE, framebuffer.width), std::min(y0 + TILE_SIZE, framebuffer.height));
+    });
+    framebuffer.passes++;
+    return pixelCount;
+}
@@ -0,0 +1,41 @@
+//
+// Created by aliebs on 18/10/26.
+//
+
+#ifndef RAYTRACINGFROMSCRATCH_WAVEFRONT_H
+#define RAYTRACINGFROMSCRATCH_WAVEFRONT_H
+
+#include "renderer.h"
+
+// paths in flight at once, whole pixels are taken until a wave is this large
+#define WAVEFRONT_PATHS (1 << 16)
+// rays per pool job in the parallel stages
+#define WAVEFRONT_CHUNK 1024
+// bounce rays are sorted by the cell of a 2^bits grid per axis over the scene their origin lies in
+#define WAVEFRONT_CELL_BITS 9
+#define WAVEFRONT_RADIX_BITS 10
+
+/* Wavefront rendering
+ * ------------------------
+ * The same estimator as trace_path(), but run one stage at a time over a
+ * wave of up to WAVEFRONT_PATHS paths rather than one path at a time from
+ * start to end. Every bounce of a wave goes through
+ *
+ * generate   camera rays for every path of the wave's pixels
+ * sort       bounce rays ordered by direction octant, then by the morton
+ *            code of the grid cell their origin is in, so neighbouring rays
+ *            walk the same BVH nodes
+ * intersect  closest hits of the whole ray queue
+ * shade      hits grouped by the material they landed on: emission,
+ *            first hit features, light samples and the next BSDF sample
+ * shadow     the light samples' shadow rays, in ray queue order
+ *
+ * and once no path is left, accumulate folds the paths into their pixels.
+ * Rays and hits are kept in queues with one array per component. A path
+ * draws its random numbers in the same order either way, so both modes
+ * render the same image. With packets the intersect stage traces the camera
+ * rays and the shadow stage every shadow ray in packets, see packet.h
+ */
+int render_pass_wavefront(ThreadPool &pool, Framebuffer &framebuffer, Vec3 origin, const Scene &scene, const RenderSettings &settings);
+
+#endif //RAYTRACINGFROMSCRATCH_WAVEFRONT_H